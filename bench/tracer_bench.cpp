@@ -0,0 +1,551 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Tracing Benchmarks
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+// Measures RayTracing::TraceRay throughput over synthetic voxel & mesh scenes for primary, shadow &
+// diffuse bounce rays under every AnyHitBehavior, then sweeps the thread count. Results are JSON on
+// stdout (or --output), progress goes to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "raytracing.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "scene/demo.h"
+#include "scene/voxelgrid.h"
+#include "scene/brickmap.h"
+#include "scene/octree.h"
+#include "scene/compressed.h"
+#include "scene/bvh.h"
+#include "scene/bvh8.h"
+
+typedef RayTracing::AnyHitBehavior AnyHitBehavior;
+
+struct BenchOptions
+{
+    size_t width = 512;
+    size_t height = 288;
+    int repeats = 7;
+    std::vector<size_t> threads; // Sweep, powers of two up to the hardware threads by default
+    std::string filter;          // Only cases whose name contains it
+    std::string output;
+};
+
+struct RaySet
+{
+    const char* name;
+    std::vector<Ray> rays;
+};
+
+struct Timing
+{
+    double min, p10, median, p90, max;
+};
+
+static const AnyHitBehavior AnyHitModes[] = {
+    AnyHitBehavior::COMMIT_AND_CONTINUE,
+    AnyHitBehavior::IGNORE_AND_CONTINUE,
+    AnyHitBehavior::COMMIT_AND_RETURN,
+    AnyHitBehavior::CALL_HANDLER
+};
+
+static const char* AnyHitName(AnyHitBehavior mode)
+{
+    switch (mode)
+    {
+    case AnyHitBehavior::COMMIT_AND_CONTINUE: return "COMMIT_AND_CONTINUE";
+    case AnyHitBehavior::IGNORE_AND_CONTINUE: return "IGNORE_AND_CONTINUE";
+    case AnyHitBehavior::COMMIT_AND_RETURN: return "COMMIT_AND_RETURN";
+    default: return "CALL_HANDLER";
+    }
+}
+
+// Rays per ParallelFor index
+static const size_t BlockSize = 256;
+
+// Traversal of the inline scenes has no side effects, so a trace that ignores every hit leaves the
+// ray untouched & the compiler may drop it entirely. An opaque use of each step keeps the loop.
+template <typename SceneT>
+class Opaque
+{
+public:
+    typedef typename SceneT::RayContext RayContext;
+
+    Opaque(const SceneT& sc) : sc(sc) {}
+
+    inline bool Traverse(RayContext& c, Ray& r) const
+    {
+        bool hit = sc.Traverse(c, r);
+#if defined(_MSC_VER)
+        _ReadWriteBarrier();
+#else
+        asm volatile("" : : "r"(hit));
+#endif
+        return hit;
+    }
+
+private:
+    const SceneT& sc;
+};
+
+template <AnyHitBehavior Mode, typename SceneT>
+static void TraceBlock(const SceneT& sc, const Ray* in, Ray* out, size_t begin, size_t end)
+{
+    RayTracing rt;
+    Opaque<SceneT> opaque(sc);
+
+    for (size_t i = begin; i < end; i++)
+    {
+        out[i] = in[i];
+
+        // The handler commits like COMMIT_AND_CONTINUE, what is measured is the call
+        rt.TraceRay<Mode>(opaque, out[i], [](const RayTracing&, const Ray&, void*) { return AnyHitBehavior::COMMIT_AND_CONTINUE; });
+    }
+}
+
+template <AnyHitBehavior Mode, typename SceneT>
+static void TraceAll(const SceneT& sc, const std::vector<Ray>& in, std::vector<Ray>& out, ThreadPool* pool)
+{
+    size_t blocks = (in.size() + BlockSize - 1) / BlockSize;
+    auto block = [&](size_t b) { TraceBlock<Mode>(sc, in.data(), out.data(), b * BlockSize, glm::min((b + 1) * BlockSize, in.size())); };
+
+    if (pool)
+    {
+        pool->ParallelFor(blocks, block);
+    }
+    else
+    {
+        for (size_t b = 0; b < blocks; b++) block(b);
+    }
+}
+
+template <typename SceneT>
+static void Trace(const SceneT& sc, AnyHitBehavior mode, const std::vector<Ray>& in, std::vector<Ray>& out, ThreadPool* pool)
+{
+    switch (mode)
+    {
+    case AnyHitBehavior::COMMIT_AND_CONTINUE: TraceAll<AnyHitBehavior::COMMIT_AND_CONTINUE>(sc, in, out, pool); break;
+    case AnyHitBehavior::IGNORE_AND_CONTINUE: TraceAll<AnyHitBehavior::IGNORE_AND_CONTINUE>(sc, in, out, pool); break;
+    case AnyHitBehavior::COMMIT_AND_RETURN: TraceAll<AnyHitBehavior::COMMIT_AND_RETURN>(sc, in, out, pool); break;
+    case AnyHitBehavior::CALL_HANDLER: TraceAll<AnyHitBehavior::CALL_HANDLER>(sc, in, out, pool); break;
+    }
+}
+
+// Visibility only, occluded rays come out with MaxT = 0 so hits count like the any hit modes
+template <typename SceneT>
+static void TraceOcclusionAll(const SceneT& sc, const std::vector<Ray>& in, std::vector<Ray>& out, ThreadPool* pool)
+{
+    size_t blocks = (in.size() + BlockSize - 1) / BlockSize;
+    auto block = [&](size_t b)
+    {
+        RayTracing rt;
+        for (size_t i = b * BlockSize; i < glm::min((b + 1) * BlockSize, in.size()); i++)
+        {
+            out[i] = in[i];
+            out[i].MaxT = rt.TraceOcclusion(sc, in[i]) ? 0.0f : MaxFloat;
+        }
+    };
+
+    if (pool)
+    {
+        pool->ParallelFor(blocks, block);
+    }
+    else
+    {
+        for (size_t b = 0; b < blocks; b++) block(b);
+    }
+}
+
+// Primary rays of the default camera, shadow & cosine distributed bounce rays from their hits
+template <typename SceneT>
+static std::vector<RaySet> GenerateRays(const SceneT& sc, IVec3 sceneSize, const BenchOptions& options, ThreadPool* pool)
+{
+    std::vector<RaySet> sets = { { "primary", {} }, { "shadow", {} }, { "diffuse", {} } };
+
+    Camera camera = DefaultCamera(sceneSize);
+    Float aspect = Float(options.width) / Float(options.height);
+
+    for (size_t y = 0; y < options.height; y++)
+    {
+        for (size_t x = 0; x < options.width; x++)
+        {
+            Float u = (Float(x) + 0.5f) / Float(options.width) * 2.0f - 1.0f;
+            Float v = (Float(y) + 0.5f) / Float(options.height) * 2.0f - 1.0f;
+            sets[0].rays.push_back(camera.GenerateRay(u, v, aspect));
+        }
+    }
+
+    std::vector<Ray> hits(sets[0].rays.size(), Ray(Vec3(0.0f), Vec3(1.0f)));
+    Trace(sc, AnyHitBehavior::COMMIT_AND_CONTINUE, sets[0].rays, hits, pool);
+
+    Vec3 sun = glm::normalize(Vec3(0.4f, 1.0f, 0.25f));
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<Float> uniform(0.0f, 1.0f);
+
+    for (const Ray& r : hits)
+    {
+        if (r.MaxT == MaxFloat) continue;
+
+        Vec3 n = sc.GetHitAttributes(r).Normal;
+        Vec3 p = r.Origin + r.Direction * r.MinT + n * 1e-3f;
+
+        sets[1].rays.push_back(Ray(p, sun));
+
+        // Cosine weighted around the normal
+        Float phi = 2.0f * 3.14159265f * uniform(rng);
+        Float cosTheta = std::sqrt(uniform(rng));
+        Float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+
+        Vec3 t = glm::normalize(glm::cross(std::fabs(n.x) > 0.5f ? Vec3(0.0f, 1.0f, 0.0f) : Vec3(1.0f, 0.0f, 0.0f), n));
+        Vec3 b = glm::cross(n, t);
+        sets[2].rays.push_back(Ray(p, glm::normalize(t * (std::cos(phi) * sinTheta) + b * (std::sin(phi) * sinTheta) + n * cosTheta)));
+    }
+
+    return sets;
+}
+
+static Timing Percentiles(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) { return samples[size_t(std::lround(q * double(samples.size() - 1)))]; };
+
+    return { samples.front(), at(0.1), at(0.5), at(0.9), samples.back() };
+}
+
+class Bench
+{
+public:
+    Bench(const BenchOptions& options) : options(options) {}
+
+    template <typename SceneT>
+    void Run(const char* sceneName, const SceneT& sc, IVec3 sceneSize)
+    {
+        ThreadPool* widest = Pool(options.threads.back());
+        std::vector<RaySet> sets = GenerateRays(sc, sceneSize, options, widest);
+
+        // Every distribution & any hit mode at the widest thread count, plus occlusion queries
+        for (const RaySet& set : sets)
+        {
+            for (AnyHitBehavior mode : AnyHitModes)
+                Measure(sceneName, sc, set, mode, options.threads.back());
+
+            Measure(sceneName, set, "OCCLUSION", options.threads.back(), [&](const std::vector<Ray>& in, std::vector<Ray>& out, ThreadPool* pool) { TraceOcclusionAll(sc, in, out, pool); });
+        }
+
+        // Thread sweep of closest hit primary & diffuse rays
+        for (size_t threads : options.threads)
+        {
+            if (threads == options.threads.back()) continue;
+
+            Measure(sceneName, sc, sets[0], AnyHitBehavior::COMMIT_AND_CONTINUE, threads);
+            Measure(sceneName, sc, sets[2], AnyHitBehavior::COMMIT_AND_CONTINUE, threads);
+        }
+    }
+
+    std::string Json() const
+    {
+        std::ostringstream out;
+        out << "{\n";
+        out << "  \"simd\": \"" << SimdInstructionSet() << "\",\n";
+        out << "  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n";
+        out << "  \"width\": " << options.width << ",\n";
+        out << "  \"height\": " << options.height << ",\n";
+        out << "  \"repeats\": " << options.repeats << ",\n";
+        out << "  \"results\": [";
+
+        for (size_t i = 0; i < results.size(); i++)
+            out << (i ? "," : "") << "\n    " << results[i];
+
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+private:
+    BenchOptions options;
+    std::vector<std::string> results;
+    std::vector<std::unique_ptr<ThreadPool>> pools;
+
+    // Workers plus the calling thread, nullptr runs on the calling thread alone
+    ThreadPool* Pool(size_t threads)
+    {
+        if (threads <= 1) return nullptr;
+
+        for (auto& p : pools)
+        {
+            if (p->NumThreads() == threads) return p.get();
+        }
+
+        pools.emplace_back(new ThreadPool(threads - 1));
+        return pools.back().get();
+    }
+
+    typedef std::function<void(const std::vector<Ray>&, std::vector<Ray>&, ThreadPool*)> TraceFn;
+
+    template <typename SceneT>
+    void Measure(const char* sceneName, const SceneT& sc, const RaySet& set, AnyHitBehavior mode, size_t threads)
+    {
+        Measure(sceneName, set, AnyHitName(mode), threads, [&](const std::vector<Ray>& in, std::vector<Ray>& out, ThreadPool* pool) { Trace(sc, mode, in, out, pool); });
+    }
+
+    void Measure(const char* sceneName, const RaySet& set, const char* modeName, size_t threads, const TraceFn& trace)
+    {
+        char name[256];
+        std::snprintf(name, sizeof(name), "%s/%s/%s/%zu", sceneName, set.name, modeName, threads);
+        if (!options.filter.empty() && std::strstr(name, options.filter.c_str()) == nullptr) return;
+        if (set.rays.empty()) return;
+
+        ThreadPool* pool = Pool(threads);
+        std::vector<Ray> out(set.rays.size(), Ray(Vec3(0.0f), Vec3(1.0f)));
+
+        // One untimed pass to warm caches & the pool
+        trace(set.rays, out, pool);
+
+        std::vector<double> ms;
+        for (int i = 0; i < options.repeats; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            trace(set.rays, out, pool);
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        // Hits double as a checksum, backends over the same geometry should agree
+        size_t hits = 0;
+        for (const Ray& r : out)
+        {
+            if (r.MaxT != MaxFloat) hits++;
+        }
+
+        Timing t = Percentiles(ms);
+        double rays = double(set.rays.size());
+
+        char json[1024];
+        std::snprintf(json, sizeof(json),
+            "{ \"scene\": \"%s\", \"rays\": \"%s\", \"anyHit\": \"%s\", \"threads\": %zu, \"count\": %zu, \"hits\": %zu, "
+            "\"ms\": { \"min\": %.4f, \"p10\": %.4f, \"median\": %.4f, \"p90\": %.4f, \"max\": %.4f }, "
+            "\"mraysPerSecond\": { \"best\": %.3f, \"median\": %.3f } }",
+            sceneName, set.name, modeName, threads, set.rays.size(), hits,
+            t.min, t.p10, t.median, t.p90, t.max, rays / t.min * 1e-3, rays / t.median * 1e-3);
+
+        results.push_back(json);
+        std::cerr << name << ": " << rays / t.median * 1e-3 << " Mrays/s (median " << t.median << "ms)" << std::endl;
+    }
+};
+
+// Heightfield of the demo hills as triangles, plus boxes floating above for depth complexity
+struct BenchMesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    Mesh mesh;
+
+    BenchMesh(IVec3 size)
+    {
+        auto height = [](Float x, Float z) { return 16.0f + 8.0f * std::sin(x * 0.05f) * std::cos(z * 0.07f) + 4.0f * std::sin((x + z) * 0.13f); };
+
+        auto vertex = [&](Vec3 p, Vec3 n)
+        {
+            Vertex v = {};
+            v.position = p;
+            v.normal = n;
+            vertices.push_back(v);
+            return uint32_t(vertices.size() - 1);
+        };
+
+        for (Int z = 0; z <= size.z; z++)
+        {
+            for (Int x = 0; x <= size.x; x++)
+            {
+                Float fx = Float(x), fz = Float(z);
+                Vec3 n = glm::normalize(Vec3(height(fx - 1.0f, fz) - height(fx + 1.0f, fz), 2.0f, height(fx, fz - 1.0f) - height(fx, fz + 1.0f)));
+                vertex(Vec3(fx, height(fx, fz), fz), n);
+            }
+        }
+
+        for (Int z = 0; z < size.z; z++)
+        {
+            for (Int x = 0; x < size.x; x++)
+            {
+                uint32_t i = uint32_t(z * (size.x + 1) + x);
+                uint32_t row = uint32_t(size.x + 1);
+                indices.insert(indices.end(), { i, i + row, i + 1, i + 1, i + row, i + row + 1 });
+            }
+        }
+
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<Float> uniform(0.0f, 1.0f);
+
+        for (int b = 0; b < 512; b++)
+        {
+            Vec3 lo(uniform(rng) * Float(size.x - 4), 28.0f + uniform(rng) * Float(size.y - 36), uniform(rng) * Float(size.z - 4));
+            Vec3 hi = lo + Vec3(1.0f) + Vec3(uniform(rng), uniform(rng), uniform(rng)) * 3.0f;
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                for (int side = 0; side < 2; side++)
+                {
+                    Vec3 n(0.0f);
+                    n[axis] = side ? 1.0f : -1.0f;
+
+                    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                    Vec3 corner[4];
+                    for (int c = 0; c < 4; c++)
+                    {
+                        corner[c][axis] = side ? hi[axis] : lo[axis];
+                        corner[c][u] = (c == 1 || c == 2) ? hi[u] : lo[u];
+                        corner[c][v] = (c >= 2) ? hi[v] : lo[v];
+                    }
+
+                    uint32_t first = vertex(corner[0], n);
+                    for (int c = 1; c < 4; c++) vertex(corner[c], n);
+                    indices.insert(indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+                }
+            }
+        }
+
+        mesh = { uint32_t(indices.size()), 0, 0, vertices.data(), indices.data() };
+    }
+};
+
+static bool ParseArguments(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+
+        if (arg == "--size")
+        {
+            if (std::sscanf(value.c_str(), "%zux%zu", &options.width, &options.height) != 2) return false;
+        }
+        else if (arg == "--repeats")
+        {
+            options.repeats = std::max(1, std::atoi(value.c_str()));
+        }
+        else if (arg == "--threads")
+        {
+            std::istringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ','))
+                options.threads.push_back(std::max<size_t>(1, std::strtoul(item.c_str(), nullptr, 10)));
+        }
+        else if (arg == "--filter")
+        {
+            options.filter = value;
+        }
+        else if (arg == "--output")
+        {
+            options.output = value;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return argc % 2 == 1;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        std::cerr << "Usage: tracer_bench [--size <w>x<h>] [--repeats <n>] [--threads <n,n,...>] [--filter <text>] [--output <file>]\n"
+            "  Cases are named scene/rays/anyHit/threads, --filter keeps those containing the text" << std::endl;
+        return 1;
+    }
+
+    if (options.threads.empty())
+    {
+        size_t hardware = glm::max(1u, std::thread::hardware_concurrency());
+        for (size_t t = 1; t < hardware; t *= 2) options.threads.push_back(t);
+        options.threads.push_back(hardware);
+    }
+    std::sort(options.threads.begin(), options.threads.end());
+    options.threads.erase(std::unique(options.threads.begin(), options.threads.end()), options.threads.end());
+
+    Bench bench(options);
+
+    // Voxel backends over the same world
+    {
+        std::unique_ptr<BrickMapScene> bricks(CreateDemoScene());
+        IVec3 size = bricks->Size();
+
+        // Floating blocks so rays also pass over & between occluders
+        std::mt19937 rng(7);
+        std::vector<Voxel> edits;
+        for (int b = 0; b < 512; b++)
+        {
+            IVec3 lo(Int(rng() % UInt(size.x - 4)), 28 + Int(rng() % UInt(size.y - 36)), Int(rng() % UInt(size.z - 4)));
+            IVec3 extent = IVec3(1) + IVec3(Int(rng() % 4), Int(rng() % 4), Int(rng() % 4));
+
+            for (Int z = 0; z < extent.z; z++)
+                for (Int y = 0; y < extent.y; y++)
+                    for (Int x = 0; x < extent.x; x++)
+                        edits.push_back({ lo + IVec3(x, y, z), UInt(3 + b % 8) });
+        }
+        bricks->ApplyEdits(edits.data(), edits.size());
+
+        VoxelGridScene grid(size);
+        for (Int z = 0; z < size.z; z++)
+            for (Int y = 0; y < size.y; y++)
+                for (Int x = 0; x < size.x; x++)
+                    grid.Set(IVec3(x, y, z), bricks->Get(IVec3(x, y, z)));
+
+        SparseVoxelOctree octree(grid);
+        CompressedVoxelScene compressed(*bricks);
+
+        bench.Run("voxelgrid", grid, size);
+        bench.Run("brickmap", *bricks, size);
+        bench.Run("octree", octree, size);
+        bench.Run("compressed", compressed, size);
+    }
+
+    // Triangle backends
+    {
+        IVec3 size(256, 64, 256);
+        BenchMesh mesh(size);
+
+        BVHScene bvh(&mesh.mesh, 1);
+        BVH8Scene bvh8(&mesh.mesh, 1);
+
+        bench.Run("bvh", bvh, size);
+        bench.Run("bvh8", bvh8, size);
+    }
+
+    std::string json = bench.Json();
+    if (options.output.empty())
+    {
+        std::cout << json;
+    }
+    else
+    {
+        std::ofstream file(options.output);
+        file << json;
+        if (!file)
+        {
+            std::cerr << "Failed to write " << options.output << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -17,10 +17,16 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "errors.h"
 #include "gfx/gfx.h"
 #include "gfx/pipeline.h"
+#include "pathtracer.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "scene/brickmap.h"
 
 #include <glm/glm.hpp>
 
@@ -37,6 +43,7 @@ private:
 
     void RenderScene();
     void RenderUI();
+    void ProfilerUI();
     void Update();
 
     enum GPUTime {
@@ -48,8 +55,27 @@ private:
     GPUTimer* timers[GPUTime::Count];
     double frameTimes[GPUTime::Count];
 
+    // Named scopes within the frame, results arrive a few frames late
+    GPUProfiler* gpuProfiler = nullptr;
+
     double framesPerSecond = 0.0;
 
+    // Zones of the last completed frame shown in the profiler, kept while paused
+    std::vector<Profiler::ThreadEvents> profiledFrame;
+    uint64_t profiledFrameStart = 0;
+    uint64_t profiledFrameEnd = 0;
+    bool profilerPaused = false;
+    std::string traceMessage;
+
+    // CPU ray tracing
+    ThreadPool threadPool;
+    Renderer renderer;
+    PathTracer pathTracer;
+    Camera camera;
+    BrickMapScene* scene = nullptr;
+    bool progressive = false;
+    bool pathTracing = false;
+
     // Test content
     struct ShaderConstants
     {
@@ -0,0 +1,92 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Context Arena
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for short lived traversal state. Memory is only handed back in bulk through
+// Reset() / Rewind(), nothing is destructed, so only trivially destructible types go in here.
+// Blocks are kept across resets: once warmed up, tracing does not touch the heap anymore.
+class ContextArena
+{
+public:
+    static constexpr size_t BlockSize = 64 * 1024;
+    static constexpr size_t BlockAlignment = 64;
+
+    struct Marker
+    {
+        size_t block;
+        size_t offset;
+    };
+
+    ContextArena() = default;
+    ContextArena(const ContextArena&) = delete;
+    ContextArena& operator=(const ContextArena&) = delete;
+
+    template <typename T, typename... Args>
+    inline T* New(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destructed");
+        static_assert(sizeof(T) <= BlockSize, "Object does not fit into an arena block");
+        static_assert(alignof(T) <= BlockAlignment, "Object alignment exceeds the block alignment");
+
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    inline void* Allocate(size_t size, size_t alignment)
+    {
+        size_t offset = (current + alignment - 1) & ~(alignment - 1);
+
+        if (block >= blocks.size() || offset + size > BlockSize)
+        {
+            NextBlock();
+            offset = 0;
+        }
+
+        current = offset + size;
+        return blocks[block]->data + offset;
+    }
+
+    inline Marker Mark() const { return { block, current }; }
+    inline void Rewind(Marker m) { block = m.block; current = m.offset; }
+    inline void Reset() { block = 0; current = 0; }
+
+    // Number of blocks ever taken from the heap
+    size_t HeapAllocations() const { return blocks.size(); }
+
+    // Arena of the calling thread
+    static ContextArena& ForThread();
+
+private:
+    struct alignas(BlockAlignment) Block
+    {
+        uint8_t data[BlockSize];
+    };
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    size_t block = 0;
+    size_t current = 0;
+
+    void NextBlock();
+};
+
+// Rewinds the arena to where it was when the scope was entered
+class ArenaScope
+{
+public:
+    ArenaScope(ContextArena& arena) : arena(arena), marker(arena.Mark()) {}
+    ~ArenaScope() { arena.Rewind(marker); }
+
+private:
+    ContextArena& arena;
+    ContextArena::Marker marker;
+};
@@ -11,7 +11,8 @@ enum class ErrorCode
     GLFW_INIT_FAILED,
     GLAD_INIT_FAILED,
     GFX_SHADERS_NOT_COMPLETE,
-    GFX_NOT_IN_SCOPE
+    GFX_NOT_IN_SCOPE,
+    ASSET_LOAD_FAILED
 };
 
 #ifdef ERROR_MSGS_IMPL
@@ -21,7 +22,8 @@ std::string ErrorCodeDesc[] = {
     "GLFW failed to initiate",
     "GLAD failed to initiate",
     "The shaders specified are not complete (missing shader stages)",
-    "Command is not executed in scope"
+    "Command is not executed in scope",
+    "Asset failed to load"
 };
 
 #endif
@@ -73,7 +73,8 @@ public:
         RGB = GL_RGB,
         RGBA = GL_RGBA,
         BGR = GL_BGR,
-        BGRA = GL_BGRA
+        BGRA = GL_BGRA,
+        RInteger = GL_RED_INTEGER
     };
 
     uint32_t texture = 0;
@@ -7,6 +7,9 @@
 
 #include <glad/glad.h>
 
+#include <string>
+#include <vector>
+
 enum class PrimitiveType
 {
     Triangles = GL_TRIANGLES,
@@ -115,17 +118,96 @@ enum class BufferFormat
     Unkown = GL_ZERO
 };
 
+// Timestamp query pairs in a ring of Latency frames. Results are read once the GPU has them, a few
+// frames after they were issued, so nothing ever waits on the GPU. A Start() that finds its slot
+// still in flight drops that measurement instead of stalling.
 class GPUTimer
 {
+public:
+    static constexpr int Latency = 4;
+
 private:
-    GLuint64 startTime = 0, stopTime = 0;
-    unsigned int queryID[2];
+    struct Slot
+    {
+        GLuint queries[2];
+        bool pending = false;
+    };
+
+    Slot slots[Latency];
+    int next = 0;      // Slot of the next Start()
+    int oldest = 0;    // Oldest slot that may be pending
+    bool recording = false;
+    double lastTime = 0.0;
 
 public:
     GPUTimer();
+    ~GPUTimer();
+
+    GPUTimer(const GPUTimer&) = delete;
+    GPUTimer& operator=(const GPUTimer&) = delete;
 
     void Start();
     void End();
 
+    // Milliseconds of the latest finished measurement, never blocks
     double getTimeSpent();
+};
+
+// Named, nestable GPU scopes. Every frame records its scopes into a ring slot of query pairs,
+// the frame Latency frames back is resolved without waiting & its scopes stay readable until the
+// next one resolves.
+class GPUProfiler
+{
+public:
+    static constexpr int Latency = GPUTimer::Latency;
+
+    struct Scope
+    {
+        const char* name; // Not copied, string literals
+        int depth;
+        double ms;
+    };
+
+    GPUProfiler();
+    ~GPUProfiler();
+
+    GPUProfiler(const GPUProfiler&) = delete;
+    GPUProfiler& operator=(const GPUProfiler&) = delete;
+
+    void BeginFrame();
+    void EndFrame();
+
+    void Push(const char* name);
+    void Pop();
+
+    // Scopes of the latest resolved frame in the order they were opened
+    const std::vector<Scope>& Results() const { return results; }
+
+private:
+    struct Frame
+    {
+        std::vector<GLuint> queries; // Start & end query per scope, grows on demand
+        std::vector<Scope> scopes;
+        GLuint lastQuery = 0;        // Timestamps complete in order, the last one issued decides
+        bool pending = false;
+    };
+
+    Frame frames[Latency];
+    int current = 0;
+    bool recording = false;  // false when the slot of this frame was still in flight
+    std::vector<size_t> open; // Open scopes of the current frame
+    std::vector<Scope> results;
+
+    void Resolve();
+};
+
+// Scope of a GPUProfiler, lives across the GL calls it measures
+class GPUScope
+{
+public:
+    GPUScope(GPUProfiler& profiler, const char* name) : profiler(profiler) { profiler.Push(name); }
+    ~GPUScope() { profiler.Pop(); }
+
+private:
+    GPUProfiler& profiler;
 };
\ No newline at end of file
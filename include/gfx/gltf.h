@@ -0,0 +1,17 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - TinyGLTF & Related model loading
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <string>
+
+#include "errors.h"
+#include "threadpool.h"
+#include "gfx/mesh.h"
+
+// Loads the triangle primitives of the default scene of a .gltf / .glb, node transforms are baked
+// into the vertices. Geometry is converted on the pool (or the calling thread without one) while
+// every image decodes on a thread of its own. Throws ErrorCode::ASSET_LOAD_FAILED.
+Model LoadGLTF(const std::string& path, ThreadPool* pool = nullptr);
@@ -5,7 +5,15 @@
 
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+const uint32_t NoTexture = 0xFFFFFFFFu;
 
 struct Vertex
 {
@@ -27,10 +35,18 @@ struct Material
 	glm::vec3 transmission;
 	float IOR;
 
-	uint32_t texture0;
-	uint32_t texture1;
-	uint32_t texture2;
-	uint32_t texture3;
+	uint32_t texture0; // Base color
+	uint32_t texture1; // Metallic roughness
+	uint32_t texture2; // Normal
+	uint32_t texture3; // Emission
+};
+
+// RGBA8
+struct TextureImage
+{
+	uint32_t width;
+	uint32_t height;
+	const uint8_t* pixels;
 };
 
 struct Mesh
@@ -41,5 +57,74 @@ struct Mesh
 	uint32_t indexOffset;
 
 	Vertex* vertices;
-	uint16_t* indicies;
-};
\ No newline at end of file
+	uint32_t* indicies;
+};
+
+// Octahedral unit vector as 2 x snorm16 (Cigolle et al., "A Survey of Efficient Representations for Independent Unit Vectors")
+inline uint32_t EncodeOctahedral(glm::vec3 n)
+{
+	glm::vec2 p = glm::vec2(n.x, n.y) / (glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z));
+
+	// Fold the lower hemisphere over the diagonals
+	if (n.z < 0.0f)
+		p = (glm::vec2(1.0f) - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+
+	return glm::packSnorm2x16(p);
+}
+
+inline glm::vec3 DecodeOctahedral(uint32_t e)
+{
+	glm::vec2 p = glm::unpackSnorm2x16(e);
+	glm::vec3 n(p.x, p.y, 1.0f - glm::abs(p.x) - glm::abs(p.y));
+
+	float t = glm::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+
+	return glm::normalize(n);
+}
+
+// Vertices split into one tightly packed stream per attribute. Positions stay full precision
+// for traversal & depth, the shading attributes are quantized. Unused texcoord sets are empty.
+struct VertexStreams
+{
+	size_t count = 0;
+
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> normals;     // EncodeOctahedral
+	std::vector<uint32_t> materialIds;
+	std::vector<uint32_t> texcoords[4]; // glm::packHalf2x16
+
+	size_t MemoryUsage() const;
+};
+
+VertexStreams SplitVertexStreams(const Vertex* vertices, size_t count);
+
+// A loaded asset, meshes point into vertex & index arrays that the model keeps alive.
+// Models mapped from a mesh cache are read only.
+struct Model
+{
+	std::vector<Mesh> meshes;
+	std::vector<Material> materials;
+	std::vector<TextureImage> images;
+
+	Vertex* vertices = nullptr;
+	size_t numVertices = 0;
+	uint32_t* indices = nullptr;
+	size_t numIndices = 0;
+
+	// Whatever backs vertices, indices & image pixels
+	std::vector<std::shared_ptr<const void>> storage;
+
+	// URIs of the buffers & images the asset reads from files of their own, relative to the asset
+	std::vector<std::string> externalFiles;
+
+	struct LoadStats
+	{
+		double parseSeconds = 0.0;   // JSON & buffers
+		double convertSeconds = 0.0; // Accessors into vertices & indices
+		double decodeSeconds = 0.0;  // Image decoding, overlaps the conversion
+		double totalSeconds = 0.0;   // Wall clock
+		bool cached = false;         // Mapped from a mesh cache, nothing was parsed or decoded
+	} stats;
+};
@@ -0,0 +1,45 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - GFX System - Mesh Buffers
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include "gfx.h"
+#include "buffer.h"
+#include "pipeline.h"
+#include "mesh.h"
+
+// GPU copy of split vertex streams, one buffer per stream so a pass only fetches what it reads
+class MeshBuffers
+{
+public:
+    static constexpr DataType IndexType = DataType::Uint32;
+
+    Buffer* positions = nullptr;
+    Buffer* normals = nullptr;
+    Buffer* materialIds = nullptr;
+    Buffer* texcoords[4] = {};
+    Buffer* indices = nullptr;
+
+    MeshBuffers(const VertexStreams& streams, const uint32_t* indices, size_t numIndices);
+    ~MeshBuffers();
+
+    MeshBuffers(const MeshBuffers&) = delete;
+    MeshBuffers& operator=(const MeshBuffers&) = delete;
+
+    // Attribute locations:
+    //  0: position, vec3
+    //  1: normal, octahedral snorm16 x 2 (decode in the shader)
+    //  2: material id, converted to float
+    //  3+: the present texcoord sets in order, half x 2
+    void Bind(VertexArray& vertexArray) const;
+
+    // Position stream only, for depth & shadow passes
+    void BindPositions(VertexArray& vertexArray) const;
+
+    size_t MemoryUsage() const { return memoryUsage; }
+
+private:
+    size_t memoryUsage = 0;
+};
@@ -0,0 +1,44 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Binary Mesh Cache
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "threadpool.h"
+#include "gfx/mesh.h"
+
+// Flat dump of a Model (meshes, materials, vertices, indices & decoded RGBA8 images) that is
+// mapped read only, mesh & image pointers go straight into the mapping. Each cache records the
+// size & modification time of its source & of every external buffer / image the source references,
+// a mismatch of any of them or a version / layout change rejects it.
+namespace MeshCache
+{
+    const uint32_t Version = 3;
+
+    // Size & modification time of a source file, the asset or one it references
+    struct SourceStamp
+    {
+        uint64_t size;
+        int64_t modified;
+    };
+
+    bool Stamp(const std::string& sourcePath, SourceStamp& stamp);
+
+    // Cache file used for a source asset
+    std::string CachePath(const std::string& sourcePath);
+
+    // Maps the cache if it is valid for the stamp of the source & the external files it recorded
+    // are unchanged
+    bool Load(const std::string& cachePath, const std::string& sourcePath, const SourceStamp& stamp, Model& model);
+
+    // Stamps Model::externalFiles next to the source, false if one of them can't be read.
+    // Written to a temporary file & renamed, so a half written cache is never picked up
+    bool Write(const std::string& cachePath, const std::string& sourcePath, const SourceStamp& stamp, const Model& model);
+}
+
+// LoadGLTF through the cache, a missing or stale cache is rebuilt from the source
+Model LoadModelCached(const std::string& path, ThreadPool* pool = nullptr);
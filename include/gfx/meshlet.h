@@ -0,0 +1,49 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Meshlets
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gfx/mesh.h"
+
+const uint32_t MaxMeshletVertices = 64;
+const uint32_t MaxMeshletTriangles = 124;
+
+// Cluster of up to 64 vertices & 124 triangles, small enough to be culled or traced as one unit
+struct Meshlet
+{
+	uint32_t vertexOffset;   // First entry in MeshletSet::vertices
+	uint32_t triangleOffset; // First byte in MeshletSet::triangles
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+
+	glm::vec3 center;
+	float radius;
+
+	// Every triangle normal is within the cone, coneCutoff is the sine of its half angle (1 if it is too wide)
+	glm::vec3 coneAxis;
+	float coneCutoff;
+};
+
+struct MeshletSet
+{
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> vertices; // Mesh relative, like Mesh::indicies
+	std::vector<uint8_t> triangles; // 3 meshlet local vertices per triangle
+};
+
+// Grows each meshlet over shared vertices, preferring triangles that add the fewest new ones
+MeshletSet BuildMeshlets(const Mesh& mesh);
+
+// True if the whole meshlet faces away from the eye (sphere form of the cone test)
+inline bool MeshletBackfacing(const Meshlet& m, glm::vec3 eye)
+{
+	glm::vec3 v = m.center - eye;
+	return glm::dot(v, m.coneAxis) >= m.coneCutoff * glm::length(v) + m.radius;
+}
@@ -0,0 +1,28 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - GFX System - Voxel Texture
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include "gfx.h"
+#include "buffer.h"
+#include "scene/brickmap.h"
+
+// GPU copy of a brick map as an R32UI 3D texture of material ids. After the first full upload
+// only the bricks in BrickMapScene::DirtyBricks() are sent again.
+class VoxelTexture
+{
+public:
+    Texture* texture = nullptr;
+
+    // Uploads the whole map & clears its dirty bricks
+    VoxelTexture(BrickMapScene& scene);
+    ~VoxelTexture();
+
+    VoxelTexture(const VoxelTexture&) = delete;
+    VoxelTexture& operator=(const VoxelTexture&) = delete;
+
+    // Uploads the bricks edited since the last call & clears them, returns how many were sent
+    size_t Update(BrickMapScene& scene);
+};
@@ -0,0 +1,94 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Headless Renderer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "errors.h"
+#include "pathtracer.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "scene/brickmap.h"
+#include "scene/paged.h"
+
+// Offline rendering with the CPU tracer, never opens a window or touches OpenGL so it runs on
+// machines without a display or GPU. Frames are written through stb_image_write.
+class HeadlessTracer
+{
+public:
+    struct Options
+    {
+        std::string scene;                   // .gltf / .glb to voxelize, a chunk file to page in, empty for the demo
+        Int resolution = 512;                // Voxels along the longest axis of voxelized glTF scenes
+        size_t width = 1280;
+        size_t height = 720;
+        size_t frames = 0;                   // 0 for one per camera keyframe, or a single frame without a path
+        std::string cameraPath;              // One "px py pz fx fy fz [fov]" keyframe per line, in scene units
+        std::string output = "frame_%04d.png"; // One %d for the frame index, format by extension
+        size_t threads = 0;                  // 0 for one per core
+        size_t cacheMB = 1024;               // Chunk cache budget of paged scenes
+        std::string trace;                   // Chrome trace of the CPU profiler zones, none if empty
+        Float progressive = 0.0f;            // Adaptive sampling error threshold, one sample per pixel if 0
+        size_t pathSamples = 0;              // Path traced samples per pixel, the Renderer's direct shading if 0
+    };
+
+    // Prints the usage & returns false on bad arguments
+    static bool ParseArguments(int argc, char** argv, Options& options);
+
+    // Throws ErrorCode::ASSET_LOAD_FAILED if the scene or camera path can't be loaded
+    HeadlessTracer(const Options& options);
+    ~HeadlessTracer();
+
+    // Returns the process exit code
+    int run();
+
+private:
+    struct Keyframe
+    {
+        Vec3 position;
+        Vec3 forward;
+        Float fov;
+    };
+
+    // Passes over a frame of a paged scene at most, waiting for the missed chunks after each
+    static constexpr int MaxPagingPasses = 16;
+
+    Options options;
+
+    ThreadPool threadPool;
+    Renderer renderer;
+    PathTracer pathTracer;
+
+    BrickMapScene* scene = nullptr;
+    PagedVoxelScene* paged = nullptr;
+
+    // Scene units of a point p are (p - worldOrigin) * worldScale
+    Vec3 worldOrigin = Vec3(0.0f);
+    Float worldScale = 1.0f;
+
+    std::vector<Keyframe> keyframes;
+
+    void LoadScene();
+    void LoadCameraPath();
+
+    Camera CameraAt(size_t frame, size_t numFrames) const;
+
+    void RenderFrame(const BrickMapScene& sc, const Camera& camera);
+    void RenderFrame(PagedVoxelScene& sc, const Camera& camera);
+
+    // Accumulates until every pixel is under the threshold
+    template <typename SceneT>
+    void Converge(const SceneT& sc, const Camera& camera);
+
+    template <typename SceneT>
+    void PathTrace(const SceneT& sc, const Camera& camera);
+
+    template <typename SceneT>
+    int RenderFrames(SceneT& sc);
+
+    bool WriteImage(const std::string& path) const;
+};
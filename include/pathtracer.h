@@ -0,0 +1,272 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Wavefront Path Tracer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "profiler.h"
+#include "raytracing.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "gfx/mesh.h"
+#include "scene/voxel.h"
+
+// Path tracing integrator over gfx Materials, run as a wavefront: instead of following one path
+// at a time, every stage runs over a queue of up to pathsInFlight paths before the next starts.
+//  - Generate tops the queue up with camera paths of pixels not started yet this frame
+//  - Extend traces the queue & records the closest hits
+//  - Shade runs in material order, adds emission & sky, queues a sun shadow ray & the next bounce
+//  - Connect traces the shadow rays as occlusion queries
+//  - Compact drops terminated paths so the next Extend runs over live paths only
+// Russian roulette ends low throughput paths, so deep bounces shrink the queue & Generate refills it.
+//
+// Materials are looked up by HitAttributes::Material. color.rgb is the diffuse albedo, emission is
+// added on every hit and transmission picks a smooth dielectric with the given IOR, tinted by color.
+// A refracted path remembers the dielectric it is in & leaves it at the first voxel along its way
+// that is of another material (or empty), voxel normals face the ray so they can't tell inside from out.
+// Ids past the end of materials shade like the Renderer's per id colors. Voxelized models report
+// Vertex::materialId + 1, so their materials go in from index 1.
+class PathTracer
+{
+public:
+    struct Settings
+    {
+        UInt maxBounces = 8;
+        UInt rouletteBounces = 3;         // Bounces before Russian roulette starts
+        size_t pathsInFlight = 1 << 16;   // Queue capacity, about 10MB of queues
+    };
+
+    struct Stats
+    {
+        double frameMs = 0.0;
+        double megaRaysPerSecond = 0.0;   // Extension & shadow rays
+        uint64_t extensionRays = 0;
+        uint64_t shadowRays = 0;
+        size_t waves = 0;                 // Extend / Shade / Connect rounds of the frame
+        UInt samples = 0;                 // Per pixel since the last restart
+    };
+
+    Settings settings;
+    std::vector<Material> materials;
+    Vec3 sunDirection = glm::normalize(Vec3(0.4f, 1.0f, 0.25f));
+    Vec3 sunIrradiance = Vec3(3.0f);
+
+    PathTracer(ThreadPool* pool, size_t width, size_t height);
+
+    void Resize(size_t width, size_t height);
+
+    // Adds one path per pixel to the running mean. A camera or sceneVersion change restarts it.
+    // SceneT follows the static scene interface of RayTracing::TraceRay<>.
+    template <typename SceneT>
+    void Render(const SceneT& sc, const Camera& camera, uint64_t sceneVersion = 0);
+
+    void RestartAccumulation();
+
+    size_t Width() const { return width; }
+    size_t Height() const { return height; }
+
+    // RGBA32F linear radiance, row 0 at the bottom like GL textures
+    const Vec4* Framebuffer() const { return framebuffer.data(); }
+
+    const Stats& GetStats() const { return stats; }
+
+private:
+    // Paths per ParallelFor index of every stage
+    static constexpr size_t ChunkSize = 1024;
+
+    static constexpr UInt NoMedium = UInt(-1);
+
+    // Along the normal, keeps bounces & shadow rays from hitting the surface they leave
+    static constexpr Float SurfaceOffset = 1e-3f;
+
+    struct PathState
+    {
+        Vec3 origin;
+        UInt pixel;
+        Vec3 direction;
+        UInt bounce;
+        Vec3 throughput;
+        UInt rng;
+        UInt medium;    // Material of the dielectric the path is in, NoMedium outside
+    };
+
+    // Closest hit of paths[i], t is MaxFloat on a miss. The normal faces the path.
+    struct PathHit
+    {
+        Vec3 normal;
+        Float t;
+        UInt material;
+    };
+
+    // Toward the sun, contribution lands in the pixel if nothing is in the way
+    struct ShadowRay
+    {
+        Vec3 origin;
+        UInt pixel;
+        Vec3 contribution;
+    };
+
+    ThreadPool* pool;
+
+    size_t width;
+    size_t height;
+    std::vector<Vec4> framebuffer;
+    std::vector<Vec3> accumulation;
+    std::vector<Vec3> radiance; // Of this frame's paths
+
+    // Queues, paths is dense, the per chunk outputs of Shade are compacted or traced in place
+    std::vector<PathState> paths;
+    std::vector<PathHit> hits;
+    std::vector<UInt> shadeOrder;       // Indices of paths sorted by material
+    std::vector<PathState> nextPaths;   // ChunkSize slots per Shade chunk
+    std::vector<ShadowRay> shadowRays;  // ChunkSize slots per Shade chunk
+    std::vector<UInt> nextCounts;
+    std::vector<UInt> shadowCounts;
+    std::vector<size_t> nextOffsets;
+    std::vector<UInt> histograms;       // Material buckets of every chunk
+
+    size_t nextPixel = 0;               // Generate cursor
+    UInt frameIndex = 0;
+
+    Stats stats;
+    std::chrono::steady_clock::time_point frameStart;
+
+    Camera accumulatedCamera;
+    uint64_t accumulatedVersion = 0;
+    bool accumulating = false;
+
+    static size_t NumChunks(size_t count) { return (count + ChunkSize - 1) / ChunkSize; }
+
+    void BeginFrame(const Camera& camera, uint64_t sceneVersion);
+    void EndFrame();
+
+    // Returns false once every pixel is done & the queue is empty
+    bool Generate(const Camera& camera);
+    void SortHits();
+    void Shade();
+    void Compact();
+
+    template <typename SceneT>
+    void Extend(const SceneT& sc);
+
+    template <typename SceneT>
+    void Connect(const SceneT& sc);
+
+    // Bucket of a hit in SortHits, misses first & ids without a material last
+    inline UInt MaterialSlot(const PathHit& h) const
+    {
+        if (h.t == MaxFloat) return 0;
+        return h.material < materials.size() ? h.material + 1 : UInt(materials.size() + 1);
+    }
+
+    Material MaterialOf(UInt id) const;
+    Vec3 Sky(Vec3 direction) const;
+};
+
+template <typename SceneT>
+void PathTracer::Render(const SceneT& sc, const Camera& camera, uint64_t sceneVersion)
+{
+    PROFILE_ZONE("Path Trace");
+
+    BeginFrame(camera, sceneVersion);
+
+    while (Generate(camera))
+    {
+        Extend(sc);
+        SortHits();
+        Shade();
+        Connect(sc);
+        Compact();
+    }
+
+    EndFrame();
+}
+
+template <typename SceneT>
+void PathTracer::Extend(const SceneT& sc)
+{
+    PROFILE_ZONE("Extend");
+
+    hits.resize(paths.size());
+
+    pool->ParallelFor(NumChunks(paths.size()), [&](size_t chunk)
+        {
+            ArenaScope scope(ContextArena::ForThread());
+            RayTracing rt;
+
+            for (size_t i = chunk * ChunkSize; i < glm::min((chunk + 1) * ChunkSize, paths.size()); i++)
+            {
+                const PathState& p = paths[i];
+                Ray r(p.origin, p.direction);
+                rt.TraceRay(sc, r);
+
+                PathHit& h = hits[i];
+
+                // Inside a dielectric, step over the run of its voxels the path starts in. The path
+                // leaves through the last one, whatever comes next is outside the medium.
+                if (p.medium != NoMedium)
+                {
+                    Float exitT = 0.0f;
+                    Ray last = r;
+
+                    while (r.MaxT != MaxFloat && r.MaxT > r.MinT && r.MinT <= exitT + SurfaceOffset && sc.GetHitAttributes(r).Material == p.medium)
+                    {
+                        exitT = r.MaxT;
+                        last = r;
+
+                        // Past the shared face, so the voxel just left is not found again
+                        r = Ray(p.origin, p.direction, exitT + SurfaceOffset * 0.5f);
+                        rt.TraceRay(sc, r);
+                    }
+
+                    if (exitT > 0.0f)
+                    {
+                        h.normal = -VoxelExitNormal(last);
+                        h.t = exitT;
+                        h.material = p.medium;
+                        continue;
+                    }
+                }
+
+                if (r.MaxT == MaxFloat)
+                {
+                    h.t = MaxFloat;
+                    continue;
+                }
+
+                HitAttributes attr = sc.GetHitAttributes(r);
+                h.normal = glm::dot(attr.Normal, p.direction) < 0.0f ? attr.Normal : -attr.Normal;
+                h.t = r.MinT;
+                h.material = attr.Material;
+            }
+        });
+
+    stats.extensionRays += paths.size();
+}
+
+template <typename SceneT>
+void PathTracer::Connect(const SceneT& sc)
+{
+    PROFILE_ZONE("Connect");
+
+    // Every path owns its pixel & queues one shadow ray at most, so the adds never collide
+    pool->ParallelFor(shadowCounts.size(), [&](size_t chunk)
+        {
+            ArenaScope scope(ContextArena::ForThread());
+            RayTracing rt;
+
+            for (size_t i = chunk * ChunkSize; i < chunk * ChunkSize + shadowCounts[chunk]; i++)
+            {
+                const ShadowRay& s = shadowRays[i];
+                if (!rt.TraceOcclusion(sc, Ray(s.origin, sunDirection)))
+                    radiance[s.pixel] += s.contribution;
+            }
+        });
+
+    for (UInt count : shadowCounts)
+        stats.shadowRays += count;
+}
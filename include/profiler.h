@@ -0,0 +1,117 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - CPU Profiler
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compiled out entirely with TRACER_PROFILER=0
+#ifndef TRACER_PROFILER
+#define TRACER_PROFILER 1
+#endif
+
+// Scoped CPU zones. Every thread records into its own ring of completed zones, written by that
+// thread alone & published with a release store, so recording never takes a lock. Readers copy
+// only the zones they ask for from the recent end of a ring & drop whatever the owner overwrote
+// while it was being copied. The ring keeps the most recent BufferEvents zones per thread, older
+// ones are overwritten. Rings outlive their threads & are handed on to the next new thread.
+//
+// Zone names are not copied, they must outlive the profiler (string literals, __func__).
+class Profiler
+{
+public:
+    static constexpr size_t BufferEvents = 1 << 15; // Power of two
+    static constexpr size_t FrameHistory = 256;
+
+    // Nanoseconds since the profiler started
+    struct Event
+    {
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+        uint32_t depth; // Zones open on the thread when this one began
+    };
+
+    struct ThreadEvents
+    {
+        uint32_t id;
+        std::string name;
+        std::vector<Event> events; // In completion order, children before their parents
+    };
+
+    static inline uint64_t Now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Epoch()).count());
+    }
+
+    static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+    static void SetEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+
+    // Shown in the trace & the timeline, "Thread <id>" until set
+    static void SetThreadName(const std::string& name);
+
+    // Marks the start of a frame on the calling thread
+    static void BeginFrame();
+
+    // Bounds of the last completed frame, false before the second BeginFrame()
+    static bool LastFrame(uint64_t& start, uint64_t& end);
+
+    // Zones overlapping [from, to) of every thread that recorded any
+    static std::vector<ThreadEvents> Collect(uint64_t from = 0, uint64_t to = UINT64_MAX);
+
+    // Everything still in the rings plus frame marks, in the Chrome trace event format
+    // (chrome://tracing, Perfetto)
+    static bool WriteChromeTrace(const std::string& path);
+
+    // Zone bookkeeping of ProfileZone
+    static uint32_t Enter();
+    static void Leave(const char* name, uint64_t start, uint32_t depth);
+
+private:
+    static std::atomic<bool> enabled;
+
+    static std::chrono::steady_clock::time_point Epoch();
+};
+
+class ProfileZone
+{
+public:
+    inline ProfileZone(const char* name) : name(Profiler::Enabled() ? name : nullptr)
+    {
+        if (this->name)
+        {
+            depth = Profiler::Enter();
+            start = Profiler::Now();
+        }
+    }
+
+    inline ~ProfileZone()
+    {
+        if (name) Profiler::Leave(name, start, depth);
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t start = 0;
+    uint32_t depth = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if TRACER_PROFILER
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_FUNCTION()
+#endif
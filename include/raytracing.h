@@ -7,9 +7,14 @@
 
 #include <functional>
 #include <limits>
+#include <type_traits>
+#include <utility>
 
 #include <glm/glm.hpp>
 
+#include "arena.h"
+#include "simd.h"
+
 // Use 32-bit precision
 typedef float Float;
 typedef int32_t Int;
@@ -17,6 +22,7 @@ typedef uint32_t UInt;
 typedef glm::vec2 Vec2;
 typedef glm::vec3 Vec3;
 typedef glm::vec4 Vec4;
+typedef glm::ivec3 IVec3;
 typedef glm::mat2 Mat2;
 typedef glm::mat3 Mat3;
 typedef glm::mat4 Mat4;
@@ -27,23 +33,166 @@ const Float EPS = 0.00001f;
 class Ray
 {
 public:
+    Vec3 Origin;
+    UInt PrimitiveID = 0; // Scene specific id of the reported intersection
     Vec3 Direction;
     Float MinT;
     Vec3 InvDirection; // rcp of Direction
     Float MaxT;
 
-    Ray(Vec3 Direction, Float MinT = EPS, Float MaxT = MaxFloat);
+    Ray(Vec3 Origin, Vec3 Direction, Float MinT = EPS, Float MaxT = MaxFloat);
+};
+
+// Structure of arrays layout of N coherent rays
+template <int N>
+struct alignas(64) RayPacket
+{
+    static constexpr int Width = N;
+
+    Float OriginX[N];
+    Float OriginY[N];
+    Float OriginZ[N];
+    Float DirectionX[N];
+    Float DirectionY[N];
+    Float DirectionZ[N];
+    Float InvDirectionX[N];
+    Float InvDirectionY[N];
+    Float InvDirectionZ[N];
+    Float MinT[N];
+    Float MaxT[N];
+    UInt PrimitiveID[N];
+
+    inline void SetRay(int lane, const Ray& r)
+    {
+        OriginX[lane] = r.Origin.x;
+        OriginY[lane] = r.Origin.y;
+        OriginZ[lane] = r.Origin.z;
+        DirectionX[lane] = r.Direction.x;
+        DirectionY[lane] = r.Direction.y;
+        DirectionZ[lane] = r.Direction.z;
+        InvDirectionX[lane] = r.InvDirection.x;
+        InvDirectionY[lane] = r.InvDirection.y;
+        InvDirectionZ[lane] = r.InvDirection.z;
+        MinT[lane] = r.MinT;
+        MaxT[lane] = r.MaxT;
+        PrimitiveID[lane] = r.PrimitiveID;
+    }
+
+    inline Ray GetRay(int lane) const
+    {
+        Ray r(Vec3(OriginX[lane], OriginY[lane], OriginZ[lane]), Vec3(DirectionX[lane], DirectionY[lane], DirectionZ[lane]), MinT[lane], MaxT[lane]);
+        r.InvDirection = Vec3(InvDirectionX[lane], InvDirectionY[lane], InvDirectionZ[lane]);
+        r.PrimitiveID = PrimitiveID[lane];
+        return r;
+    }
+};
+
+typedef RayPacket<4> RayPacket4;
+typedef RayPacket<8> RayPacket8;
+typedef RayPacket<16> RayPacket16;
+
+// Shading inputs of a hit
+struct HitAttributes
+{
+    Vec3 Normal;
+    UInt Material;
 };
 
+// A scene reports the intersections along a ray one at a time.
+// On every NextIntersection call [MinT, MaxT] of the ray is the interval still searched,
+// on a hit the scene narrows MinT / MaxT to the extent of the hit & sets PrimitiveID.
 class Scene
 {
 public:
     class Context;
 
-    virtual Context* LaunchRay() = 0;
+    virtual ~Scene() = default;
+
+    // Contexts are placed in the given arena & die with it, the caller rewinds the arena once done
+    virtual Context* LaunchRay(ContextArena& arena) = 0;
     virtual bool NextIntersection(Context* ctx, Ray& r) = 0;
+
+    // Surface of a hit previously reported into r
+    virtual HitAttributes GetHitAttributes(const Ray& r) const = 0;
+
+    // Packet traversal, follows the single ray rules per lane.
+    // Returns the lanes of active that report a hit, 0 once every active lane is exhausted.
+    // The default implementation runs the single ray path lane by lane.
+    virtual Context* LaunchRayPacket(ContextArena& arena, int width);
+    virtual LaneMask NextIntersectionPacket(Context* ctx, RayPacket4& p, LaneMask active);
+    virtual LaneMask NextIntersectionPacket(Context* ctx, RayPacket8& p, LaneMask active);
+    virtual LaneMask NextIntersectionPacket(Context* ctx, RayPacket16& p, LaneMask active);
+
+    // Whether anything intersects the ray within [MinT, MaxT]. Hits may be found in any order &
+    // nothing is reported, so scenes can stop at the first one they come across.
+    // The default implementation runs NextIntersection until the first hit.
+    virtual bool Occluded(const Ray& r);
+
+    // Occluded lanes of active, the default implementation runs the packet traversal
+    virtual LaneMask OccludedPacket(const RayPacket4& p, LaneMask active);
+    virtual LaneMask OccludedPacket(const RayPacket8& p, LaneMask active);
+    virtual LaneMask OccludedPacket(const RayPacket16& p, LaneMask active);
+};
+
+// Per ray traversal state, lives in a ContextArena and is never destructed
+class Scene::Context
+{
+};
+
+// Static scene interface over any Scene, for RayTracing::TraceRay<> when the scene type is not known
+class DynamicScene
+{
+public:
+    // Launched lazily into the thread's arena, released when the trace is done
+    class RayContext
+    {
+    public:
+        ArenaScope scope{ ContextArena::ForThread() };
+        Scene::Context* ctx = nullptr;
+    };
+
+    DynamicScene(Scene* sc) : sc(sc) {}
+
+    inline bool Traverse(RayContext& c, Ray& r) const
+    {
+        if (!c.ctx) c.ctx = sc->LaunchRay(ContextArena::ForThread());
+        return sc->NextIntersection(c.ctx, r);
+    }
+
+    inline bool TraverseOcclusion(const Ray& r) const { return sc->Occluded(r); }
+
+    inline HitAttributes GetHitAttributes(const Ray& r) const { return sc->GetHitAttributes(r); }
+
+private:
+    Scene* sc;
+};
+
+// Scenes with their own any hit traversal provide bool TraverseOcclusion(const Ray&) const
+template <typename SceneT, typename = void>
+struct HasTraverseOcclusion : std::false_type
+{
+};
+
+template <typename SceneT>
+struct HasTraverseOcclusion<SceneT, std::void_t<decltype(std::declval<const SceneT&>().TraverseOcclusion(std::declval<const Ray&>()))>> : std::true_type
+{
 };
 
+// OccludedPacket as single ray queries, for scenes whose any hit traversal beats their packet one
+template <typename SceneT, int N>
+inline LaneMask OccludedPerLane(const SceneT& sc, const RayPacket<N>& p, LaneMask active)
+{
+    LaneMask occluded = 0;
+
+    for (; active; active &= active - 1)
+    {
+        int lane = LowestLane(active);
+        if (sc.TraverseOcclusion(p.GetRay(lane))) occluded |= LaneMask(1) << lane;
+    }
+
+    return occluded;
+}
+
 class RayTracing
 {
 public:
@@ -64,6 +213,24 @@ public:
     std::function<ClosestHitBehavior(const RayTracing&, const Ray&, void*)> cloestHitHandler = nullptr;
     std::function<AnyHitBehavior(const RayTracing&, const Ray&, void*)> anyHitHandler = nullptr;
 
+    // Placeholder for handlers a behavior never calls
+    struct NoHandler
+    {
+    };
+
+    // Statically dispatched TraceRay, the scene type, handlers & behaviors are all known at compile time
+    // so traversal and handlers inline into a single loop. SceneT provides a RayContext type and
+    // bool Traverse(RayContext&, Ray&) const following the NextIntersection rules, handlers take the
+    // same arguments as anyHitHandler & cloestHitHandler.
+    template <
+        AnyHitBehavior AnyHitFlag = AnyHitBehavior::COMMIT_AND_CONTINUE,
+        ClosestHitBehavior ClosestHitFlag = ClosestHitBehavior::RETURN,
+        typename SceneT,
+        typename AnyHitFn = NoHandler,
+        typename ClosestHitFn = NoHandler>
+    inline std::enable_if_t<!std::is_pointer<SceneT>::value> TraceRay(const SceneT& sc, Ray& r, AnyHitFn&& anyHit = {}, ClosestHitFn&& closestHit = {}, void* payload = nullptr);
+
+    // Dynamic version, dispatches to TraceRay<> through DynamicScene & the std::function handlers
     void TraceRay(
         Scene* sc,
         Ray& r,
@@ -71,4 +238,103 @@ public:
         ClosestHitBehavior closestHitFlag = ClosestHitBehavior::RETURN,
         void* payload = nullptr
         );
-};
\ No newline at end of file
+
+    // Traces a batch of rays. Rays are binned by origin cell & direction octant and traced
+    // in that order (as packets where possible), results land back in the original order.
+    // payloads (if any) holds one entry per ray
+    void TraceRays(
+        Scene* sc,
+        Ray* rays,
+        size_t count,
+        AnyHitBehavior anyHitFlag = AnyHitBehavior::COMMIT_AND_CONTINUE,
+        ClosestHitBehavior closestHitFlag = ClosestHitBehavior::RETURN,
+        void* const* payloads = nullptr
+        );
+
+    // Origin cell size used to bin rays in TraceRays
+    Float batchCellSize = 4.0f;
+
+    // Traces the active lanes of a packet, payloads (if any) holds one entry per lane
+    void TraceRayPacket(Scene* sc, RayPacket4& p, LaneMask active = AllLanes<4>(), AnyHitBehavior anyHitFlag = AnyHitBehavior::COMMIT_AND_CONTINUE, ClosestHitBehavior closestHitFlag = ClosestHitBehavior::RETURN, void* const* payloads = nullptr);
+    void TraceRayPacket(Scene* sc, RayPacket8& p, LaneMask active = AllLanes<8>(), AnyHitBehavior anyHitFlag = AnyHitBehavior::COMMIT_AND_CONTINUE, ClosestHitBehavior closestHitFlag = ClosestHitBehavior::RETURN, void* const* payloads = nullptr);
+    void TraceRayPacket(Scene* sc, RayPacket16& p, LaneMask active = AllLanes<16>(), AnyHitBehavior anyHitFlag = AnyHitBehavior::COMMIT_AND_CONTINUE, ClosestHitBehavior closestHitFlag = ClosestHitBehavior::RETURN, void* const* payloads = nullptr);
+
+    // Visibility queries (shadow rays & the like): true if anything intersects [MinT, MaxT] of the ray.
+    // No handlers run & the ray is left untouched, traversal stops at the first hit found.
+    // Goes through SceneT::TraverseOcclusion if the scene has one, else the first Traverse hit.
+    template <typename SceneT>
+    inline std::enable_if_t<!std::is_pointer<SceneT>::value, bool> TraceOcclusion(const SceneT& sc, const Ray& r);
+
+    // Dynamic version, Scene::Occluded
+    bool TraceOcclusion(Scene* sc, const Ray& r);
+
+    // Batch of visibility queries binned like TraceRays, occluded receives one result per ray
+    void TraceOcclusions(Scene* sc, const Ray* rays, size_t count, bool* occluded);
+
+    // Occluded lanes of active
+    LaneMask TraceOcclusionPacket(Scene* sc, const RayPacket4& p, LaneMask active = AllLanes<4>());
+    LaneMask TraceOcclusionPacket(Scene* sc, const RayPacket8& p, LaneMask active = AllLanes<8>());
+    LaneMask TraceOcclusionPacket(Scene* sc, const RayPacket16& p, LaneMask active = AllLanes<16>());
+
+private:
+    template <int N>
+    void TracePacket(Scene* sc, RayPacket<N>& p, LaneMask active, AnyHitBehavior anyHitFlag, ClosestHitBehavior closestHitFlag, void* const* payloads);
+};
+
+template <typename SceneT>
+inline std::enable_if_t<!std::is_pointer<SceneT>::value, bool> RayTracing::TraceOcclusion(const SceneT& sc, const Ray& r)
+{
+    if constexpr (HasTraverseOcclusion<SceneT>::value)
+    {
+        return sc.TraverseOcclusion(r);
+    }
+    else
+    {
+        typename SceneT::RayContext ctx;
+        Ray tempRay = r;
+        return sc.Traverse(ctx, tempRay);
+    }
+}
+
+template <
+    RayTracing::AnyHitBehavior AnyHitFlag,
+    RayTracing::ClosestHitBehavior ClosestHitFlag,
+    typename SceneT,
+    typename AnyHitFn,
+    typename ClosestHitFn>
+inline std::enable_if_t<!std::is_pointer<SceneT>::value> RayTracing::TraceRay(const SceneT& sc, Ray& r, AnyHitFn&& anyHit, ClosestHitFn&& closestHit, void* payload)
+{
+    typename SceneT::RayContext ctx;
+    Ray query = r;
+    Ray tempRay = r;
+
+    bool hasHit = false;
+
+    while (sc.Traverse(ctx, tempRay))
+    {
+        AnyHitBehavior anyhit = AnyHitFlag;
+
+        if constexpr (AnyHitFlag == AnyHitBehavior::CALL_HANDLER)
+            anyhit = anyHit(*this, tempRay, payload);
+
+        if (anyhit == AnyHitBehavior::COMMIT_AND_CONTINUE || anyhit == AnyHitBehavior::COMMIT_AND_RETURN)
+        {
+            r.MaxT = tempRay.MaxT;
+            r.MinT = tempRay.MinT;
+            r.PrimitiveID = tempRay.PrimitiveID;
+            hasHit = true;
+
+            // Only closer hits are of interest from now on
+            query.MaxT = tempRay.MinT;
+        }
+
+        if (anyhit == AnyHitBehavior::COMMIT_AND_RETURN) break;
+
+        tempRay = query;
+    }
+
+    if constexpr (ClosestHitFlag == ClosestHitBehavior::CALL_HANDLER)
+    {
+        if (hasHit) closestHit(*this, r, payload);
+    }
+}
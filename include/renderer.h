@@ -0,0 +1,251 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - CPU Renderer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "profiler.h"
+#include "raytracing.h"
+#include "threadpool.h"
+
+struct Camera
+{
+    Vec3 position = Vec3(0.0f);
+    Vec3 forward = Vec3(0.0f, 0.0f, 1.0f);
+    Vec3 up = Vec3(0.0f, 1.0f, 0.0f);
+    Float fov = 60.0f; // Vertical, in degrees
+
+    // u, v in [-1, 1], v pointing up
+    Ray GenerateRay(Float u, Float v, Float aspect) const;
+
+    bool operator==(const Camera& other) const;
+    bool operator!=(const Camera& other) const { return !(*this == other); }
+};
+
+// Splits the frame into tiles & traces them on the thread pool, the scene is shared read only
+class Renderer
+{
+public:
+    struct Stats
+    {
+        double frameMs = 0.0;
+        double megaRaysPerSecond = 0.0;
+        std::vector<double> threadUtilization; // Busy time / frame time per pool thread
+        std::vector<uint64_t> threadSteals;
+        uint64_t rays = 0; // Primary rays of the frame
+
+        // Progressive mode
+        size_t activeTiles = 0;       // Tiles sampled this frame
+        uint64_t accumulatedRays = 0; // Since the last restart
+        UInt maxSamples = 0;          // Of the most sampled pixel
+        bool converged = false;       // Every pixel is under the threshold or at maxSamples
+    };
+
+    // Pixels take samples while the standard error of the mean, in luminance, of them or one of their
+    // 8 neighbors is above threshold. Looking at the neighbors & minSamples keep pixels from stopping
+    // on a lucky first few samples that all missed a small feature.
+    struct ProgressiveSettings
+    {
+        UInt minSamples = 8;
+        UInt maxSamples = 1024;
+        UInt samplesPerFrame = 1; // Per active pixel
+        Float threshold = 0.004f;
+    };
+
+    size_t tileSize = 16;
+    ProgressiveSettings progressive;
+    Vec3 sunDirection = glm::normalize(Vec3(0.4f, 1.0f, 0.25f));
+
+    Renderer(ThreadPool* pool, size_t width, size_t height);
+
+    void Resize(size_t width, size_t height);
+
+    // SceneT follows the static scene interface of RayTracing::TraceRay<>, wrap a Scene* in DynamicScene
+    template <typename SceneT>
+    void Render(const SceneT& sc, const Camera& camera);
+
+    // Accumulates jittered samples over frames while the camera & sceneVersion stay the same, any
+    // change (or a Render() in between) restarts. Only pixels whose error estimate is still above
+    // progressive.threshold are traced & tiles without any are skipped, the framebuffer holds the
+    // running mean. Costs 36 bytes per pixel on top of the framebuffer.
+    template <typename SceneT>
+    void RenderProgressive(const SceneT& sc, const Camera& camera, uint64_t sceneVersion = 0);
+
+    void RestartAccumulation();
+
+    size_t Width() const { return width; }
+    size_t Height() const { return height; }
+
+    // RGBA32F, row 0 at the bottom like GL textures
+    const Vec4* Framebuffer() const { return framebuffer.data(); }
+
+    const Stats& GetStats() const { return stats; }
+
+private:
+    ThreadPool* pool;
+
+    size_t width;
+    size_t height;
+    std::vector<Vec4> framebuffer;
+
+    Stats stats;
+    std::chrono::steady_clock::time_point frameStart;
+
+    struct TileState
+    {
+        UInt samples = 0;   // Of the most sampled pixel
+        uint64_t rays = 0;  // Traced in the last pass
+        bool active = true; // Has pixels to sample
+    };
+
+    // Progressive state, rgb sums & the sum of squared luminance per pixel
+    std::vector<Vec4> accumulation;
+    std::vector<UInt> pixelSamples;
+    std::vector<Float> pixelError;    // Standard error after the last pass, MaxFloat below minSamples, 0 at maxSamples
+    std::vector<uint8_t> pixelActive; // Decided for the whole frame before tracing
+    std::vector<TileState> tiles;
+    std::vector<size_t> activeTiles;
+    Camera accumulatedCamera;
+    uint64_t accumulatedVersion = 0;
+    bool accumulating = false;
+
+    size_t NumTiles() const;
+    void TileBounds(size_t tile, size_t& x0, size_t& y0, size_t& x1, size_t& y1) const;
+    void BeginFrame();
+    void EndFrame(uint64_t rays);
+
+    // Restarts if needed & picks the pixels & tiles to sample
+    void SelectTiles(const Camera& camera, uint64_t sceneVersion);
+    void SelectPixels(size_t tile);
+    void EndProgressiveFrame();
+
+    template <typename SceneT>
+    void RenderTile(const SceneT& sc, const Camera& camera, size_t tile);
+
+    template <typename SceneT>
+    void RenderTileProgressive(const SceneT& sc, const Camera& camera, size_t tile);
+
+    // Per pixel rotation of the R2 sequence, decorrelates the sample positions of neighbors
+    static Vec2 PixelJitter(size_t x, size_t y, UInt sample);
+
+    static Float PixelError(const Vec4& sum, UInt samples);
+
+    Vec4 Sky(const Ray& r) const;
+    Vec4 Shade(const HitAttributes& attr) const;
+};
+
+template <typename SceneT>
+void Renderer::Render(const SceneT& sc, const Camera& camera)
+{
+    PROFILE_ZONE("Render");
+
+    // The framebuffer no longer holds the accumulated mean
+    accumulating = false;
+
+    BeginFrame();
+    pool->ParallelFor(NumTiles(), [&](size_t tile) { RenderTile(sc, camera, tile); });
+    EndFrame(uint64_t(width) * uint64_t(height));
+}
+
+template <typename SceneT>
+void Renderer::RenderProgressive(const SceneT& sc, const Camera& camera, uint64_t sceneVersion)
+{
+    PROFILE_ZONE("Render Progressive");
+
+    BeginFrame();
+    SelectTiles(camera, sceneVersion);
+    pool->ParallelFor(activeTiles.size(), [&](size_t i) { RenderTileProgressive(sc, camera, activeTiles[i]); });
+    EndProgressiveFrame();
+}
+
+template <typename SceneT>
+void Renderer::RenderTile(const SceneT& sc, const Camera& camera, size_t tile)
+{
+    PROFILE_ZONE("Tile");
+
+    size_t x0, y0, x1, y1;
+    TileBounds(tile, x0, y0, x1, y1);
+
+    Float aspect = Float(width) / Float(height);
+
+    // Traversal state of the whole tile is dropped at once
+    ArenaScope scope(ContextArena::ForThread());
+    RayTracing rt;
+
+    for (size_t y = y0; y < y1; y++)
+    {
+        for (size_t x = x0; x < x1; x++)
+        {
+            Float u = (Float(x) + 0.5f) / Float(width) * 2.0f - 1.0f;
+            Float v = (Float(y) + 0.5f) / Float(height) * 2.0f - 1.0f;
+
+            Ray r = camera.GenerateRay(u, v, aspect);
+            rt.TraceRay(sc, r);
+
+            framebuffer[y * width + x] = (r.MaxT == MaxFloat) ? Sky(r) : Shade(sc.GetHitAttributes(r));
+        }
+    }
+}
+
+template <typename SceneT>
+void Renderer::RenderTileProgressive(const SceneT& sc, const Camera& camera, size_t tile)
+{
+    PROFILE_ZONE("Progressive Tile");
+
+    size_t x0, y0, x1, y1;
+    TileBounds(tile, x0, y0, x1, y1);
+
+    Float aspect = Float(width) / Float(height);
+
+    ArenaScope scope(ContextArena::ForThread());
+    RayTracing rt;
+
+    TileState& state = tiles[tile];
+    state.rays = 0;
+
+    UInt maxSamples = glm::max(progressive.maxSamples, 1u);
+
+    for (size_t y = y0; y < y1; y++)
+    {
+        for (size_t x = x0; x < x1; x++)
+        {
+            size_t pixel = y * width + x;
+            if (!pixelActive[pixel]) continue;
+
+            Vec4& sum = accumulation[pixel];
+            UInt& samples = pixelSamples[pixel];
+
+            UInt first = samples;
+            samples = glm::min(samples + progressive.samplesPerFrame, maxSamples);
+
+            for (UInt s = first; s < samples; s++)
+            {
+                Vec2 jitter = PixelJitter(x, y, s);
+                Float u = (Float(x) + jitter.x) / Float(width) * 2.0f - 1.0f;
+                Float v = (Float(y) + jitter.y) / Float(height) * 2.0f - 1.0f;
+
+                Ray r = camera.GenerateRay(u, v, aspect);
+                rt.TraceRay(sc, r);
+
+                Vec3 c = Vec3((r.MaxT == MaxFloat) ? Sky(r) : Shade(sc.GetHitAttributes(r)));
+                Float luminance = glm::dot(c, Vec3(0.2126f, 0.7152f, 0.0722f));
+                sum += Vec4(c, luminance * luminance);
+            }
+
+            framebuffer[pixel] = Vec4(Vec3(sum) / Float(samples), 1.0f);
+            // Pixels out of samples stop holding their neighbors back
+            if (samples >= maxSamples)
+                pixelError[pixel] = 0.0f;
+            else
+                pixelError[pixel] = samples < progressive.minSamples ? MaxFloat : PixelError(sum, samples);
+
+            state.samples = glm::max(state.samples, samples);
+            state.rays += samples - first;
+        }
+    }
+}
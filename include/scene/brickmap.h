@@ -0,0 +1,178 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Brick Map
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "raytracing.h"
+#include "voxel.h"
+#include "voxelgrid.h"
+
+// Two level voxel storage: a coarse grid of 8^3 bricks, empty bricks are just a null index.
+// Occupancy masks & materials of a brick are kept apart so traversal only touches the masks.
+class BrickMapScene final : public Scene
+{
+public:
+    static constexpr Int BrickSize = 8;
+    static constexpr Int BrickVoxels = BrickSize * BrickSize * BrickSize;
+    static constexpr UInt NullBrick = 0xFFFFFFFFu;
+
+    struct Brick
+    {
+        uint64_t occupancy[BrickSize]; // Slice z, bit x + y * 8
+
+        inline bool Test(IVec3 local) const
+        {
+            return (occupancy[local.z] >> (local.x + local.y * BrickSize)) & 1;
+        }
+    };
+
+    class BrickMapContext : public Context
+    {
+    public:
+        GridDDA coarse;
+        GridDDA fine;
+
+        Float t = 0.0f;      // Entry of the current brick cell
+        Float tExit = 0.0f;  // Exit of the map bounds
+        Float fineT = 0.0f;  // Entry of the current voxel inside the brick
+        Float brickExit = 0.0f;
+
+        UInt brick = NullBrick;
+        bool inBrick = false;
+        bool started = false;
+    };
+
+    // size is rounded up to whole bricks
+    BrickMapScene(IVec3 size);
+    BrickMapScene(IVec3 size, const Voxel* voxels, size_t count);
+    BrickMapScene(const VoxelGridScene& grid);
+
+    IVec3 Size() const { return size; }
+    IVec3 GridSize() const { return gridSize; }
+
+    UInt Get(IVec3 p) const;
+    void Set(IVec3 p, UInt material);
+    void ApplyEdits(const Voxel* edits, size_t count);
+
+    // Bricks changed by Set or ApplyEdits since the last ClearDirty(), in brick coordinates
+    const std::vector<IVec3>& DirtyBricks() const { return dirtyBricks; }
+    void ClearDirty();
+
+    // Counts the voxels Set or ApplyEdits changed, accumulating renderers restart when it moves
+    uint64_t Version() const { return version; }
+
+    // BrickVoxels materials of a brick in LocalIndex order, nullptr for empty bricks
+    const UInt* BrickMaterials(IVec3 brick) const;
+
+    size_t NumBricks() const { return bricks.size(); }
+    size_t SolidVoxels() const;
+    size_t MemoryUsage() const;
+    double BytesPerSolidVoxel() const;
+
+    // Static scene interface for RayTracing::TraceRay<>, NextIntersection forwards here
+    typedef BrickMapContext RayContext;
+    bool Traverse(BrickMapContext& c, Ray& r) const;
+
+    Context* LaunchRay(ContextArena& arena) override;
+    bool NextIntersection(Context* ctx, Ray& r) override;
+    HitAttributes GetHitAttributes(const Ray& r) const override;
+
+private:
+    friend class Voxelizer;
+
+    IVec3 size;
+    IVec3 gridSize;
+
+    std::vector<UInt> grid; // Brick index or NullBrick
+    std::vector<Brick> bricks;
+    std::vector<UInt> materials; // BrickVoxels per brick
+
+    std::vector<IVec3> dirtyBricks;
+    std::vector<uint8_t> dirty; // Per grid cell, set while the brick is in dirtyBricks
+    uint64_t version = 0;
+
+    inline size_t GridIndex(IVec3 brick) const
+    {
+        return (size_t(brick.z) * size_t(gridSize.y) + size_t(brick.y)) * size_t(gridSize.x) + size_t(brick.x);
+    }
+
+    static inline UInt LocalIndex(IVec3 local)
+    {
+        return UInt(local.x + local.y * BrickSize + local.z * BrickSize * BrickSize);
+    }
+};
+
+inline bool BrickMapScene::Traverse(BrickMapContext& c, Ray& r) const
+{
+    if (!c.started)
+    {
+        c.started = true;
+
+        Float tEnter;
+        if (!IntersectBox(r, Vec3(0.0f), Vec3(size), tEnter, c.tExit))
+        {
+            c.t = MaxFloat;
+            return false;
+        }
+
+        c.t = tEnter;
+        c.coarse.Init(r, tEnter, Vec3(0.0f), Float(BrickSize), gridSize);
+    }
+
+    Float tEnd = glm::min(c.tExit, r.MaxT);
+
+    for (;;)
+    {
+        // Fine DDA inside an occupied brick
+        if (c.inBrick)
+        {
+            const Brick& brick = bricks[c.brick];
+            Float brickEnd = glm::min(c.brickExit, tEnd);
+
+            while (c.fineT < brickEnd && c.fine.Inside(IVec3(BrickSize)))
+            {
+                IVec3 local = c.fine.cell;
+                Float tEnter = c.fineT;
+
+                c.fineT = c.fine.Step();
+
+                if (brick.Test(local))
+                {
+                    r.MinT = tEnter;
+                    r.MaxT = glm::min(c.fineT, brickEnd);
+                    r.PrimitiveID = c.brick * BrickVoxels + LocalIndex(local);
+                    return true;
+                }
+            }
+
+            c.inBrick = false;
+        }
+
+        // Coarse DDA skipping over empty bricks
+        while (c.t < tEnd && c.coarse.Inside(gridSize))
+        {
+            IVec3 cell = c.coarse.cell;
+            Float tEnter = c.t;
+
+            c.t = c.coarse.Step();
+
+            UInt b = grid[GridIndex(cell)];
+            if (b != NullBrick)
+            {
+                c.brick = b;
+                c.brickExit = c.t;
+                c.fineT = tEnter;
+                c.fine.Init(r, tEnter, Vec3(cell * BrickSize), 1.0f, IVec3(BrickSize));
+                c.inBrick = true;
+                break;
+            }
+        }
+
+        if (!c.inBrick) return false;
+    }
+}
@@ -0,0 +1,257 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Triangle BVH
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "raytracing.h"
+#include "threadpool.h"
+#include "gfx/mesh.h"
+
+// Binary BVH over the triangles of a set of meshes, built with binned SAH.
+// Traversal only touches the nodes & a compact copy of the triangle positions in leaf order,
+// the full vertices stay in the source meshes (which must outlive the scene) for hit attributes.
+class BVHScene final : public Scene
+{
+public:
+    static constexpr int StackSize = 64;
+    static constexpr int MaxDepth = StackSize - 4;
+    static constexpr int NumBins = 16;
+    static constexpr UInt MaxLeafSize = 4;
+
+    struct Node
+    {
+        Vec3 boundsMin;
+        UInt leftFirst; // Left child (right one follows it) or first triangle of a leaf
+        Vec3 boundsMax;
+        UInt count;     // Triangles of a leaf, 0 for interior nodes
+    };
+
+    // Vertex 0 and the two edges leaving it, what Moller-Trumbore wants
+    struct Triangle
+    {
+        Vec3 v0;
+        Vec3 e1;
+        Vec3 e2;
+    };
+
+    struct TriangleSource
+    {
+        UInt mesh;
+        UInt triangle;
+    };
+
+    class BVHContext : public Context
+    {
+    public:
+        UInt stack[StackSize];
+        Float stackT[StackSize]; // Entry of the node box, lets committed hits cull it
+        int stackPtr = 0;
+
+        UInt leafNext = 0;
+        UInt leafEnd = 0;
+        bool started = false;
+    };
+
+    // Mesh triangles are vertices[vertexOffset + indicies[indexOffset + i]] for i in [0, count).
+    // Without a pool the build runs on the calling thread.
+    BVHScene(const Mesh* meshes, size_t numMeshes, ThreadPool* pool = nullptr);
+
+    size_t NumTriangles() const { return triangles.size(); }
+    size_t NumNodes() const { return nodes.size(); }
+    double BuildSeconds() const { return buildSeconds; }
+
+    // Bytes touched by traversal, the nodes & leaf ordered triangles
+    size_t MemoryUsage() const;
+
+    typedef BVHContext RayContext;
+    bool Traverse(BVHContext& c, Ray& r) const;
+
+    // Any hit traversal without resumable state or culling by committed hits, done at the first triangle hit
+    bool TraverseOcclusion(const Ray& r) const;
+
+    Context* LaunchRay(ContextArena& arena) override;
+    bool NextIntersection(Context* ctx, Ray& r) override;
+    HitAttributes GetHitAttributes(const Ray& r) const override;
+
+    bool Occluded(const Ray& r) override;
+    LaneMask OccludedPacket(const RayPacket4& p, LaneMask active) override;
+    LaneMask OccludedPacket(const RayPacket8& p, LaneMask active) override;
+    LaneMask OccludedPacket(const RayPacket16& p, LaneMask active) override;
+
+private:
+    friend class BVH8Scene;
+
+    struct PrimRef
+    {
+        Vec3 boundsMin;
+        UInt index;
+        Vec3 boundsMax;
+        UInt padding;
+    };
+
+    std::vector<Mesh> meshes;
+
+    std::vector<Node> nodes; // Root is node 0
+    std::vector<Triangle> triangles;
+    std::vector<TriangleSource> sources; // Cold, parallel to triangles
+
+    double buildSeconds = 0.0;
+
+    void Build(ThreadPool* pool);
+    static HitAttributes TriangleHitAttributes(const Mesh& m, const Triangle& tri, UInt triangle, const Ray& r);
+    void BuildNode(ThreadPool* pool, std::vector<PrimRef>& refs, UInt nodeIndex, UInt begin, UInt end, int depth, std::atomic<UInt>& nodeCount);
+
+    static inline bool IntersectNode(const Node& n, const Ray& r, Float& tEnter)
+    {
+        Vec3 t0 = (n.boundsMin - r.Origin) * r.InvDirection;
+        Vec3 t1 = (n.boundsMax - r.Origin) * r.InvDirection;
+        Vec3 tNear = glm::min(t0, t1);
+        Vec3 tFar = glm::max(t0, t1);
+
+        tEnter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, r.MinT));
+        Float tExit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, r.MaxT));
+
+        return tEnter <= tExit;
+    }
+
+    // Hits strictly inside (MinT, MaxT), so a committed hit is not reported again
+    static inline bool IntersectTriangle(const Triangle& tri, const Ray& r, Float& t)
+    {
+        Vec3 p = glm::cross(r.Direction, tri.e2);
+        Float det = glm::dot(tri.e1, p);
+        if (glm::abs(det) < 1e-12f) return false;
+
+        Float invDet = 1.0f / det;
+        Vec3 s = r.Origin - tri.v0;
+        Float u = glm::dot(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f) return false;
+
+        Vec3 q = glm::cross(s, tri.e1);
+        Float v = glm::dot(r.Direction, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f) return false;
+
+        t = glm::dot(tri.e2, q) * invDet;
+        return t > r.MinT && t < r.MaxT;
+    }
+};
+
+inline bool BVHScene::Traverse(BVHContext& c, Ray& r) const
+{
+    if (!c.started)
+    {
+        c.started = true;
+
+        Float tEnter;
+        if (!triangles.empty() && IntersectNode(nodes[0], r, tEnter))
+        {
+            c.stack[c.stackPtr] = 0;
+            c.stackT[c.stackPtr++] = tEnter;
+        }
+    }
+
+    for (;;)
+    {
+        // Finish the current leaf first
+        while (c.leafNext < c.leafEnd)
+        {
+            UInt i = c.leafNext++;
+
+            Float t;
+            if (IntersectTriangle(triangles[i], r, t))
+            {
+                r.MinT = t;
+                r.MaxT = t;
+                r.PrimitiveID = i;
+                return true;
+            }
+        }
+
+        if (c.stackPtr == 0) return false;
+
+        c.stackPtr--;
+        if (c.stackT[c.stackPtr] > r.MaxT) continue;
+
+        const Node& n = nodes[c.stack[c.stackPtr]];
+
+        if (n.count)
+        {
+            c.leafNext = n.leftFirst;
+            c.leafEnd = n.leftFirst + n.count;
+            continue;
+        }
+
+        UInt first = n.leftFirst;
+        UInt second = n.leftFirst + 1;
+
+        Float tFirst, tSecond;
+        bool hitFirst = IntersectNode(nodes[first], r, tFirst);
+        bool hitSecond = IntersectNode(nodes[second], r, tSecond);
+
+        if (hitFirst && hitSecond && tSecond < tFirst)
+        {
+            std::swap(first, second);
+            std::swap(tFirst, tSecond);
+        }
+
+        // Nearest child ends up on top of the stack
+        if (hitSecond)
+        {
+            c.stack[c.stackPtr] = second;
+            c.stackT[c.stackPtr++] = tSecond;
+        }
+
+        if (hitFirst)
+        {
+            c.stack[c.stackPtr] = first;
+            c.stackT[c.stackPtr++] = tFirst;
+        }
+    }
+}
+
+inline bool BVHScene::TraverseOcclusion(const Ray& r) const
+{
+    Float tEnter;
+    if (triangles.empty() || !IntersectNode(nodes[0], r, tEnter)) return false;
+
+    // At most one sibling is left behind per level
+    UInt stack[StackSize];
+    int stackPtr = 0;
+    stack[stackPtr++] = 0;
+
+    while (stackPtr)
+    {
+        const Node& n = nodes[stack[--stackPtr]];
+
+        if (n.count)
+        {
+            for (UInt i = n.leftFirst; i < n.leftFirst + n.count; i++)
+            {
+                Float t;
+                if (IntersectTriangle(triangles[i], r, t)) return true;
+            }
+
+            continue;
+        }
+
+        // Nearer child first still pays off, blockers are more likely close to the origin
+        UInt first = n.leftFirst;
+        UInt second = n.leftFirst + 1;
+
+        Float tFirst, tSecond;
+        bool hitFirst = IntersectNode(nodes[first], r, tFirst);
+        bool hitSecond = IntersectNode(nodes[second], r, tSecond);
+
+        if (hitFirst && hitSecond && tSecond < tFirst) std::swap(first, second);
+
+        if (hitSecond) stack[stackPtr++] = second;
+        if (hitFirst) stack[stackPtr++] = first;
+    }
+
+    return false;
+}
@@ -0,0 +1,245 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Wide Triangle BVH
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "raytracing.h"
+#include "threadpool.h"
+#include "scene/bvh.h"
+
+// 8 wide BVH collapsed from the binary SAH BVH. Child boxes are stored as 8 bit offsets on a
+// power of two grid spanning the node, so a node is one cache line & all 8 children are tested
+// in a single SimdFloat<8> pass. Child links live in a separate array only read for hit children.
+class BVH8Scene final : public Scene
+{
+public:
+    static constexpr int Width = 8;
+    static constexpr int StackSize = (Width - 1) * BVHScene::MaxDepth + 1; // Each level leaves at most 7 siblings behind
+
+    struct alignas(64) Node
+    {
+        Vec3 origin;
+        int8_t exponent[3]; // Grid step per axis is 2^exponent
+        uint8_t validMask;  // Bit i set if child slot i is used
+        uint8_t lo[3][Width];
+        uint8_t hi[3][Width];
+    };
+
+    struct NodeLinks
+    {
+        UInt child[Width]; // Node index, or first triangle of a leaf child
+        UInt count[Width]; // Triangles of a leaf child, 0 for interior children
+    };
+
+    class BVH8Context : public Context
+    {
+    public:
+        struct Entry
+        {
+            UInt child;
+            UInt count;
+            Float tEnter;
+        };
+
+        Entry stack[StackSize];
+        int stackPtr = 0;
+
+        UInt leafNext = 0;
+        UInt leafEnd = 0;
+        bool started = false;
+    };
+
+    // Same mesh layout & lifetime rules as BVHScene
+    BVH8Scene(const Mesh* meshes, size_t numMeshes, ThreadPool* pool = nullptr);
+
+    size_t NumTriangles() const { return triangles.size(); }
+    size_t NumNodes() const { return nodes.size(); }
+    double BuildSeconds() const { return buildSeconds; }
+
+    // Bytes touched by traversal, nodes, links & leaf ordered triangles
+    size_t MemoryUsage() const;
+
+    typedef BVH8Context RayContext;
+    bool Traverse(BVH8Context& c, Ray& r) const;
+
+    // Any hit traversal, hit children are pushed unsorted & the first triangle hit ends it
+    bool TraverseOcclusion(const Ray& r) const;
+
+    Context* LaunchRay(ContextArena& arena) override;
+    bool NextIntersection(Context* ctx, Ray& r) override;
+    HitAttributes GetHitAttributes(const Ray& r) const override;
+
+    bool Occluded(const Ray& r) override;
+    LaneMask OccludedPacket(const RayPacket4& p, LaneMask active) override;
+    LaneMask OccludedPacket(const RayPacket8& p, LaneMask active) override;
+    LaneMask OccludedPacket(const RayPacket16& p, LaneMask active) override;
+
+private:
+    std::vector<Mesh> meshes;
+
+    std::vector<Node> nodes; // Root is node 0
+    std::vector<NodeLinks> links;
+    std::vector<BVHScene::Triangle> triangles;
+    std::vector<BVHScene::TriangleSource> sources;
+
+    BVHScene::Node root = { Vec3(0.0f), 0, Vec3(0.0f), 0 };
+
+    double buildSeconds = 0.0;
+
+    UInt Collapse(const BVHScene& bvh, UInt bvhNode);
+
+    // 2^e straight from the exponent bits, e within [-126, 127]
+    static inline Float Exp2(int e)
+    {
+        uint32_t bits = uint32_t(e + 127) << 23;
+        Float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // Entry distances of the children, returns the hit ones
+    static inline LaneMask IntersectChildren(const Node& n, const Ray& r, Float* tEnter)
+    {
+        typedef SimdFloat<Width> F;
+
+        F tNear = F::Set1(r.MinT);
+        F tFar = F::Set1(r.MaxT);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // Plane t = (q * step + origin - o) / d, the position is formed first so that
+            // axis parallel rays see +-inf instead of 0 * inf
+            F step = F::Set1(Exp2(n.exponent[axis]));
+            F offset = F::Set1(n.origin[axis] - r.Origin[axis]);
+            F invDir = F::Set1(r.InvDirection[axis]);
+
+            F t0 = (F::LoadBytes(n.lo[axis]) * step + offset) * invDir;
+            F t1 = (F::LoadBytes(n.hi[axis]) * step + offset) * invDir;
+
+            tNear = Max(tNear, Min(t0, t1));
+            tFar = Min(tFar, Max(t0, t1));
+        }
+
+        tNear.Store(tEnter);
+        return LessEqual(tNear, tFar) & n.validMask;
+    }
+};
+
+inline bool BVH8Scene::Traverse(BVH8Context& c, Ray& r) const
+{
+    if (!c.started)
+    {
+        c.started = true;
+
+        Float tEnter;
+        if (!triangles.empty() && BVHScene::IntersectNode(root, r, tEnter))
+            c.stack[c.stackPtr++] = { 0, 0, tEnter };
+    }
+
+    for (;;)
+    {
+        // Finish the current leaf first
+        while (c.leafNext < c.leafEnd)
+        {
+            UInt i = c.leafNext++;
+
+            Float t;
+            if (BVHScene::IntersectTriangle(triangles[i], r, t))
+            {
+                r.MinT = t;
+                r.MaxT = t;
+                r.PrimitiveID = i;
+                return true;
+            }
+        }
+
+        if (c.stackPtr == 0) return false;
+
+        BVH8Context::Entry e = c.stack[--c.stackPtr];
+        if (e.tEnter > r.MaxT) continue;
+
+        if (e.count)
+        {
+            c.leafNext = e.child;
+            c.leafEnd = e.child + e.count;
+            continue;
+        }
+
+        alignas(32) Float tEnter[Width];
+        LaneMask hits = IntersectChildren(nodes[e.child], r, tEnter);
+        if (!hits) continue;
+
+        const NodeLinks& l = links[e.child];
+
+        // Sort the hit children far to near, nearest ends up on top of the stack
+        BVH8Context::Entry children[Width];
+        int numChildren = 0;
+
+        for (; hits; hits &= hits - 1)
+        {
+            int i = LowestLane(hits);
+            BVH8Context::Entry child = { l.child[i], l.count[i], tEnter[i] };
+
+            int j = numChildren++;
+            while (j > 0 && children[j - 1].tEnter < child.tEnter)
+            {
+                children[j] = children[j - 1];
+                j--;
+            }
+            children[j] = child;
+        }
+
+        for (int i = 0; i < numChildren; i++)
+            c.stack[c.stackPtr++] = children[i];
+    }
+}
+
+inline bool BVH8Scene::TraverseOcclusion(const Ray& r) const
+{
+    Float rootEnter;
+    if (triangles.empty() || !BVHScene::IntersectNode(root, r, rootEnter)) return false;
+
+    struct Entry
+    {
+        UInt child;
+        UInt count;
+    };
+
+    Entry stack[StackSize];
+    int stackPtr = 0;
+    stack[stackPtr++] = { 0, 0 };
+
+    while (stackPtr)
+    {
+        Entry e = stack[--stackPtr];
+
+        if (e.count)
+        {
+            for (UInt i = e.child; i < e.child + e.count; i++)
+            {
+                Float t;
+                if (BVHScene::IntersectTriangle(triangles[i], r, t)) return true;
+            }
+
+            continue;
+        }
+
+        alignas(32) Float tEnter[Width];
+        LaneMask hits = IntersectChildren(nodes[e.child], r, tEnter);
+        const NodeLinks& l = links[e.child];
+
+        for (; hits; hits &= hits - 1)
+        {
+            int i = LowestLane(hits);
+            stack[stackPtr++] = { l.child[i], l.count[i] };
+        }
+    }
+
+    return false;
+}
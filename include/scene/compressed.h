@@ -0,0 +1,216 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Compressed Voxel Chunks
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "raytracing.h"
+#include "threadpool.h"
+#include "voxel.h"
+#include "voxelgrid.h"
+#include "brickmap.h"
+
+// Brick map style two level storage over 16^3 chunks, each chunk compressed on its own:
+//  - a palette of the materials in the chunk, index 0 is always empty space
+//  - every row along x is run length encoded, a 16 bit mask marks where runs start so the run
+//    holding voxel x is just the popcount of the mask up to x
+//  - run values are bit packed at the smallest of 1, 2, 4, 8 or 16 bits that fits the palette,
+//    power of two widths never straddle a 32 bit word
+// Chunks filled with a single material store no rows at all.
+
+// Palette index of voxel local of a non uniform 16^3 chunk, given its rows & run words
+inline UInt ChunkPaletteIndex(const uint32_t* rows, const uint32_t* runWords, UInt bits, IVec3 local)
+{
+    uint32_t row = rows[local.y + local.z * 16];
+    UInt run = (row >> 16) + PopCount(row & ((2u << local.x) - 1u)) - 1;
+
+    UInt bit = run * bits;
+    return (runWords[bit >> 5] >> (bit & 31)) & ((1u << bits) - 1u);
+}
+
+class CompressedVoxelScene final : public Scene
+{
+public:
+    static constexpr Int ChunkSize = 16;
+    static constexpr Int ChunkRows = ChunkSize * ChunkSize;
+    static constexpr Int ChunkVoxels = ChunkRows * ChunkSize;
+    static constexpr UInt NullChunk = 0xFFFFFFFFu;
+
+    struct Chunk
+    {
+        UInt rowOffset;     // ChunkRows entries in rows
+        UInt runOffset;     // First word in runWords
+        UInt paletteOffset; // First entry in palettes
+        uint16_t paletteSize;
+        uint8_t bits;       // Per run value, 0 for uniform chunks
+        uint8_t uniform;    // Every voxel is palettes[paletteOffset]
+    };
+
+    class ChunkContext : public Context
+    {
+    public:
+        GridDDA coarse;
+        GridDDA fine;
+
+        Float t = 0.0f;
+        Float tExit = 0.0f;
+        Float fineT = 0.0f;
+        Float chunkExit = 0.0f;
+
+        UInt chunk = NullChunk;
+        bool inChunk = false;
+        bool started = false;
+    };
+
+    // Chunks encode in parallel on the pool
+    CompressedVoxelScene(const BrickMapScene& map, ThreadPool* pool = nullptr);
+    CompressedVoxelScene(const VoxelGridScene& grid, ThreadPool* pool = nullptr);
+
+    IVec3 Size() const { return size; }
+    IVec3 GridSize() const { return gridSize; }
+
+    UInt Get(IVec3 p) const;
+
+    // Only the chunks holding edited voxels are encoded again. A chunk is rewritten in place when
+    // it still fits, otherwise it moves to the end of the arrays & its old words become garbage.
+    void ApplyEdits(const Voxel* edits, size_t count);
+    size_t GarbageBytes() const { return garbageWords * sizeof(uint32_t); }
+    void Compact();
+
+    size_t NumChunks() const { return chunks.size() - freeChunks.size(); }
+    size_t SolidVoxels() const;
+    size_t MemoryUsage() const;
+    double BytesPerSolidVoxel() const;
+
+    // Static scene interface for RayTracing::TraceRay<>, NextIntersection forwards here
+    typedef ChunkContext RayContext;
+    bool Traverse(ChunkContext& c, Ray& r) const;
+
+    Context* LaunchRay(ContextArena& arena) override;
+    bool NextIntersection(Context* ctx, Ray& r) override;
+    HitAttributes GetHitAttributes(const Ray& r) const override;
+
+private:
+    friend class PagedVoxelScene;
+
+    IVec3 size;
+    IVec3 gridSize;
+
+    std::vector<UInt> grid; // Chunk index or NullChunk
+    std::vector<Chunk> chunks;
+    std::vector<UInt> palettes;
+    std::vector<uint32_t> rows; // First run of the row << 16 | run start mask
+    std::vector<uint32_t> runWords;
+
+    std::vector<UInt> freeChunks; // Chunk records of chunks edited away
+    size_t garbageWords = 0;
+
+    template <typename SourceFn>
+    void Build(IVec3 size, ThreadPool* pool, const SourceFn& source);
+
+    // Appends the chunk to the arrays, false if every voxel is empty. palette is scratch space.
+    static bool EncodeChunk(const UInt* voxels, std::vector<UInt>& palette, Chunk& c,
+        std::vector<UInt>& palettes, std::vector<uint32_t>& rows, std::vector<uint32_t>& runWords);
+
+    void DecodeChunk(UInt index, UInt* voxels) const;
+
+    static inline UInt RunWordCount(const Chunk& c, const uint32_t* chunkRows)
+    {
+        if (c.uniform) return 0;
+
+        uint32_t last = chunkRows[ChunkRows - 1];
+        UInt runs = (last >> 16) + PopCount(last & 0xFFFFu);
+        return (runs * c.bits + 31) / 32;
+    }
+
+    inline size_t GridIndex(IVec3 chunk) const
+    {
+        return (size_t(chunk.z) * size_t(gridSize.y) + size_t(chunk.y)) * size_t(gridSize.x) + size_t(chunk.x);
+    }
+
+    // Palette index of a voxel inside a chunk, 0 is empty
+    inline UInt PaletteIndex(const Chunk& c, IVec3 local) const
+    {
+        if (c.uniform) return 0;
+        return ChunkPaletteIndex(&rows[c.rowOffset], &runWords[c.runOffset], c.bits, local);
+    }
+
+    inline bool Solid(const Chunk& c, IVec3 local) const
+    {
+        return c.uniform || PaletteIndex(c, local) != 0;
+    }
+};
+
+inline bool CompressedVoxelScene::Traverse(ChunkContext& c, Ray& r) const
+{
+    if (!c.started)
+    {
+        c.started = true;
+
+        Float tEnter;
+        if (!IntersectBox(r, Vec3(0.0f), Vec3(size), tEnter, c.tExit))
+        {
+            c.t = MaxFloat;
+            return false;
+        }
+
+        c.t = tEnter;
+        c.coarse.Init(r, tEnter, Vec3(0.0f), Float(ChunkSize), gridSize);
+    }
+
+    Float tEnd = glm::min(c.tExit, r.MaxT);
+
+    for (;;)
+    {
+        // Fine DDA inside a stored chunk, queried straight from the runs
+        if (c.inChunk)
+        {
+            const Chunk& chunk = chunks[c.chunk];
+            Float chunkEnd = glm::min(c.chunkExit, tEnd);
+
+            while (c.fineT < chunkEnd && c.fine.Inside(IVec3(ChunkSize)))
+            {
+                IVec3 local = c.fine.cell;
+                Float tEnter = c.fineT;
+
+                c.fineT = c.fine.Step();
+
+                if (Solid(chunk, local))
+                {
+                    r.MinT = tEnter;
+                    r.MaxT = glm::min(c.fineT, chunkEnd);
+                    r.PrimitiveID = c.chunk * ChunkVoxels + UInt(local.x + local.y * ChunkSize + local.z * ChunkRows);
+                    return true;
+                }
+            }
+
+            c.inChunk = false;
+        }
+
+        // Coarse DDA skipping over empty chunks
+        while (c.t < tEnd && c.coarse.Inside(gridSize))
+        {
+            IVec3 cell = c.coarse.cell;
+            Float tEnter = c.t;
+
+            c.t = c.coarse.Step();
+
+            UInt index = grid[GridIndex(cell)];
+            if (index != NullChunk)
+            {
+                c.chunk = index;
+                c.chunkExit = c.t;
+                c.fineT = tEnter;
+                c.fine.Init(r, tEnter, Vec3(cell * ChunkSize), 1.0f, IVec3(ChunkSize));
+                c.inChunk = true;
+                break;
+            }
+        }
+
+        if (!c.inChunk) return false;
+    }
+}
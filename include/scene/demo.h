@@ -0,0 +1,21 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Demo Content
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <vector>
+
+#include "renderer.h"
+#include "gfx/mesh.h"
+#include "scene/brickmap.h"
+
+// Rolling hills to have something to look at, owned by the caller
+BrickMapScene* CreateDemoScene();
+
+// Materials of the demo voxels for the PathTracer, indexed by voxel material
+std::vector<Material> DemoMaterials();
+
+// Looking over the scene from above one corner
+Camera DefaultCamera(IVec3 sceneSize);
@@ -0,0 +1,174 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Sparse Voxel Octree
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "raytracing.h"
+#include "voxel.h"
+#include "voxelgrid.h"
+
+// Pointerless octree: children of a node are stored next to each other and addressed
+// through the first child index plus the number of lower set bits in the child mask.
+// Children of the nodes one level above the voxels index into the material array.
+class SparseVoxelOctree final : public Scene
+{
+public:
+    struct Node
+    {
+        UInt firstChild;
+        uint8_t childMask; // Bit i is octant (i & 1, (i >> 1) & 1, (i >> 2) & 1)
+        uint8_t padding[3];
+    };
+
+    static constexpr int StackSize = 64;
+
+    class OctreeContext : public Context
+    {
+    public:
+        struct Entry
+        {
+            UInt node; // Material index once size reaches 1
+            Int size;
+            IVec3 origin;
+            Float tEnter;
+            Float tExit;
+        };
+
+        Entry stack[StackSize];
+        int stackPtr = 0;
+        bool started = false;
+    };
+
+    // resolution is rounded up to a power of two, at least 2
+    SparseVoxelOctree(UInt resolution, const Voxel* voxels, size_t count);
+    SparseVoxelOctree(const VoxelGridScene& grid);
+
+    UInt Resolution() const { return resolution; }
+
+    UInt Get(IVec3 p) const;
+
+    // Child blocks that have to grow move to the end of nodes / materials, the old slots become
+    // garbage until Compact()
+    void ApplyEdits(const Voxel* edits, size_t count);
+    size_t GarbageBytes() const { return garbageNodes * sizeof(Node) + garbageMaterials * sizeof(UInt); }
+    void Compact();
+
+    size_t SolidVoxels() const { return materials.size() - garbageMaterials; }
+    size_t MemoryUsage() const;
+    double BytesPerSolidVoxel() const;
+
+    // Static scene interface for RayTracing::TraceRay<>, NextIntersection forwards here
+    typedef OctreeContext RayContext;
+    bool Traverse(OctreeContext& c, Ray& r) const;
+
+    Context* LaunchRay(ContextArena& arena) override;
+    bool NextIntersection(Context* ctx, Ray& r) override;
+    HitAttributes GetHitAttributes(const Ray& r) const override;
+
+private:
+    UInt resolution = 2;
+    UInt levels = 1;
+
+    std::vector<Node> nodes; // Root is node 0, stored level by level until edited
+    std::vector<UInt> materials;
+
+    size_t garbageNodes = 0;
+    size_t garbageMaterials = 0;
+
+    void Build(const Voxel* voxels, size_t count);
+
+    void Edit(IVec3 p, UInt material);
+    UInt InsertChild(UInt node, int octant, bool leaf);
+    void RemoveChild(UInt node, int octant, bool leaf);
+
+    static inline UInt ChildIndex(const Node& n, int octant)
+    {
+        return n.firstChild + PopCount(UInt(n.childMask) & ((1u << octant) - 1u));
+    }
+};
+
+inline bool SparseVoxelOctree::Traverse(OctreeContext& c, Ray& r) const
+{
+    if (!c.started)
+    {
+        c.started = true;
+
+        Float tEnter, tExit;
+        if (nodes[0].childMask && IntersectBox(r, Vec3(0.0f), Vec3(Float(resolution)), tEnter, tExit))
+            c.stack[c.stackPtr++] = { 0, Int(resolution), IVec3(0), tEnter, tExit };
+    }
+
+    while (c.stackPtr > 0)
+    {
+        OctreeContext::Entry e = c.stack[--c.stackPtr];
+
+        if (e.tEnter >= r.MaxT) continue;
+
+        if (e.size == 1)
+        {
+            r.MinT = e.tEnter;
+            r.MaxT = glm::min(e.tExit, r.MaxT);
+            r.PrimitiveID = e.node;
+            return true;
+        }
+
+        const Node& n = nodes[e.node];
+        Int half = e.size >> 1;
+
+        // Slab planes of the node, child octants pick the lower or upper half per axis
+        Vec3 tLo = (Vec3(e.origin) - r.Origin) * r.InvDirection;
+        Vec3 tMid = (Vec3(e.origin + IVec3(half)) - r.Origin) * r.InvDirection;
+        Vec3 tHi = (Vec3(e.origin + IVec3(e.size)) - r.Origin) * r.InvDirection;
+
+        OctreeContext::Entry children[8];
+        int numChildren = 0;
+
+        for (int octant = 0; octant < 8; octant++)
+        {
+            if (!(n.childMask & (1u << octant))) continue;
+
+            Vec3 t0, t1;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                bool upper = (octant >> axis) & 1;
+                t0[axis] = upper ? tMid[axis] : tLo[axis];
+                t1[axis] = upper ? tHi[axis] : tMid[axis];
+            }
+
+            Vec3 tNear = glm::min(t0, t1);
+            Vec3 tFar = glm::max(t0, t1);
+            Float tEnter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, e.tEnter));
+            Float tExit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, e.tExit));
+
+            if (tEnter >= tExit) continue;
+
+            // Insertion sort front to back, a ray crosses at most 4 octants
+            OctreeContext::Entry child = {
+                ChildIndex(n, octant),
+                half,
+                e.origin + IVec3(octant & 1, (octant >> 1) & 1, (octant >> 2) & 1) * half,
+                tEnter,
+                tExit
+            };
+
+            int i = numChildren++;
+            while (i > 0 && children[i - 1].tEnter > tEnter)
+            {
+                children[i] = children[i - 1];
+                i--;
+            }
+            children[i] = child;
+        }
+
+        // Nearest child ends up on top of the stack
+        for (int i = numChildren - 1; i >= 0; i--)
+            c.stack[c.stackPtr++] = children[i];
+    }
+
+    return false;
+}
@@ -0,0 +1,297 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Paged Voxel World
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "errors.h"
+#include "raytracing.h"
+#include "voxel.h"
+#include "compressed.h"
+
+// Out of core voxel world. Compressed 16^3 chunks live in a chunk file and are read on demand by
+// a background I/O thread into an LRU cache with a byte budget, only the chunk directory stays in
+// memory. The resident set only changes in Update(), which the owner calls between frames while no
+// ray is in flight, so traversal reads resident chunks without any locking.
+//
+// Traversal asks for every chunk it enters & the next PrefetchCells non-empty chunks along the ray,
+// looking at most PrefetchSteps grid cells ahead so rays over open air reach past it. A chunk
+// that is not resident is traced at its coarse LOD: an occupancy mask of 4^3 voxel blocks with the
+// most common material of the chunk, stored in the directory.
+class PagedVoxelScene final : public Scene
+{
+public:
+    static constexpr Int ChunkSize = CompressedVoxelScene::ChunkSize;
+    static constexpr Int ChunkRows = CompressedVoxelScene::ChunkRows;
+    static constexpr Int ChunkVoxels = CompressedVoxelScene::ChunkVoxels;
+    static constexpr Int LodSize = 4; // LOD blocks per chunk axis
+    static constexpr Int LodCell = ChunkSize / LodSize;
+    static constexpr Int PrefetchCells = 2;
+    static constexpr Int PrefetchSteps = 32;
+    static constexpr UInt LodHit = 0x80000000u; // PrimitiveID bit of hits against the LOD
+
+    static constexpr uint32_t FileVersion = 1;
+
+    struct DirectoryEntry
+    {
+        uint64_t offset;
+        uint32_t bytes;       // 0 for empty chunks
+        uint32_t lodMaterial;
+        uint64_t lodMask;     // Bit x + y * 4 + z * 16 set if the 4^3 block has a solid voxel
+    };
+
+    struct Stats
+    {
+        uint64_t lookups = 0;   // Chunks entered by rays
+        uint64_t misses = 0;    // ... that were not resident & fell back to the LOD
+        uint64_t loads = 0;
+        uint64_t evictions = 0;
+        uint64_t ioBytes = 0;   // Read from the chunk file
+        size_t residentChunks = 0;
+        size_t residentBytes = 0;
+
+        double HitRate() const { return lookups ? 1.0 - double(misses) / double(lookups) : 1.0; }
+    };
+
+    class PagedContext : public Context
+    {
+    public:
+        GridDDA coarse;
+        GridDDA fine;
+
+        Float t = 0.0f;
+        Float tExit = 0.0f;
+        Float fineT = 0.0f;
+        Float chunkExit = 0.0f;
+
+        UInt cell = 0; // Grid index of the current chunk
+        bool inChunk = false;
+        bool lod = false; // Tracing the current chunk at its LOD
+        bool started = false;
+    };
+
+    // Writes every chunk of the scene into a chunk file
+    static bool WriteChunkFile(const CompressedVoxelScene& scene, const std::string& path);
+
+    // Throws ErrorCode::ASSET_LOAD_FAILED if the chunk file can't be opened or its header &
+    // directory are damaged. Damaged chunks are never made resident & stay at their LOD.
+    PagedVoxelScene(const std::string& path, size_t byteBudget);
+    ~PagedVoxelScene();
+
+    IVec3 Size() const { return size; }
+    IVec3 GridSize() const { return gridSize; }
+
+    size_t ByteBudget() const { return byteBudget; }
+    void SetByteBudget(size_t bytes) { byteBudget = bytes; }
+
+    // Installs finished reads & evicts least recently used chunks down to the budget. Call between
+    // frames, never while rays are traced.
+    void Update();
+
+    // Blocks until every requested chunk has been read, then runs Update()
+    void Flush();
+
+    Stats GetStats() const;
+
+    // Static scene interface for RayTracing::TraceRay<>, NextIntersection forwards here
+    typedef PagedContext RayContext;
+    bool Traverse(PagedContext& c, Ray& r) const;
+
+    Context* LaunchRay(ContextArena& arena) override;
+    bool NextIntersection(Context* ctx, Ray& r) override;
+
+    // Valid until the next Update()
+    HitAttributes GetHitAttributes(const Ray& r) const override;
+
+private:
+    struct ResidentChunk
+    {
+        std::vector<uint32_t> data; // Palette, rows & run words
+        const UInt* palette;
+        const uint32_t* rows;
+        const uint32_t* runWords;
+        UInt bits;
+        bool uniform;
+
+        mutable std::atomic<uint32_t> lastUsed;
+    };
+
+    // Counters are spread over cache lines, traversal threads pick one each
+    struct alignas(64) CounterShard
+    {
+        std::atomic<uint64_t> lookups{ 0 };
+        std::atomic<uint64_t> misses{ 0 };
+    };
+
+    static constexpr int NumShards = 64;
+
+    IVec3 size;
+    IVec3 gridSize;
+    size_t byteBudget;
+
+    std::vector<DirectoryEntry> directory;
+    std::vector<ResidentChunk*> resident;                 // Per grid cell, only written in Update()
+    std::unique_ptr<std::atomic<uint8_t>[]> requested;    // Per grid cell, set once a read is queued
+    std::vector<UInt> residentCells;
+
+    uint32_t frame = 1;
+    size_t residentBytes = 0;
+    uint64_t loads = 0;
+    uint64_t evictions = 0;
+
+    mutable CounterShard shards[NumShards];
+
+    // Background reads
+    std::string path;
+    std::thread ioThread;
+    mutable std::mutex ioMutex;
+    mutable std::condition_variable ioWake;
+    std::condition_variable ioIdle;
+    mutable std::deque<UInt> pending;
+    std::vector<std::pair<UInt, ResidentChunk*>> completed;
+    bool reading = false;
+    bool stopping = false;
+    std::atomic<uint64_t> ioBytes{ 0 };
+
+    void IOLoop();
+    ResidentChunk* ReadChunk(std::ifstream& file, UInt cell);
+
+    // Whether a payload read from the file can be traced without reading out of bounds
+    static bool ValidPayload(const uint32_t* words, size_t count);
+
+    // Queues a read of a chunk that is neither resident nor requested yet
+    void Request(UInt cell) const;
+
+    static CounterShard& Shard(CounterShard* shards);
+
+    inline size_t GridIndex(IVec3 chunk) const
+    {
+        return (size_t(chunk.z) * size_t(gridSize.y) + size_t(chunk.y)) * size_t(gridSize.x) + size_t(chunk.x);
+    }
+
+    inline bool Solid(const ResidentChunk& c, IVec3 local) const
+    {
+        return c.uniform || ChunkPaletteIndex(c.rows, c.runWords, c.bits, local) != 0;
+    }
+
+    // Chunk entry bookkeeping, returns the resident chunk or nullptr
+    inline const ResidentChunk* Enter(UInt cell) const
+    {
+        CounterShard& s = Shard(shards);
+        s.lookups.fetch_add(1, std::memory_order_relaxed);
+
+        const ResidentChunk* c = resident[cell];
+        if (c)
+        {
+            if (c->lastUsed.load(std::memory_order_relaxed) != frame)
+                c->lastUsed.store(frame, std::memory_order_relaxed);
+            return c;
+        }
+
+        s.misses.fetch_add(1, std::memory_order_relaxed);
+        Request(cell);
+        return nullptr;
+    }
+};
+
+inline bool PagedVoxelScene::Traverse(PagedContext& c, Ray& r) const
+{
+    if (!c.started)
+    {
+        c.started = true;
+
+        Float tEnter;
+        if (!IntersectBox(r, Vec3(0.0f), Vec3(size), tEnter, c.tExit))
+        {
+            c.t = MaxFloat;
+            return false;
+        }
+
+        c.t = tEnter;
+        c.coarse.Init(r, tEnter, Vec3(0.0f), Float(ChunkSize), gridSize);
+    }
+
+    Float tEnd = glm::min(c.tExit, r.MaxT);
+
+    for (;;)
+    {
+        if (c.inChunk)
+        {
+            // Resident chunks or the LOD blocks, chunks stay put until the next Update()
+            const ResidentChunk* chunk = c.lod ? nullptr : resident[c.cell];
+            const DirectoryEntry& entry = directory[c.cell];
+
+            Float chunkEnd = glm::min(c.chunkExit, tEnd);
+            IVec3 cells = IVec3(c.lod ? LodSize : ChunkSize);
+
+            while (c.fineT < chunkEnd && c.fine.Inside(cells))
+            {
+                IVec3 local = c.fine.cell;
+                Float tEnter = c.fineT;
+
+                c.fineT = c.fine.Step();
+
+                bool solid = c.lod ? ((entry.lodMask >> (local.x + local.y * LodSize + local.z * LodSize * LodSize)) & 1) : Solid(*chunk, local);
+                if (solid)
+                {
+                    r.MinT = tEnter;
+                    r.MaxT = glm::min(c.fineT, chunkEnd);
+                    r.PrimitiveID = c.lod ? (c.cell | LodHit) : c.cell;
+                    return true;
+                }
+            }
+
+            c.inChunk = false;
+        }
+
+        while (c.t < tEnd && c.coarse.Inside(gridSize))
+        {
+            IVec3 cell = c.coarse.cell;
+            Float tEnter = c.t;
+
+            c.t = c.coarse.Step();
+
+            UInt index = UInt(GridIndex(cell));
+            if (!directory[index].bytes) continue;
+
+            // Ask for what the ray will cross next while this chunk is traced, skipping empty cells
+            GridDDA ahead = c.coarse;
+            Float tAhead = c.t;
+            for (int found = 0, steps = 0; found < PrefetchCells && steps < PrefetchSteps && tAhead < tEnd && ahead.Inside(gridSize); steps++)
+            {
+                UInt next = UInt(GridIndex(ahead.cell));
+                if (directory[next].bytes)
+                {
+                    found++;
+                    if (!resident[next]) Request(next);
+                }
+
+                tAhead = ahead.Step();
+            }
+
+            c.lod = !Enter(index);
+            c.cell = index;
+            c.chunkExit = c.t;
+            c.fineT = tEnter;
+
+            Float cellSize = c.lod ? Float(LodCell) : 1.0f;
+            c.fine.Init(r, tEnter, Vec3(cell * ChunkSize), cellSize, IVec3(c.lod ? LodSize : ChunkSize));
+            c.inChunk = true;
+            break;
+        }
+
+        if (!c.inChunk) return false;
+    }
+}
@@ -0,0 +1,155 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Voxel Common
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include "raytracing.h"
+
+// Voxel scenes live in voxel units: voxel (x, y, z) covers [x, x + 1) x [y, y + 1) x [z, z + 1)
+// A voxel stores a material id, 0 is reserved for empty space
+const UInt EmptyVoxel = 0;
+
+struct Voxel
+{
+    IVec3 position;
+    UInt material;
+};
+
+// Voxel scenes take edits as batches of Voxel applied in order (ApplyEdits), the last edit of a
+// voxel wins & edits outside the scene are ignored. Only the parts of the scene holding edited
+// voxels are updated.
+inline bool VoxelInside(IVec3 p, IVec3 size)
+{
+    return p.x >= 0 && p.y >= 0 && p.z >= 0 && p.x < size.x && p.y < size.y && p.z < size.z;
+}
+
+inline UInt PopCount(UInt v)
+{
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    return (((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+}
+
+// Interleave the lower 21 bits of each coordinate, x in the lowest bit
+inline uint64_t MortonEncode(IVec3 p)
+{
+    auto spread = [](uint64_t v)
+    {
+        v &= 0x1FFFFF;
+        v = (v | (v << 32)) & 0x001F00000000FFFFull;
+        v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+        v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+        v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+        v = (v | (v << 2)) & 0x1249249249249249ull;
+        return v;
+    };
+
+    return spread(uint64_t(p.x)) | (spread(uint64_t(p.y)) << 1) | (spread(uint64_t(p.z)) << 2);
+}
+
+// Slab test of the ray's [MinT, MaxT] against an axis aligned box
+inline bool IntersectBox(const Ray& r, Vec3 boxMin, Vec3 boxMax, Float& tEnter, Float& tExit)
+{
+    Vec3 t0 = (boxMin - r.Origin) * r.InvDirection;
+    Vec3 t1 = (boxMax - r.Origin) * r.InvDirection;
+    Vec3 tNear = glm::min(t0, t1);
+    Vec3 tFar = glm::max(t0, t1);
+
+    tEnter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, r.MinT));
+    tExit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, r.MaxT));
+
+    return tEnter < tExit;
+}
+
+// Normal of the voxel face a reported hit entered through.
+// The middle of [MinT, MaxT] is inside the voxel, the entry face is the one with the latest slab entry.
+inline Vec3 VoxelHitNormal(const Ray& r)
+{
+    Vec3 cell = glm::floor(r.Origin + r.Direction * ((r.MinT + r.MaxT) * 0.5f));
+    Vec3 t0 = (cell - r.Origin) * r.InvDirection;
+    Vec3 t1 = (cell + Vec3(1.0f) - r.Origin) * r.InvDirection;
+    Vec3 tNear = glm::min(t0, t1);
+
+    int axis = (tNear.x > tNear.y) ? (tNear.x > tNear.z ? 0 : 2) : (tNear.y > tNear.z ? 1 : 2);
+
+    Vec3 n(0.0f);
+    n[axis] = r.Direction[axis] > 0.0f ? -1.0f : 1.0f;
+    return n;
+}
+
+// Normal of the voxel face a reported hit leaves through, pointing out of the voxel
+inline Vec3 VoxelExitNormal(const Ray& r)
+{
+    Vec3 cell = glm::floor(r.Origin + r.Direction * ((r.MinT + r.MaxT) * 0.5f));
+    Vec3 t0 = (cell - r.Origin) * r.InvDirection;
+    Vec3 t1 = (cell + Vec3(1.0f) - r.Origin) * r.InvDirection;
+    Vec3 tFar = glm::max(t0, t1);
+
+    int axis = (tFar.x < tFar.y) ? (tFar.x < tFar.z ? 0 : 2) : (tFar.y < tFar.z ? 1 : 2);
+
+    Vec3 n(0.0f);
+    n[axis] = r.Direction[axis] > 0.0f ? 1.0f : -1.0f;
+    return n;
+}
+
+// Incremental grid traversal (Amanatides & Woo, "A Fast Voxel Traversal Algorithm")
+struct GridDDA
+{
+    IVec3 cell;
+    IVec3 step;
+    Vec3 tNext;  // t where the ray leaves the current cell along each axis
+    Vec3 tDelta; // t it takes to cross a whole cell along each axis
+
+    // Start traversing at ray parameter t, the grid starts at gridOrigin with cubic cells
+    inline void Init(const Ray& r, Float t, Vec3 gridOrigin, Float cellSize, IVec3 size)
+    {
+        Vec3 p = (r.Origin + r.Direction * t - gridOrigin) / cellSize;
+        cell = glm::clamp(IVec3(glm::floor(p)), IVec3(0), size - IVec3(1));
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (r.Direction[i] > 0.0f)
+            {
+                step[i] = 1;
+                tNext[i] = (gridOrigin[i] + Float(cell[i] + 1) * cellSize - r.Origin[i]) * r.InvDirection[i];
+                tDelta[i] = cellSize * r.InvDirection[i];
+            }
+            else if (r.Direction[i] < 0.0f)
+            {
+                step[i] = -1;
+                tNext[i] = (gridOrigin[i] + Float(cell[i]) * cellSize - r.Origin[i]) * r.InvDirection[i];
+                tDelta[i] = -cellSize * r.InvDirection[i];
+            }
+            else
+            {
+                step[i] = 0;
+                tNext[i] = MaxFloat;
+                tDelta[i] = MaxFloat;
+            }
+        }
+    }
+
+    inline Float CellExit() const
+    {
+        return glm::min(glm::min(tNext.x, tNext.y), tNext.z);
+    }
+
+    // Move to the neighbouring cell, returns the t at which the ray left the current one
+    inline Float Step()
+    {
+        int axis = (tNext.x < tNext.y) ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+
+        Float t = tNext[axis];
+        cell[axis] += step[axis];
+        tNext[axis] += tDelta[axis];
+
+        return t;
+    }
+
+    inline bool Inside(IVec3 size) const
+    {
+        return cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x < size.x && cell.y < size.y && cell.z < size.z;
+    }
+};
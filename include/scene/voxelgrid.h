@@ -0,0 +1,124 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Dense Voxel Grid
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <vector>
+
+#include "raytracing.h"
+#include "voxel.h"
+
+class VoxelGridScene final : public Scene
+{
+public:
+    class GridContext : public Context
+    {
+    public:
+        GridDDA dda;
+        Float t = 0.0f;     // Entry of the current cell
+        Float tExit = 0.0f; // Exit of the grid bounds
+        bool started = false;
+    };
+
+    // Lanes of a packet step through the grid in lock step, cells are kept as floats
+    class GridPacketContext : public Context
+    {
+    public:
+        alignas(64) Float cellX[16] = {};
+        alignas(64) Float cellY[16] = {};
+        alignas(64) Float cellZ[16] = {};
+        alignas(64) Float stepX[16] = {};
+        alignas(64) Float stepY[16] = {};
+        alignas(64) Float stepZ[16] = {};
+        alignas(64) Float tNextX[16] = {};
+        alignas(64) Float tNextY[16] = {};
+        alignas(64) Float tNextZ[16] = {};
+        alignas(64) Float tDeltaX[16] = {};
+        alignas(64) Float tDeltaY[16] = {};
+        alignas(64) Float tDeltaZ[16] = {};
+        alignas(64) Float t[16] = {};
+        alignas(64) Float tExit[16] = {};
+
+        LaneMask alive = 0;
+        bool started = false;
+    };
+
+    VoxelGridScene(IVec3 size);
+
+    IVec3 Size() const { return size; }
+
+    UInt Get(IVec3 p) const;
+    void Set(IVec3 p, UInt material);
+    void ApplyEdits(const Voxel* edits, size_t count);
+
+    size_t SolidVoxels() const;
+    size_t MemoryUsage() const;
+    double BytesPerSolidVoxel() const;
+
+    // Static scene interface for RayTracing::TraceRay<>, NextIntersection forwards here
+    typedef GridContext RayContext;
+    bool Traverse(GridContext& c, Ray& r) const;
+
+    Context* LaunchRay(ContextArena& arena) override;
+    bool NextIntersection(Context* ctx, Ray& r) override;
+    HitAttributes GetHitAttributes(const Ray& r) const override;
+
+    Context* LaunchRayPacket(ContextArena& arena, int width) override;
+    LaneMask NextIntersectionPacket(Context* ctx, RayPacket4& p, LaneMask active) override;
+    LaneMask NextIntersectionPacket(Context* ctx, RayPacket8& p, LaneMask active) override;
+    LaneMask NextIntersectionPacket(Context* ctx, RayPacket16& p, LaneMask active) override;
+
+private:
+    IVec3 size;
+    std::vector<UInt> voxels; // x major
+
+    inline size_t Index(IVec3 p) const
+    {
+        return (size_t(p.z) * size_t(size.y) + size_t(p.y)) * size_t(size.x) + size_t(p.x);
+    }
+
+    template <int N>
+    LaneMask TraversePacket(GridPacketContext* c, RayPacket<N>& p, LaneMask active);
+};
+
+inline bool VoxelGridScene::Traverse(GridContext& c, Ray& r) const
+{
+    if (!c.started)
+    {
+        c.started = true;
+
+        Float tEnter;
+        if (!IntersectBox(r, Vec3(0.0f), Vec3(size), tEnter, c.tExit))
+        {
+            c.t = MaxFloat;
+            return false;
+        }
+
+        c.t = tEnter;
+        c.dda.Init(r, tEnter, Vec3(0.0f), 1.0f, size);
+    }
+
+    Float tEnd = glm::min(c.tExit, r.MaxT);
+
+    while (c.t < tEnd && c.dda.Inside(size))
+    {
+        IVec3 cell = c.dda.cell;
+        Float tEnter = c.t;
+
+        // Advance first so the next call resumes behind this cell
+        c.t = c.dda.Step();
+
+        size_t index = Index(cell);
+        if (voxels[index] != EmptyVoxel)
+        {
+            r.MinT = tEnter;
+            r.MaxT = glm::min(c.t, tEnd);
+            r.PrimitiveID = UInt(index);
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,70 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Triangle Mesh Voxelizer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include "raytracing.h"
+#include "threadpool.h"
+#include "gfx/mesh.h"
+#include "scene/brickmap.h"
+
+// Conservative surface voxelization: every voxel the triangle touches is set, using the
+// triangle / box overlap test of Schwarz & Seidel ("Fast Parallel Surface and Solid Voxelization
+// on GPUs"). Triangles are binned into tiles of whole bricks & each tile is voxelized on its own,
+// so tiles run in parallel without sharing any writes.
+class Voxelizer
+{
+public:
+    static constexpr Int TileSize = 64; // Voxels, a multiple of BrickMapScene::BrickSize
+
+    struct Result
+    {
+        BrickMapScene* scene;
+
+        // World position p lands in voxel floor((p - origin) * scale)
+        Vec3 origin;
+        Float scale;
+
+        size_t triangles;
+        size_t tiles;   // Tiles that had triangles
+        double seconds; // Wall clock
+    };
+
+    // resolution voxels along the longest axis of the meshes' bounds. Voxel materials are
+    // Vertex::materialId + 1 of the first vertex, as 0 is EmptyVoxel. Where triangles share a
+    // voxel the one that comes first in the meshes wins. The scene is owned by the caller.
+    static Result Voxelize(const Mesh* meshes, size_t numMeshes, Int resolution, ThreadPool* pool = nullptr);
+
+private:
+    // Triangle in voxel units
+    struct SourceTriangle
+    {
+        Vec3 v[3];
+        UInt material;
+    };
+
+    // Overlap test of one triangle, set up per tile so only SourceTriangle is kept for all of them
+    struct Triangle
+    {
+        Vec3 n;
+        Float d1, d2; // Plane offsets of the two critical box corners
+
+        // Edge normals & offsets of the xy, yz & zx projections
+        Vec2 ne[3][3];
+        Float de[3][3];
+
+        Float plane;  // n . v0
+        int dominant; // Axis of the largest normal component, the triangle is swept along it
+
+        IVec3 boundsMin;
+        IVec3 boundsMax;
+        UInt material;
+    };
+
+    static bool Setup(const SourceTriangle& s, IVec3 size, Triangle& t);
+    static bool Overlaps(const Triangle& t, IVec3 voxel);
+
+    static void VoxelizeTile(const Triangle& t, IVec3 tileMin, UInt* tile);
+};
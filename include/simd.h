@@ -0,0 +1,184 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - SIMD Lanes
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Instruction sets are picked at compile time (see TRACER_NATIVE_ARCH in CMakeLists.txt),
+// widths without a native implementation fall back to plain loops.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRACER_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define TRACER_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX512F__)
+#define TRACER_SIMD_AVX512
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Bit i is lane i
+typedef uint32_t LaneMask;
+
+template <int N>
+constexpr LaneMask AllLanes()
+{
+    return (N >= 32) ? ~LaneMask(0) : ((LaneMask(1) << N) - 1);
+}
+
+inline int LowestLane(LaneMask m)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, m);
+    return int(index);
+#else
+    return __builtin_ctz(m);
+#endif
+}
+
+inline const char* SimdInstructionSet()
+{
+#if defined(TRACER_SIMD_AVX512)
+    return "AVX-512";
+#elif defined(TRACER_SIMD_AVX2)
+    return "AVX2";
+#elif defined(TRACER_SIMD_SSE)
+    return "SSE2";
+#else
+    return "Scalar";
+#endif
+}
+
+template <int N>
+struct SimdFloat
+{
+    float v[N];
+
+    static inline SimdFloat Load(const float* p) { SimdFloat r; for (int i = 0; i < N; i++) r.v[i] = p[i]; return r; }
+    static inline SimdFloat Set1(float f) { SimdFloat r; for (int i = 0; i < N; i++) r.v[i] = f; return r; }
+    inline void Store(float* p) const { for (int i = 0; i < N; i++) p[i] = v[i]; }
+
+    // N unsigned bytes widened to floats
+    static inline SimdFloat LoadBytes(const uint8_t* p) { SimdFloat r; for (int i = 0; i < N; i++) r.v[i] = float(p[i]); return r; }
+
+    friend inline SimdFloat operator+(SimdFloat a, SimdFloat b) { for (int i = 0; i < N; i++) a.v[i] += b.v[i]; return a; }
+    friend inline SimdFloat operator-(SimdFloat a, SimdFloat b) { for (int i = 0; i < N; i++) a.v[i] -= b.v[i]; return a; }
+    friend inline SimdFloat operator*(SimdFloat a, SimdFloat b) { for (int i = 0; i < N; i++) a.v[i] *= b.v[i]; return a; }
+
+    friend inline SimdFloat Min(SimdFloat a, SimdFloat b) { for (int i = 0; i < N; i++) a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i]; return a; }
+    friend inline SimdFloat Max(SimdFloat a, SimdFloat b) { for (int i = 0; i < N; i++) a.v[i] = a.v[i] < b.v[i] ? b.v[i] : a.v[i]; return a; }
+
+    friend inline LaneMask Less(SimdFloat a, SimdFloat b) { LaneMask m = 0; for (int i = 0; i < N; i++) m |= LaneMask(a.v[i] < b.v[i]) << i; return m; }
+    friend inline LaneMask LessEqual(SimdFloat a, SimdFloat b) { LaneMask m = 0; for (int i = 0; i < N; i++) m |= LaneMask(a.v[i] <= b.v[i]) << i; return m; }
+
+    // m ? a : b per lane
+    friend inline SimdFloat Select(LaneMask m, SimdFloat a, SimdFloat b) { for (int i = 0; i < N; i++) a.v[i] = ((m >> i) & 1) ? a.v[i] : b.v[i]; return a; }
+};
+
+#ifdef TRACER_SIMD_SSE
+template <>
+struct SimdFloat<4>
+{
+    __m128 v;
+
+    static inline SimdFloat Load(const float* p) { return { _mm_loadu_ps(p) }; }
+    static inline SimdFloat Set1(float f) { return { _mm_set1_ps(f) }; }
+    inline void Store(float* p) const { _mm_storeu_ps(p, v); }
+
+    static inline SimdFloat LoadBytes(const uint8_t* p)
+    {
+        int32_t bytes;
+        std::memcpy(&bytes, p, sizeof(bytes));
+        __m128i zero = _mm_setzero_si128();
+        return { _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero)) };
+    }
+
+    friend inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return { _mm_add_ps(a.v, b.v) }; }
+    friend inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return { _mm_sub_ps(a.v, b.v) }; }
+    friend inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return { _mm_mul_ps(a.v, b.v) }; }
+
+    // Operand order keeps the (b < a ? b : a) semantic of the scalar path for NaNs
+    friend inline SimdFloat Min(SimdFloat a, SimdFloat b) { return { _mm_min_ps(b.v, a.v) }; }
+    friend inline SimdFloat Max(SimdFloat a, SimdFloat b) { return { _mm_max_ps(b.v, a.v) }; }
+
+    friend inline LaneMask Less(SimdFloat a, SimdFloat b) { return LaneMask(_mm_movemask_ps(_mm_cmplt_ps(a.v, b.v))); }
+    friend inline LaneMask LessEqual(SimdFloat a, SimdFloat b) { return LaneMask(_mm_movemask_ps(_mm_cmple_ps(a.v, b.v))); }
+
+    friend inline SimdFloat Select(LaneMask m, SimdFloat a, SimdFloat b)
+    {
+        __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+        __m128 mask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(m)), bits), bits));
+        return { _mm_or_ps(_mm_and_ps(mask, a.v), _mm_andnot_ps(mask, b.v)) };
+    }
+};
+#endif
+
+#ifdef TRACER_SIMD_AVX2
+template <>
+struct SimdFloat<8>
+{
+    __m256 v;
+
+    static inline SimdFloat Load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    static inline SimdFloat Set1(float f) { return { _mm256_set1_ps(f) }; }
+    inline void Store(float* p) const { _mm256_storeu_ps(p, v); }
+
+    static inline SimdFloat LoadBytes(const uint8_t* p) { return { _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)))) }; }
+
+    friend inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+    friend inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    friend inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+
+    friend inline SimdFloat Min(SimdFloat a, SimdFloat b) { return { _mm256_min_ps(b.v, a.v) }; }
+    friend inline SimdFloat Max(SimdFloat a, SimdFloat b) { return { _mm256_max_ps(b.v, a.v) }; }
+
+    friend inline LaneMask Less(SimdFloat a, SimdFloat b) { return LaneMask(_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ))); }
+    friend inline LaneMask LessEqual(SimdFloat a, SimdFloat b) { return LaneMask(_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ))); }
+
+    friend inline SimdFloat Select(LaneMask m, SimdFloat a, SimdFloat b)
+    {
+        __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        __m256 mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(m)), bits), bits));
+        return { _mm256_blendv_ps(b.v, a.v, mask) };
+    }
+};
+#endif
+
+#ifdef TRACER_SIMD_AVX512
+template <>
+struct SimdFloat<16>
+{
+    __m512 v;
+
+    static inline SimdFloat Load(const float* p) { return { _mm512_loadu_ps(p) }; }
+    static inline SimdFloat Set1(float f) { return { _mm512_set1_ps(f) }; }
+    inline void Store(float* p) const { _mm512_storeu_ps(p, v); }
+
+    static inline SimdFloat LoadBytes(const uint8_t* p) { return { _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))) }; }
+
+    friend inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return { _mm512_add_ps(a.v, b.v) }; }
+    friend inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return { _mm512_sub_ps(a.v, b.v) }; }
+    friend inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return { _mm512_mul_ps(a.v, b.v) }; }
+
+    friend inline SimdFloat Min(SimdFloat a, SimdFloat b) { return { _mm512_min_ps(b.v, a.v) }; }
+    friend inline SimdFloat Max(SimdFloat a, SimdFloat b) { return { _mm512_max_ps(b.v, a.v) }; }
+
+    friend inline LaneMask Less(SimdFloat a, SimdFloat b) { return LaneMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)); }
+    friend inline LaneMask LessEqual(SimdFloat a, SimdFloat b) { return LaneMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ)); }
+
+    friend inline SimdFloat Select(LaneMask m, SimdFloat a, SimdFloat b) { return { _mm512_mask_blend_ps(__mmask16(m), b.v, a.v) }; }
+};
+#endif
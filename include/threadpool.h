@@ -0,0 +1,97 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Work Stealing Thread Pool
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Every thread owns a deque: it pushes & pops its own work at the back (LIFO, cache warm)
+// while idle threads steal from the front of others (FIFO, the biggest chunks).
+// The thread calling into the pool takes part through the last slot.
+class ThreadPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // Fork-join scope, Wait() runs pending work instead of blocking
+    class TaskGroup
+    {
+    public:
+        TaskGroup(ThreadPool& pool);
+        ~TaskGroup();
+
+        void Run(Task task);
+        void Wait();
+
+    private:
+        ThreadPool& pool;
+        std::atomic<size_t> pending{ 0 };
+    };
+
+    struct ThreadStats
+    {
+        double busySeconds;
+        uint64_t tasks;
+        uint64_t steals;
+    };
+
+    // numWorkers = 0 uses one worker per hardware thread besides the caller
+    ThreadPool(size_t numWorkers = 0);
+    ~ThreadPool();
+
+    // Workers plus the calling thread
+    size_t NumThreads() const { return numThreads; }
+
+    // Runs fn(i) for every i in [0, count), ranges are split recursively so thieves take big halves
+    void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    // Slot of the calling thread in the pool it currently works for, NumThreads() - 1 outside of workers
+    int ThreadIndex() const;
+
+    std::vector<ThreadStats> GetStats() const;
+    void ResetStats();
+
+private:
+    struct Job
+    {
+        Task task;
+        std::atomic<size_t>* pending;
+    };
+
+    struct alignas(64) Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    struct alignas(64) Counters
+    {
+        std::atomic<uint64_t> busyNanoseconds{ 0 };
+        std::atomic<uint64_t> tasks{ 0 };
+        std::atomic<uint64_t> steals{ 0 };
+    };
+
+    size_t numThreads;
+    std::vector<std::thread> workers;
+    std::unique_ptr<Queue[]> queues;
+    std::unique_ptr<Counters[]> counters;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{ 0 };
+    bool shutdown = false;
+
+    void Push(Job job);
+    bool TryRunOne(int self);
+    void WorkerLoop(int index);
+};
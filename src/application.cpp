@@ -5,8 +5,10 @@
 
 #include <glm/glm.hpp>
 
-#define ERROR_MSGS_IMPL
+#include <algorithm>
+
 #include "application.h"
+#include "scene/demo.h"
 
 using namespace glm;
 
@@ -15,12 +17,6 @@ void error_callback(int error, const char* description)
     std::cerr << "[GLFW] Error: " << description << std::endl;
 }
 
-std::ostream& operator<<(std::ostream& os, const ErrorCode& e)
-{
-    os << "Error code = " << int(e) << ", " << ErrorCodeDesc[int(e)];
-    return os;
-}
-
 std::string vertexShader = R"V0G0N(
 
 #version 450 core
@@ -31,7 +27,7 @@ out vec2 texcoord;
 
 void main()
 {
-    texcoord = position.st;
+    texcoord = position.st * 0.5 + 0.5;
     gl_Position = vec4(position, 1.0);
 }
 
@@ -60,20 +56,25 @@ void main()
 )V0G0N";
 
 vec3 vertices[] = {
-    vec3(-0.5, -0.5, 0.0),
-    vec3( 0.5, -0.5, 0.0),
-    vec3( 0.5,  0.5, 0.0),
-    vec3(-0.5,  0.5, 0.0)
+    vec3(-1.0, -1.0, 0.0),
+    vec3( 1.0, -1.0, 0.0),
+    vec3( 1.0,  1.0, 0.0),
+    vec3(-1.0,  1.0, 0.0)
 };
 
-uint16_t indices[] = {
+const int RenderWidth = 640;
+const int RenderHeight = 360;
+
+uint32_t indices[] = {
     0, 1, 2,
     3, 0, 2
 };
 
 VoxelTracer::VoxelTracer()
-    : pipeline(PipelineType::Raster)
+    : renderer(&threadPool, RenderWidth, RenderHeight), pathTracer(&threadPool, RenderWidth, RenderHeight), pipeline(PipelineType::Raster)
 {
+    Profiler::SetThreadName("Main");
+
     // Initialize GLFW & OpenGL Context
     {
         glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -122,31 +123,22 @@ VoxelTracer::VoxelTracer()
         timers[i] = new GPUTimer();
     }
 
+    gpuProfiler = new GPUProfiler();
+
     // Test content
     pipeline.LoadFragmentShader(fragmentShader);
     pipeline.LoadVertexShader(vertexShader);
     pipeline.compile();
 
     vertexBuffer = new Buffer();
-    vertexBuffer->UploadData(vertices, sizeof(vertices));
+    vertexBuffer->UploadData(vertices, sizeof(vertices) / sizeof(vertices[0]));
 
     indexArray = new Buffer();
-    indexArray->UploadData(indices, sizeof(indices));
+    indexArray->UploadData(indices, sizeof(indices) / sizeof(indices[0]));
 
     sampler = new Samplers();
 
-    vec4 image[50][50];
-    for (int i = 0; i < 50; i++)
-    {
-        for (int j = 0; j < 50; j++)
-        {
-            int fun = i ^ j;
-            image[i][j] = vec4((fun % 3 == 0) ? 0.0 : 1.0, (fun % 3 == 1) ? 0.0 : 1.0, (fun % 3 == 2) ? 0.0 : 1.0, 1.0);
-        }
-    }
-
-    texture = new Texture(BufferFormat::RGBA32F, 50, 50, 1);
-    texture->UploadImage(Texture::ImageFormat::RGBA, DataType::Float, 0, 0, 0, 50, 50, image);
+    texture = new Texture(BufferFormat::RGBA32F, RenderWidth, RenderHeight, 1);
 
     sampler = new Samplers();
 
@@ -156,6 +148,12 @@ VoxelTracer::VoxelTracer()
     vertexArray.BuildArray();
 
     constants = new Buffer(sizeof(ShaderConstants));
+
+    // CPU ray tracing
+    scene = CreateDemoScene();
+    pathTracer.materials = DemoMaterials();
+
+    camera = DefaultCamera(scene->Size());
 }
 
 VoxelTracer::~VoxelTracer()
@@ -164,6 +162,15 @@ VoxelTracer::~VoxelTracer()
     delete vertexBuffer;
     // End test content
 
+    delete scene;
+
+    // Queries go while the context is still alive
+    for (int i = 0; i < GPUTime::Count; i++)
+    {
+        delete timers[i];
+    }
+    delete gpuProfiler;
+
     ImGui::DestroyPlatformWindows();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -175,23 +182,40 @@ VoxelTracer::~VoxelTracer()
 
 void VoxelTracer::RenderScene()
 {
-    // Test content
+    PROFILE_FUNCTION();
+
+    if (pathTracing)
+        pathTracer.Render(*scene, camera, scene->Version());
+    else if (progressive)
+        renderer.RenderProgressive(*scene, camera, scene->Version());
+    else
+        renderer.Render(*scene, camera);
+
+    {
+        PROFILE_ZONE("Upload");
+        GPUScope gpuScope(*gpuProfiler, "Upload");
+        texture->UploadImage(Texture::ImageFormat::RGBA, DataType::Float, 0, 0, 0, RenderWidth, RenderHeight, pathTracing ? pathTracer.Framebuffer() : renderer.Framebuffer());
+    }
+
+    GPUScope gpuScope(*gpuProfiler, "Blit");
     pipeline.ScopedExec([&](Pipeline& p)
         {
             ShaderConstants* consts = constants->Map<ShaderConstants>(BufferAccess::WriteOnly);
-            consts->color = vec4(1.0, 0.0, 1.0, 1.0);
+            consts->color = vec4(1.0, 1.0, 1.0, 1.0);
             constants->Unmap();
 
             vertexArray.UseVertexArray();
             p.BindTexture(0, texture);
             p.BindSamplers(0, sampler);
             p.BindConstants(1, 0, sizeof(ShaderConstants), constants);
-            p.DrawIndexed(PrimitiveType::Triangles, DataType::Uint16, 6, 0, 0, 1, 0);
+            p.DrawIndexed(PrimitiveType::Triangles, DataType::Uint32, 6, 0, 0, 1, 0);
         });
 }
 
 void VoxelTracer::RenderUI()
 {
+    PROFILE_FUNCTION();
+
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -241,12 +265,128 @@ void VoxelTracer::RenderUI()
         ImGui::Text("3D: %fms", frameTimes[GPU3D]);
         ImGui::Text("2D: %fms", frameTimes[GPU2D]);
 
+        for (const GPUProfiler::Scope& s : gpuProfiler->Results())
+        {
+            ImGui::Text("%*s%s: %fms", s.depth * 2, "", s.name, s.ms);
+        }
+
+        ImGui::Separator();
+
+        const Renderer::Stats& stats = renderer.GetStats();
+        ImGui::Text("CPU Trace: %fms, %.1f Mrays/s", stats.frameMs, stats.megaRaysPerSecond);
+
+        ImGui::Checkbox("Progressive", &progressive);
+        if (progressive)
+        {
+            ImGui::SliderFloat("Error", &renderer.progressive.threshold, 0.0005f, 0.05f, "%.4f");
+            ImGui::Text("%s, %d active tiles, %d samples max", stats.converged ? "Converged" : "Accumulating", int(stats.activeTiles), int(stats.maxSamples));
+        }
+
+        ImGui::Checkbox("Path Tracing", &pathTracing);
+        if (pathTracing)
+        {
+            const PathTracer::Stats& pt = pathTracer.GetStats();
+            ImGui::Text("Path Trace: %fms, %.1f Mrays/s, %d samples, %d waves", pt.frameMs, pt.megaRaysPerSecond, int(pt.samples), int(pt.waves));
+        }
+        ImGui::Text("SIMD: %s, %d threads", SimdInstructionSet(), int(threadPool.NumThreads()));
+
+        for (size_t i = 0; i < stats.threadUtilization.size(); i++)
+        {
+            ImGui::Text("Thread %d: %.0f%%, %d steals", int(i), stats.threadUtilization[i] * 100.0, int(stats.threadSteals[i]));
+        }
+
         ImGui::End();
     }
 
+    ProfilerUI();
+
     ImGui::Render();
 }
 
+// Stable color per zone name
+static ImU32 ZoneColor(const char* name)
+{
+    uint32_t h = 2166136261u;
+    for (const char* c = name; *c; c++)
+        h = (h ^ uint8_t(*c)) * 16777619u;
+
+    return ImColor::HSV(float(h % 360) / 360.0f, 0.45f, 0.95f);
+}
+
+void VoxelTracer::ProfilerUI()
+{
+    if (!ImGui::Begin("Profiler"))
+    {
+        ImGui::End();
+        return;
+    }
+
+    bool recording = Profiler::Enabled();
+    if (ImGui::Checkbox("Record", &recording))
+        Profiler::SetEnabled(recording);
+
+    ImGui::SameLine();
+    ImGui::Checkbox("Pause", &profilerPaused);
+
+    ImGui::SameLine();
+    if (ImGui::Button("Save Trace"))
+        traceMessage = Profiler::WriteChromeTrace("trace.json") ? "Saved trace.json" : "Failed to write trace.json";
+
+    if (!traceMessage.empty())
+    {
+        ImGui::SameLine();
+        ImGui::TextUnformatted(traceMessage.c_str());
+    }
+
+    if (!profilerPaused && Profiler::LastFrame(profiledFrameStart, profiledFrameEnd))
+        profiledFrame = Profiler::Collect(profiledFrameStart, profiledFrameEnd);
+
+    if (profiledFrameEnd <= profiledFrameStart)
+    {
+        ImGui::End();
+        return;
+    }
+
+    ImGui::Text("Frame: %.3fms", double(profiledFrameEnd - profiledFrameStart) * 1e-6);
+    ImGui::Separator();
+
+    // One lane per thread, nested zones stack downwards, the width spans the frame
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+    float width = glm::max(ImGui::GetContentRegionAvail().x, 1.0f);
+    double scale = double(width) / double(profiledFrameEnd - profiledFrameStart);
+
+    for (const Profiler::ThreadEvents& t : profiledFrame)
+    {
+        uint32_t rows = 1;
+        for (const Profiler::Event& e : t.events)
+            rows = glm::max(rows, e.depth + 1);
+
+        ImGui::TextUnformatted(t.name.c_str());
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        ImGui::Dummy(ImVec2(width, float(rows) * rowHeight));
+
+        for (const Profiler::Event& e : t.events)
+        {
+            uint64_t start = std::max(e.start, profiledFrameStart) - profiledFrameStart;
+            uint64_t end = std::min(e.end, profiledFrameEnd) - profiledFrameStart;
+
+            ImVec2 lo(origin.x + float(double(start) * scale), origin.y + float(e.depth) * rowHeight);
+            ImVec2 hi(glm::max(origin.x + float(double(end) * scale), lo.x + 1.0f), lo.y + rowHeight - 1.0f);
+
+            drawList->AddRectFilled(lo, hi, ZoneColor(e.name));
+
+            if (hi.x - lo.x > ImGui::CalcTextSize(e.name).x + 4.0f)
+                drawList->AddText(ImVec2(lo.x + 2.0f, lo.y + 2.0f), IM_COL32(0, 0, 0, 255), e.name);
+
+            if (ImGui::IsMouseHoveringRect(lo, hi))
+                ImGui::SetTooltip("%s: %.3fms", e.name, double(e.end - e.start) * 1e-6);
+        }
+    }
+
+    ImGui::End();
+}
+
 void VoxelTracer::Update()
 {
 }
@@ -257,6 +397,8 @@ void VoxelTracer::run()
 
     while (!glfwWindowShouldClose(m_context.window))
     {
+        Profiler::BeginFrame();
+
         double currentTime = glfwGetTime();
         framesPerSecond = framesPerSecond * 0.9 + 1.0 / (currentTime - previousTime) * 0.1;
         previousTime = currentTime;
@@ -274,14 +416,25 @@ void VoxelTracer::run()
 
         RenderUI();
 
+        gpuProfiler->BeginFrame();
+
         timers[GPU3D]->Start();
-        RenderScene();
+        {
+            GPUScope gpuScope(*gpuProfiler, "Scene");
+            RenderScene();
+        }
         timers[GPU3D]->End();
 
         timers[GPU2D]->Start();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            PROFILE_ZONE("DrawUI");
+            GPUScope gpuScope(*gpuProfiler, "UI");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
         timers[GPU2D]->End();
 
+        gpuProfiler->EndFrame();
+
         frameTimes[GPU3D] = timers[GPU3D]->getTimeSpent();
         frameTimes[GPU2D] = timers[GPU2D]->getTimeSpent();
 
@@ -290,7 +443,10 @@ void VoxelTracer::run()
         ImGui::RenderPlatformWindowsDefault();
         glfwMakeContextCurrent(backup_current_context);
 
-        glfwSwapBuffers(m_context.window);
+        {
+            PROFILE_ZONE("SwapBuffers");
+            glfwSwapBuffers(m_context.window);
+        }
     }
 
 }
\ No newline at end of file
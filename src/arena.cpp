@@ -0,0 +1,21 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Context Arena
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "arena.h"
+
+void ContextArena::NextBlock()
+{
+    // Before the first allocation block 0 does not exist yet
+    if (block < blocks.size()) block++;
+
+    if (block == blocks.size())
+        blocks.emplace_back(new Block());
+}
+
+ContextArena& ContextArena::ForThread()
+{
+    thread_local ContextArena arena;
+    return arena;
+}
@@ -0,0 +1,16 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Errors
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include <iostream>
+#include <string>
+
+#define ERROR_MSGS_IMPL
+#include "errors.h"
+
+std::ostream& operator<<(std::ostream& os, const ErrorCode& e)
+{
+    os << "Error code = " << int(e) << ", " << ErrorCodeDesc[int(e)];
+    return os;
+}
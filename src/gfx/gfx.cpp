@@ -5,32 +5,159 @@
 
 #include "gfx/gfx.h"
 
+static bool QueryAvailable(GLuint query)
+{
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    return available != 0;
+}
+
+static double QueryMs(GLuint start, GLuint end)
+{
+    GLuint64 startTime = 0, stopTime = 0;
+    glGetQueryObjectui64v(start, GL_QUERY_RESULT, &startTime);
+    glGetQueryObjectui64v(end, GL_QUERY_RESULT, &stopTime);
+
+    return double(stopTime - startTime) / 1000000.0;
+}
+
 GPUTimer::GPUTimer()
 {
-    glGenQueries(2, queryID);
+    for (Slot& s : slots)
+        glGenQueries(2, s.queries);
+}
+
+GPUTimer::~GPUTimer()
+{
+    for (Slot& s : slots)
+        glDeleteQueries(2, s.queries);
 }
 
 void GPUTimer::Start()
 {
-    glQueryCounter(queryID[0], GL_TIMESTAMP);
+    getTimeSpent();
+
+    // The GPU is Latency measurements behind, skip this one rather than wait
+    recording = !slots[next].pending;
+    if (recording)
+        glQueryCounter(slots[next].queries[0], GL_TIMESTAMP);
 }
 
 void GPUTimer::End()
 {
-    glQueryCounter(queryID[1], GL_TIMESTAMP);
+    if (!recording) return;
+
+    glQueryCounter(slots[next].queries[1], GL_TIMESTAMP);
+    slots[next].pending = true;
+    next = (next + 1) % Latency;
+    recording = false;
 }
 
 double GPUTimer::getTimeSpent()
 {
-    GLint stopTimerAvailable = 0;
-    while (!stopTimerAvailable) {
-        glGetQueryObjectiv(queryID[1],
-            GL_QUERY_RESULT_AVAILABLE,
-            &stopTimerAvailable);
+    // Results arrive in submission order, stop at the first one still in flight
+    while (slots[oldest].pending && QueryAvailable(slots[oldest].queries[1]))
+    {
+        lastTime = QueryMs(slots[oldest].queries[0], slots[oldest].queries[1]);
+        slots[oldest].pending = false;
+        oldest = (oldest + 1) % Latency;
     }
 
-    glGetQueryObjectui64v(queryID[0], GL_QUERY_RESULT, &startTime);
-    glGetQueryObjectui64v(queryID[1], GL_QUERY_RESULT, &stopTime);
+    return lastTime;
+}
 
-    return double(stopTime - startTime) / 1000000.0;
-}
\ No newline at end of file
+GPUProfiler::GPUProfiler()
+{
+}
+
+GPUProfiler::~GPUProfiler()
+{
+    for (Frame& f : frames)
+    {
+        if (!f.queries.empty())
+            glDeleteQueries(GLsizei(f.queries.size()), f.queries.data());
+    }
+}
+
+void GPUProfiler::Resolve()
+{
+    // Oldest frame first (the slot about to be reused), frames finish in order
+    for (int i = 0; i < Latency; i++)
+    {
+        Frame& f = frames[(current + i) % Latency];
+        if (!f.pending) continue;
+
+        if (f.lastQuery && !QueryAvailable(f.lastQuery)) return;
+
+        for (size_t s = 0; s < f.scopes.size(); s++)
+            f.scopes[s].ms = QueryMs(f.queries[s * 2], f.queries[s * 2 + 1]);
+
+        results = f.scopes;
+        f.pending = false;
+    }
+}
+
+void GPUProfiler::BeginFrame()
+{
+    Resolve();
+
+    Frame& f = frames[current];
+    recording = !f.pending;
+    if (recording)
+    {
+        f.scopes.clear();
+        f.lastQuery = 0;
+    }
+
+    open.clear();
+}
+
+void GPUProfiler::EndFrame()
+{
+    // Scopes left open end with the frame
+    while (!open.empty())
+        Pop();
+
+    if (recording)
+    {
+        frames[current].pending = true;
+        current = (current + 1) % Latency;
+    }
+
+    recording = false;
+}
+
+void GPUProfiler::Push(const char* name)
+{
+    Frame& f = frames[current];
+    open.push_back(f.scopes.size());
+
+    if (!recording) return;
+
+    size_t index = f.scopes.size();
+    if (f.queries.size() < index * 2 + 2)
+    {
+        size_t first = f.queries.size();
+        f.queries.resize(index * 2 + 2);
+        glGenQueries(GLsizei(f.queries.size() - first), f.queries.data() + first);
+    }
+
+    f.scopes.push_back({ name, int(open.size()) - 1, 0.0 });
+    f.lastQuery = f.queries[index * 2];
+    glQueryCounter(f.lastQuery, GL_TIMESTAMP);
+}
+
+void GPUProfiler::Pop()
+{
+    if (open.empty()) return;
+
+    size_t index = open.back();
+    open.pop_back();
+
+    if (recording)
+    {
+        Frame& f = frames[current];
+        f.lastQuery = f.queries[index * 2 + 1];
+        glQueryCounter(f.lastQuery, GL_TIMESTAMP);
+    }
+}
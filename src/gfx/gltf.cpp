@@ -10,4 +10,467 @@
 
 #include "tiny_gltf.h"
 
-using namespace tinygltf;
\ No newline at end of file
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include "gfx/gltf.h"
+#include "profiler.h"
+
+using namespace tinygltf;
+
+typedef std::chrono::steady_clock Clock;
+
+static double SecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Encoded images are only collected while parsing & decoded in parallel afterwards
+struct PendingImages
+{
+    std::vector<std::vector<unsigned char>> encoded;
+};
+
+static bool CollectImage(Image* image, const int imageIndex, std::string* err, std::string* warn, int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData)
+{
+    PendingImages* pending = static_cast<PendingImages*>(userData);
+
+    if (size_t(imageIndex) >= pending->encoded.size())
+        pending->encoded.resize(imageIndex + 1);
+
+    pending->encoded[imageIndex].assign(bytes, bytes + size);
+    return true;
+}
+
+// Strided view of an accessor
+struct AccessorView
+{
+    const unsigned char* data = nullptr;
+    size_t stride = 0;
+    size_t count = 0;
+    int componentType = 0;
+    bool normalized = false;
+
+    AccessorView(const tinygltf::Model& m, int accessor)
+    {
+        if (accessor < 0) return;
+
+        const Accessor& a = m.accessors[accessor];
+        if (a.bufferView < 0) return;
+
+        const BufferView& view = m.bufferViews[a.bufferView];
+        int byteStride = a.ByteStride(view);
+        if (byteStride <= 0) return;
+
+        data = m.buffers[view.buffer].data.data() + view.byteOffset + a.byteOffset;
+        stride = size_t(byteStride);
+        count = a.count;
+        componentType = a.componentType;
+        normalized = a.normalized;
+    }
+
+    inline float Component(size_t element, int component) const
+    {
+        const unsigned char* p = data + element * stride;
+
+        switch (componentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+        {
+            float f;
+            std::memcpy(&f, p + component * sizeof(float), sizeof(float));
+            return f;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        {
+            float v = float(p[component]);
+            return normalized ? v / 255.0f : v;
+        }
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+        {
+            float v = float(int8_t(p[component]));
+            return normalized ? glm::max(v / 127.0f, -1.0f) : v;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        {
+            uint16_t u;
+            std::memcpy(&u, p + component * sizeof(uint16_t), sizeof(uint16_t));
+            return normalized ? float(u) / 65535.0f : float(u);
+        }
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+        {
+            int16_t s;
+            std::memcpy(&s, p + component * sizeof(int16_t), sizeof(int16_t));
+            return normalized ? glm::max(float(s) / 32767.0f, -1.0f) : float(s);
+        }
+        default:
+            return 0.0f;
+        }
+    }
+
+    inline glm::vec2 Vec2(size_t element) const { return glm::vec2(Component(element, 0), Component(element, 1)); }
+    inline glm::vec3 Vec3(size_t element) const { return glm::vec3(Component(element, 0), Component(element, 1), Component(element, 2)); }
+
+    inline uint32_t Index(size_t element) const
+    {
+        const unsigned char* p = data + element * stride;
+
+        switch (componentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return p[0];
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        {
+            uint16_t u;
+            std::memcpy(&u, p, sizeof(u));
+            return u;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+        {
+            uint32_t u;
+            std::memcpy(&u, p, sizeof(u));
+            return u;
+        }
+        default:
+            return 0;
+        }
+    }
+};
+
+// One primitive of one node, with its final place in the vertex & index arrays
+struct PrimitiveInstance
+{
+    const Primitive* primitive;
+    glm::mat4 transform;
+    uint32_t vertexOffset;
+    uint32_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+};
+
+static glm::mat4 NodeTransform(const Node& node)
+{
+    if (node.matrix.size() == 16)
+    {
+        glm::mat4 m;
+        for (int i = 0; i < 16; i++)
+            m[i / 4][i % 4] = float(node.matrix[i]);
+        return m;
+    }
+
+    glm::vec3 t = node.translation.size() == 3 ? glm::vec3(float(node.translation[0]), float(node.translation[1]), float(node.translation[2])) : glm::vec3(0.0f);
+    glm::vec3 s = node.scale.size() == 3 ? glm::vec3(float(node.scale[0]), float(node.scale[1]), float(node.scale[2])) : glm::vec3(1.0f);
+
+    float x = 0.0f, y = 0.0f, z = 0.0f, w = 1.0f;
+    if (node.rotation.size() == 4)
+    {
+        x = float(node.rotation[0]);
+        y = float(node.rotation[1]);
+        z = float(node.rotation[2]);
+        w = float(node.rotation[3]);
+    }
+
+    // T * R * S, columns of the rotation scaled
+    glm::mat4 m(1.0f);
+    m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + z * w), 2.0f * (x * z - y * w), 0.0f) * s.x;
+    m[1] = glm::vec4(2.0f * (x * y - z * w), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + x * w), 0.0f) * s.y;
+    m[2] = glm::vec4(2.0f * (x * z + y * w), 2.0f * (y * z - x * w), 1.0f - 2.0f * (x * x + y * y), 0.0f) * s.z;
+    m[3] = glm::vec4(t, 1.0f);
+    return m;
+}
+
+static uint32_t TextureSource(const tinygltf::Model& m, int texture)
+{
+    if (texture < 0 || size_t(texture) >= m.textures.size() || m.textures[texture].source < 0)
+        return NoTexture;
+
+    return uint32_t(m.textures[texture].source);
+}
+
+static float ExtensionNumber(const tinygltf::Material& mat, const char* extension, const char* key, float fallback)
+{
+    auto it = mat.extensions.find(extension);
+    if (it == mat.extensions.end() || !it->second.Has(key)) return fallback;
+
+    const Value& v = it->second.Get(key);
+    return v.IsNumber() ? float(v.GetNumberAsDouble()) : fallback;
+}
+
+static ::Material ConvertMaterial(const tinygltf::Model& m, const tinygltf::Material& mat)
+{
+    ::Material out;
+
+    const std::vector<double>& color = mat.pbrMetallicRoughness.baseColorFactor;
+    out.color = color.size() == 4 ? glm::vec4(float(color[0]), float(color[1]), float(color[2]), float(color[3])) : glm::vec4(1.0f);
+
+    const std::vector<double>& emission = mat.emissiveFactor;
+    out.emission = emission.size() == 3 ? glm::vec3(float(emission[0]), float(emission[1]), float(emission[2])) : glm::vec3(0.0f);
+
+    out.transmission = glm::vec3(ExtensionNumber(mat, "KHR_materials_transmission", "transmissionFactor", 0.0f));
+    out.IOR = ExtensionNumber(mat, "KHR_materials_ior", "ior", 1.5f);
+
+    out.texture0 = TextureSource(m, mat.pbrMetallicRoughness.baseColorTexture.index);
+    out.texture1 = TextureSource(m, mat.pbrMetallicRoughness.metallicRoughnessTexture.index);
+    out.texture2 = TextureSource(m, mat.normalTexture.index);
+    out.texture3 = TextureSource(m, mat.emissiveTexture.index);
+
+    return out;
+}
+
+// Returns the triangles dropped for indexing past the primitive's vertices, they are left degenerate
+static uint32_t ConvertPrimitive(const tinygltf::Model& m, const PrimitiveInstance& inst, uint32_t defaultMaterial, Vertex* vertices, uint32_t* indices)
+{
+    const Primitive& prim = *inst.primitive;
+
+    // Attributes shorter than POSITION are treated as missing
+    auto attribute = [&](const char* name)
+    {
+        auto it = prim.attributes.find(name);
+        AccessorView view(m, it == prim.attributes.end() ? -1 : it->second);
+        if (view.count < inst.vertexCount) view.data = nullptr;
+        return view;
+    };
+
+    AccessorView positions = attribute("POSITION");
+    AccessorView normals = attribute("NORMAL");
+    AccessorView texcoords[4] = { attribute("TEXCOORD_0"), attribute("TEXCOORD_1"), attribute("TEXCOORD_2"), attribute("TEXCOORD_3") };
+
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(inst.transform)));
+    uint32_t material = prim.material >= 0 ? uint32_t(prim.material) : defaultMaterial;
+
+    Vertex* out = vertices + inst.vertexOffset;
+    for (uint32_t i = 0; i < inst.vertexCount; i++)
+    {
+        Vertex& v = out[i];
+
+        v.position = glm::vec3(inst.transform * glm::vec4(positions.Vec3(i), 1.0f));
+        v.normal = glm::vec3(0.0f);
+        if (normals.data)
+        {
+            // Exporters do write zero normals, those shade like missing ones
+            glm::vec3 n = normalMatrix * normals.Vec3(i);
+            float length = glm::length(n);
+            if (length > 0.0f) v.normal = n / length;
+        }
+        v.materialId = material;
+
+        v.texcoord0 = texcoords[0].data ? texcoords[0].Vec2(i) : glm::vec2(0.0f);
+        v.texcoord1 = texcoords[1].data ? texcoords[1].Vec2(i) : glm::vec2(0.0f);
+        v.texcoord2 = texcoords[2].data ? texcoords[2].Vec2(i) : glm::vec2(0.0f);
+        v.texcoord3 = texcoords[3].data ? texcoords[3].Vec2(i) : glm::vec2(0.0f);
+    }
+
+    uint32_t* outIndices = indices + inst.indexOffset;
+
+    if (prim.indices < 0)
+    {
+        for (uint32_t i = 0; i < inst.indexCount; i++)
+            outIndices[i] = i;
+        return 0;
+    }
+
+    // The BVH, voxelizer & meshlets index the vertices as is
+    AccessorView source = AccessorView(m, prim.indices);
+    uint32_t dropped = 0;
+
+    for (uint32_t i = 0; i < inst.indexCount; i += 3)
+    {
+        uint32_t a = source.Index(i);
+        uint32_t b = source.Index(i + 1);
+        uint32_t c = source.Index(i + 2);
+
+        if (a >= inst.vertexCount || b >= inst.vertexCount || c >= inst.vertexCount)
+        {
+            a = b = c = 0;
+            dropped++;
+        }
+
+        outIndices[i] = a;
+        outIndices[i + 1] = b;
+        outIndices[i + 2] = c;
+    }
+
+    return dropped;
+}
+
+::Model LoadGLTF(const std::string& path, ThreadPool* pool)
+{
+    PROFILE_ZONE("LoadGLTF");
+
+    auto start = Clock::now();
+
+    ::Model result;
+
+    // Parse JSON & buffers, images are only collected
+    tinygltf::Model m;
+    PendingImages pending;
+    {
+        PROFILE_ZONE("glTF Parse");
+
+        TinyGLTF loader;
+        loader.SetImageLoader(CollectImage, &pending);
+
+        std::string err, warn;
+        bool binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".glb") == 0;
+        bool ok = binary ? loader.LoadBinaryFromFile(&m, &err, &warn, path) : loader.LoadASCIIFromFile(&m, &err, &warn, path);
+
+        if (!warn.empty()) std::cerr << "[glTF] Warning: " << warn << std::endl;
+
+        if (!ok)
+        {
+            std::cerr << "[glTF] Error: " << err << std::endl;
+            throw ErrorCode::ASSET_LOAD_FAILED;
+        }
+    }
+
+    result.stats.parseSeconds = SecondsSince(start);
+
+    // Buffers & images in files of their own, the GLB chunk & data URIs are part of the asset
+    auto external = [](const std::string& uri) { return !uri.empty() && uri.compare(0, 5, "data:") != 0; };
+
+    for (const Buffer& buffer : m.buffers)
+        if (external(buffer.uri)) result.externalFiles.push_back(buffer.uri);
+
+    for (const Image& image : m.images)
+        if (external(image.uri)) result.externalFiles.push_back(image.uri);
+
+    // One thread per image, stb_image is the slowest part of loading
+    pending.encoded.resize(m.images.size());
+    result.images.resize(m.images.size(), { 0, 0, nullptr });
+    result.storage.resize(m.images.size());
+
+    std::vector<std::thread> decoders;
+    std::vector<double> decodeSeconds(m.images.size(), 0.0);
+
+    for (size_t i = 0; i < m.images.size(); i++)
+    {
+        decoders.emplace_back([&, i]()
+        {
+            Profiler::SetThreadName("Image Decoder");
+            PROFILE_ZONE("Decode Image");
+
+            auto decodeStart = Clock::now();
+            const std::vector<unsigned char>& bytes = pending.encoded[i];
+
+            int width, height, components;
+            stbi_uc* pixels = bytes.empty() ? nullptr : stbi_load_from_memory(bytes.data(), int(bytes.size()), &width, &height, &components, 4);
+
+            if (pixels)
+            {
+                // stb's buffer is handed over as is
+                result.storage[i] = std::shared_ptr<const void>(pixels, stbi_image_free);
+                result.images[i] = { uint32_t(width), uint32_t(height), pixels };
+            }
+
+            decodeSeconds[i] = SecondsSince(decodeStart);
+        });
+    }
+
+    // Meanwhile lay out the geometry of every primitive instance
+    auto convertStart = Clock::now();
+
+    std::vector<PrimitiveInstance> instances;
+    uint32_t numVertices = 0;
+    uint32_t numIndices = 0;
+
+    std::function<void(int, const glm::mat4&)> visit = [&](int nodeIndex, const glm::mat4& parent)
+    {
+        const Node& node = m.nodes[nodeIndex];
+        glm::mat4 transform = parent * NodeTransform(node);
+
+        if (node.mesh >= 0)
+        {
+            for (const Primitive& prim : m.meshes[node.mesh].primitives)
+            {
+                auto position = prim.attributes.find("POSITION");
+                if (prim.mode != TINYGLTF_MODE_TRIANGLES || position == prim.attributes.end()) continue;
+
+                // Sparse accessors without a base buffer view are not decoded
+                AccessorView positions(m, position->second);
+                AccessorView source(m, prim.indices);
+                if (!positions.data || (prim.indices >= 0 && !source.data))
+                {
+                    std::cerr << "[glTF] Warning: skipped a primitive of mesh " << node.mesh << ", its "
+                        << (positions.data ? "indices have" : "positions have") << " no buffer view" << std::endl;
+                    continue;
+                }
+
+                uint32_t vertexCount = uint32_t(positions.count);
+                uint32_t indexCount = prim.indices >= 0 ? uint32_t(source.count) : vertexCount;
+
+                instances.push_back({ &prim, transform, numVertices, numIndices, vertexCount, indexCount - indexCount % 3 });
+                numVertices += vertexCount;
+                numIndices += instances.back().indexCount;
+            }
+        }
+
+        for (int child : node.children)
+            visit(child, transform);
+    };
+
+    if (!m.scenes.empty())
+    {
+        const tinygltf::Scene& scene = m.scenes[m.defaultScene >= 0 ? m.defaultScene : 0];
+        for (int node : scene.nodes)
+            visit(node, glm::mat4(1.0f));
+    }
+
+    // Primitives without a material get a default one at the end
+    for (const tinygltf::Material& mat : m.materials)
+        result.materials.push_back(ConvertMaterial(m, mat));
+
+    uint32_t defaultMaterial = uint32_t(result.materials.size());
+    result.materials.push_back({ glm::vec4(1.0f), glm::vec3(0.0f), glm::vec3(0.0f), 1.5f, NoTexture, NoTexture, NoTexture, NoTexture });
+
+    // Accessors are converted straight into the final arrays
+    std::shared_ptr<Vertex> vertices(new Vertex[glm::max(numVertices, 1u)], std::default_delete<Vertex[]>());
+    std::shared_ptr<uint32_t> indices(new uint32_t[glm::max(numIndices, 1u)], std::default_delete<uint32_t[]>());
+
+    PROFILE_ZONE("glTF Convert");
+
+    std::vector<uint32_t> dropped(instances.size(), 0);
+    auto convert = [&](size_t i) { dropped[i] = ConvertPrimitive(m, instances[i], defaultMaterial, vertices.get(), indices.get()); };
+
+    if (pool)
+        pool->ParallelFor(instances.size(), convert);
+    else
+        for (size_t i = 0; i < instances.size(); i++) convert(i);
+
+    result.vertices = vertices.get();
+    result.numVertices = numVertices;
+    result.indices = indices.get();
+    result.numIndices = numIndices;
+
+    for (const PrimitiveInstance& inst : instances)
+        result.meshes.push_back({ inst.indexCount, inst.vertexOffset, inst.indexOffset, result.vertices, result.indices });
+
+    result.stats.convertSeconds = SecondsSince(convertStart);
+
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        if (dropped[i])
+            std::cerr << "[glTF] Warning: dropped " << dropped[i] << " triangles with out of range indices" << std::endl;
+    }
+
+    for (std::thread& t : decoders)
+        t.join();
+
+    // Decoders write their slots of storage, it may only grow once they are done
+    result.storage.push_back(vertices);
+    result.storage.push_back(indices);
+
+    for (size_t i = 0; i < m.images.size(); i++)
+    {
+        result.stats.decodeSeconds = glm::max(result.stats.decodeSeconds, decodeSeconds[i]);
+
+        if (!result.images[i].pixels)
+            std::cerr << "[glTF] Warning: failed to decode image " << i << " (" << m.images[i].uri << ")" << std::endl;
+    }
+
+    result.stats.totalSeconds = SecondsSince(start);
+
+    return result;
+}
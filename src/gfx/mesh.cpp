@@ -0,0 +1,53 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Mesh Formats
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "gfx/mesh.h"
+
+size_t VertexStreams::MemoryUsage() const
+{
+	size_t bytes = positions.size() * sizeof(glm::vec3) + normals.size() * sizeof(uint32_t) + materialIds.size() * sizeof(uint32_t);
+
+	for (const std::vector<uint32_t>& set : texcoords)
+		bytes += set.size() * sizeof(uint32_t);
+
+	return bytes;
+}
+
+VertexStreams SplitVertexStreams(const Vertex* vertices, size_t count)
+{
+	VertexStreams s;
+	s.count = count;
+
+	s.positions.resize(count);
+	s.normals.resize(count);
+	s.materialIds.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const Vertex& v = vertices[i];
+
+		s.positions[i] = v.position;
+		s.normals[i] = (v.normal == glm::vec3(0.0f)) ? 0u : EncodeOctahedral(v.normal); // Missing normals decode as +z
+		s.materialIds[i] = v.materialId;
+	}
+
+	// A texcoord set that is zero everywhere was never provided
+	const glm::vec2 Vertex::* sets[4] = { &Vertex::texcoord0, &Vertex::texcoord1, &Vertex::texcoord2, &Vertex::texcoord3 };
+
+	for (int set = 0; set < 4; set++)
+	{
+		bool used = false;
+		for (size_t i = 0; i < count && !used; i++)
+			used = vertices[i].*sets[set] != glm::vec2(0.0f);
+
+		if (!used) continue;
+
+		s.texcoords[set].resize(count);
+		for (size_t i = 0; i < count; i++)
+			s.texcoords[set][i] = glm::packHalf2x16(vertices[i].*sets[set]);
+	}
+
+	return s;
+}
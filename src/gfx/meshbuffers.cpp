@@ -0,0 +1,76 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - GFX System - Mesh Buffers
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "gfx/meshbuffers.h"
+
+template <typename T>
+static Buffer* UploadStream(const std::vector<T>& stream, size_t& memoryUsage)
+{
+    if (stream.empty()) return nullptr;
+
+    Buffer* buffer = new Buffer();
+    buffer->UploadData(const_cast<T*>(stream.data()), stream.size());
+    buffer->size = stream.size() * sizeof(T);
+
+    memoryUsage += buffer->size;
+    return buffer;
+}
+
+MeshBuffers::MeshBuffers(const VertexStreams& streams, const uint32_t* indices, size_t numIndices)
+{
+    positions = UploadStream(streams.positions, memoryUsage);
+    normals = UploadStream(streams.normals, memoryUsage);
+    materialIds = UploadStream(streams.materialIds, memoryUsage);
+
+    for (int set = 0; set < 4; set++)
+        texcoords[set] = UploadStream(streams.texcoords[set], memoryUsage);
+
+    this->indices = new Buffer();
+    this->indices->UploadData(const_cast<uint32_t*>(indices), numIndices);
+    this->indices->size = numIndices * sizeof(uint32_t);
+    memoryUsage += this->indices->size;
+}
+
+MeshBuffers::~MeshBuffers()
+{
+    delete positions;
+    delete normals;
+    delete materialIds;
+
+    for (Buffer* set : texcoords)
+        delete set;
+
+    delete indices;
+}
+
+void MeshBuffers::Bind(VertexArray& vertexArray) const
+{
+    vertexArray.SetIndexBuffer(indices);
+
+    auto stream = [&vertexArray](Buffer* buffer, DataType type, uint8_t numComponents, size_t stride, bool normalized)
+    {
+        size_t bufferIndex = vertexArray.buffers.size();
+        vertexArray.AddBuffer(buffer, 0, stride);
+        vertexArray.AddAttribute(type, numComponents, stride, 0, bufferIndex, normalized);
+    };
+
+    stream(positions, DataType::Float, 3, sizeof(glm::vec3), false);
+    stream(normals, DataType::Int16, 2, sizeof(uint32_t), true);
+    stream(materialIds, DataType::Uint32, 1, sizeof(uint32_t), false);
+
+    for (Buffer* set : texcoords)
+    {
+        if (set) stream(set, DataType::Float16, 2, sizeof(uint32_t), false);
+    }
+}
+
+void MeshBuffers::BindPositions(VertexArray& vertexArray) const
+{
+    vertexArray.SetIndexBuffer(indices);
+
+    size_t bufferIndex = vertexArray.buffers.size();
+    vertexArray.AddBuffer(positions, 0, sizeof(glm::vec3));
+    vertexArray.AddAttribute(DataType::Float, 3, sizeof(glm::vec3), 0, bufferIndex);
+}
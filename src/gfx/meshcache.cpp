@@ -0,0 +1,429 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Binary Mesh Cache
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "gfx/meshcache.h"
+#include "gfx/gltf.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char Magic[8] = { 'V', 'T', 'M', 'E', 'S', 'H', 'C', '\0' };
+    const uint64_t SectionAlignment = 64;
+
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertexSize;   // Catches layout changes of Vertex & Material that forgot a version bump
+        uint32_t materialSize;
+        uint32_t reserved;
+
+        MeshCache::SourceStamp source;
+        uint64_t fileSize;
+
+        Section meshes;
+        Section materials;
+        Section images;
+        Section vertices;
+        Section indices;
+        Section externals;
+        Section uris; // Characters of the external URIs
+    };
+
+    struct CachedMesh
+    {
+        uint32_t count;
+        uint32_t vertexOffset;
+        uint32_t indexOffset;
+        uint32_t reserved;
+    };
+
+    struct CachedImage
+    {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset; // 0 if the image failed to decode
+    };
+
+    struct CachedExternal
+    {
+        MeshCache::SourceStamp stamp;
+        uint64_t uriOffset; // Into the uris section
+        uint64_t uriLength;
+    };
+
+    inline uint64_t Align(uint64_t offset)
+    {
+        return (offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+    }
+
+    // Read only mapping of a whole file, unmapped with the last reference
+    class MappedFile
+    {
+    public:
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        static std::shared_ptr<MappedFile> Open(const std::string& path)
+        {
+            std::shared_ptr<MappedFile> file(new MappedFile());
+
+#ifdef _WIN32
+            HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle == INVALID_HANDLE_VALUE) return nullptr;
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+            {
+                CloseHandle(handle);
+                return nullptr;
+            }
+
+            HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(handle);
+            if (!mapping) return nullptr;
+
+            file->data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+            if (!file->data) return nullptr;
+
+            file->size = uint64_t(size.QuadPart);
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return nullptr;
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0)
+            {
+                close(fd);
+                return nullptr;
+            }
+
+            void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED) return nullptr;
+
+            file->data = static_cast<const uint8_t*>(p);
+            file->size = uint64_t(st.st_size);
+#endif
+
+            return file;
+        }
+
+        ~MappedFile()
+        {
+            if (!data) return;
+
+#ifdef _WIN32
+            UnmapViewOfFile(data);
+#else
+            munmap(const_cast<uint8_t*>(data), size_t(size));
+#endif
+        }
+
+        const uint8_t* data = nullptr;
+        uint64_t size = 0;
+
+    private:
+        MappedFile() = default;
+    };
+
+    inline bool InFile(const Section& s, uint64_t elementSize, uint64_t fileSize)
+    {
+        return s.offset <= fileSize && s.count <= (fileSize - s.offset) / elementSize;
+    }
+
+    inline bool SameStamp(const MeshCache::SourceStamp& a, const MeshCache::SourceStamp& b)
+    {
+        return a.size == b.size && a.modified == b.modified;
+    }
+
+    // File of an external buffer / image, URIs are percent encoded & relative to the asset
+    std::string ExternalPath(const std::string& sourcePath, const std::string& uri)
+    {
+        std::string path;
+        for (size_t i = 0; i < uri.size(); i++)
+        {
+            if (uri[i] == '%' && i + 2 < uri.size() && std::isxdigit((unsigned char)uri[i + 1]) && std::isxdigit((unsigned char)uri[i + 2]))
+            {
+                path += char(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+                i += 2;
+            }
+            else
+            {
+                path += uri[i];
+            }
+        }
+
+        return (std::filesystem::path(sourcePath).parent_path() / path).string();
+    }
+}
+
+bool MeshCache::Stamp(const std::string& sourcePath, SourceStamp& stamp)
+{
+    std::error_code ec;
+
+    uintmax_t size = std::filesystem::file_size(sourcePath, ec);
+    if (ec) return false;
+
+    auto modified = std::filesystem::last_write_time(sourcePath, ec);
+    if (ec) return false;
+
+    stamp.size = uint64_t(size);
+    stamp.modified = int64_t(modified.time_since_epoch().count());
+    return true;
+}
+
+std::string MeshCache::CachePath(const std::string& sourcePath)
+{
+    return sourcePath + ".vtcache";
+}
+
+bool MeshCache::Load(const std::string& cachePath, const std::string& sourcePath, const SourceStamp& stamp, Model& model)
+{
+    PROFILE_ZONE("MeshCache Load");
+
+    std::shared_ptr<MappedFile> file = MappedFile::Open(cachePath);
+    if (!file || file->size < sizeof(Header)) return false;
+
+    Header h;
+    std::memcpy(&h, file->data, sizeof(h));
+
+    if (std::memcmp(h.magic, Magic, sizeof(Magic)) != 0 || h.version != Version ||
+        h.vertexSize != sizeof(Vertex) || h.materialSize != sizeof(Material) ||
+        !SameStamp(h.source, stamp) || h.fileSize != file->size)
+        return false;
+
+    if (!InFile(h.meshes, sizeof(CachedMesh), file->size) || !InFile(h.materials, sizeof(Material), file->size) ||
+        !InFile(h.images, sizeof(CachedImage), file->size) || !InFile(h.vertices, sizeof(Vertex), file->size) ||
+        !InFile(h.indices, sizeof(uint32_t), file->size) || !InFile(h.externals, sizeof(CachedExternal), file->size) ||
+        !InFile(h.uris, 1, file->size))
+        return false;
+
+    Model m;
+
+    // Stale if any buffer or image file the source read changed since
+    const CachedExternal* externals = reinterpret_cast<const CachedExternal*>(file->data + h.externals.offset);
+    const char* uris = reinterpret_cast<const char*>(file->data + h.uris.offset);
+
+    for (uint64_t i = 0; i < h.externals.count; i++)
+    {
+        const CachedExternal& c = externals[i];
+        if (c.uriOffset > h.uris.count || c.uriLength > h.uris.count - c.uriOffset) return false;
+
+        std::string uri(uris + c.uriOffset, size_t(c.uriLength));
+
+        SourceStamp current;
+        if (!Stamp(ExternalPath(sourcePath, uri), current) || !SameStamp(current, c.stamp)) return false;
+
+        m.externalFiles.push_back(std::move(uri));
+    }
+
+    // The mapping is read only, the pointers are only non const to fit Mesh
+    Vertex* vertices = reinterpret_cast<Vertex*>(const_cast<uint8_t*>(file->data + h.vertices.offset));
+    uint32_t* indices = reinterpret_cast<uint32_t*>(const_cast<uint8_t*>(file->data + h.indices.offset));
+
+    m.vertices = vertices;
+    m.numVertices = size_t(h.vertices.count);
+    m.indices = indices;
+    m.numIndices = size_t(h.indices.count);
+
+    const CachedMesh* meshes = reinterpret_cast<const CachedMesh*>(file->data + h.meshes.offset);
+    m.meshes.reserve(size_t(h.meshes.count));
+
+    for (uint64_t i = 0; i < h.meshes.count; i++)
+    {
+        const CachedMesh& c = meshes[i];
+        if (uint64_t(c.indexOffset) + c.count > h.indices.count || c.vertexOffset > h.vertices.count) return false;
+
+        m.meshes.push_back({ c.count, c.vertexOffset, c.indexOffset, vertices, indices });
+    }
+
+    // Materials are tiny, copied so they stay editable
+    const Material* materials = reinterpret_cast<const Material*>(file->data + h.materials.offset);
+    m.materials.assign(materials, materials + h.materials.count);
+
+    const CachedImage* images = reinterpret_cast<const CachedImage*>(file->data + h.images.offset);
+    m.images.reserve(size_t(h.images.count));
+
+    for (uint64_t i = 0; i < h.images.count; i++)
+    {
+        const CachedImage& c = images[i];
+        Section pixels = { c.offset, uint64_t(c.width) * c.height };
+
+        if (c.offset && !InFile(pixels, 4, file->size)) return false;
+
+        m.images.push_back({ c.width, c.height, c.offset ? file->data + c.offset : nullptr });
+    }
+
+    m.storage.push_back(file);
+    m.stats.cached = true;
+
+    model = std::move(m);
+    return true;
+}
+
+bool MeshCache::Write(const std::string& cachePath, const std::string& sourcePath, const SourceStamp& stamp, const Model& model)
+{
+    PROFILE_ZONE("MeshCache Write");
+
+    std::vector<CachedExternal> externals;
+    std::string uris;
+    for (const std::string& uri : model.externalFiles)
+    {
+        CachedExternal c = {};
+        if (!Stamp(ExternalPath(sourcePath, uri), c.stamp)) return false;
+
+        c.uriOffset = uris.size();
+        c.uriLength = uri.size();
+        uris += uri;
+        externals.push_back(c);
+    }
+
+    Header h = {};
+    std::memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = Version;
+    h.vertexSize = sizeof(Vertex);
+    h.materialSize = sizeof(Material);
+    h.source = stamp;
+
+    // Lay out the sections, then the image pixels
+    uint64_t offset = Align(sizeof(Header));
+    auto place = [&offset](Section& s, uint64_t count, uint64_t elementSize)
+    {
+        s = { offset, count };
+        offset = Align(offset + count * elementSize);
+    };
+
+    place(h.meshes, model.meshes.size(), sizeof(CachedMesh));
+    place(h.materials, model.materials.size(), sizeof(Material));
+    place(h.images, model.images.size(), sizeof(CachedImage));
+    place(h.vertices, model.numVertices, sizeof(Vertex));
+    place(h.indices, model.numIndices, sizeof(uint32_t));
+    place(h.externals, externals.size(), sizeof(CachedExternal));
+    place(h.uris, uris.size(), 1);
+
+    std::vector<CachedImage> images;
+    for (const TextureImage& image : model.images)
+    {
+        CachedImage c = { image.width, image.height, 0 };
+        if (image.pixels)
+        {
+            c.offset = offset;
+            offset = Align(offset + uint64_t(image.width) * image.height * 4);
+        }
+        images.push_back(c);
+    }
+
+    h.fileSize = offset;
+
+    std::vector<CachedMesh> meshes;
+    for (const Mesh& mesh : model.meshes)
+    {
+        // Mesh offsets are relative to the model arrays
+        if (mesh.vertices != model.vertices || mesh.indicies != model.indices) return false;
+
+        meshes.push_back({ mesh.count, mesh.vertexOffset, mesh.indexOffset, 0 });
+    }
+
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+
+        auto write = [&out](uint64_t at, const void* data, uint64_t bytes)
+        {
+            // Zero fill the alignment padding
+            static const char zeros[SectionAlignment] = {};
+            while (uint64_t(out.tellp()) < at)
+                out.write(zeros, std::streamsize(std::min<uint64_t>(at - uint64_t(out.tellp()), SectionAlignment)));
+
+            if (bytes) out.write(static_cast<const char*>(data), std::streamsize(bytes));
+        };
+
+        write(0, &h, sizeof(h));
+        write(h.meshes.offset, meshes.data(), meshes.size() * sizeof(CachedMesh));
+        write(h.materials.offset, model.materials.data(), model.materials.size() * sizeof(Material));
+        write(h.images.offset, images.data(), images.size() * sizeof(CachedImage));
+        write(h.vertices.offset, model.vertices, model.numVertices * sizeof(Vertex));
+        write(h.indices.offset, model.indices, model.numIndices * sizeof(uint32_t));
+        write(h.externals.offset, externals.data(), externals.size() * sizeof(CachedExternal));
+        write(h.uris.offset, uris.data(), uris.size());
+
+        for (size_t i = 0; i < images.size(); i++)
+            if (images[i].offset)
+                write(images[i].offset, model.images[i].pixels, uint64_t(images[i].width) * images[i].height * 4);
+
+        write(h.fileSize, nullptr, 0);
+
+        if (!out.good()) return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    return true;
+}
+
+Model LoadModelCached(const std::string& path, ThreadPool* pool)
+{
+    PROFILE_FUNCTION();
+
+    auto start = std::chrono::steady_clock::now();
+
+    MeshCache::SourceStamp stamp;
+    if (!MeshCache::Stamp(path, stamp))
+    {
+        std::cerr << "[MeshCache] Cannot read " << path << std::endl;
+        throw ErrorCode::ASSET_LOAD_FAILED;
+    }
+
+    std::string cachePath = MeshCache::CachePath(path);
+
+    Model model;
+    if (MeshCache::Load(cachePath, path, stamp, model))
+    {
+        model.stats.totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return model;
+    }
+
+    model = LoadGLTF(path, pool);
+
+    if (!MeshCache::Write(cachePath, path, stamp, model))
+        std::cerr << "[MeshCache] Warning: failed to write " << cachePath << std::endl;
+
+    return model;
+}
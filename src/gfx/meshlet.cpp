@@ -0,0 +1,218 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Meshlets
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "gfx/meshlet.h"
+
+#include <cfloat>
+#include <cmath>
+
+static const uint32_t FallbackWindow = 32; // Unused triangles looked at when nothing adjacent fits
+
+static void ComputeBounds(const Mesh& mesh, MeshletSet& set, Meshlet& m)
+{
+	auto position = [&](uint32_t local)
+	{
+		return mesh.vertices[mesh.vertexOffset + set.vertices[m.vertexOffset + local]].position;
+	};
+
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (uint32_t i = 0; i < m.vertexCount; i++)
+	{
+		lo = glm::min(lo, position(i));
+		hi = glm::max(hi, position(i));
+	}
+
+	m.center = (lo + hi) * 0.5f;
+	m.radius = 0.0f;
+	for (uint32_t i = 0; i < m.vertexCount; i++)
+		m.radius = glm::max(m.radius, glm::length(position(i) - m.center));
+
+	// Cone around the average normal, degenerate triangles don't constrain it
+	std::vector<glm::vec3> normals;
+	glm::vec3 sum(0.0f);
+
+	for (uint32_t t = 0; t < m.triangleCount; t++)
+	{
+		const uint8_t* tri = &set.triangles[m.triangleOffset + t * 3];
+		glm::vec3 n = glm::cross(position(tri[1]) - position(tri[0]), position(tri[2]) - position(tri[0]));
+
+		float l = glm::length(n);
+		if (l <= 0.0f) continue;
+
+		normals.push_back(n / l);
+		sum += n / l;
+	}
+
+	m.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	m.coneCutoff = 1.0f;
+
+	float l = glm::length(sum);
+	if (normals.empty() || l <= 0.0f) return;
+
+	m.coneAxis = sum / l;
+
+	float minDot = 1.0f;
+	for (const glm::vec3& n : normals)
+		minDot = glm::min(minDot, glm::dot(n, m.coneAxis));
+
+	// Cones past ~84 degrees are never backfacing from anywhere useful
+	if (minDot > 0.1f)
+		m.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+MeshletSet BuildMeshlets(const Mesh& mesh)
+{
+	MeshletSet set;
+
+	uint32_t numTriangles = mesh.count / 3;
+	if (numTriangles == 0) return set;
+
+	const uint32_t* indices = mesh.indicies + mesh.indexOffset;
+
+	uint32_t numVertices = 0;
+	for (uint32_t i = 0; i < numTriangles * 3; i++)
+		numVertices = glm::max(numVertices, indices[i] + 1);
+
+	auto centroid = [&](uint32_t t)
+	{
+		const Vertex* v = mesh.vertices + mesh.vertexOffset;
+		return (v[indices[t * 3]].position + v[indices[t * 3 + 1]].position + v[indices[t * 3 + 2]].position) * (1.0f / 3.0f);
+	};
+
+	// Vertex to triangle adjacency
+	std::vector<uint32_t> firstAdjacent(numVertices + 1, 0);
+	for (uint32_t i = 0; i < numTriangles * 3; i++)
+		firstAdjacent[indices[i] + 1]++;
+	for (uint32_t v = 0; v < numVertices; v++)
+		firstAdjacent[v + 1] += firstAdjacent[v];
+
+	std::vector<uint32_t> adjacent(numTriangles * 3);
+	{
+		std::vector<uint32_t> cursor(firstAdjacent.begin(), firstAdjacent.end() - 1);
+		for (uint32_t i = 0; i < numTriangles * 3; i++)
+			adjacent[cursor[indices[i]]++] = i / 3;
+	}
+
+	std::vector<bool> used(numTriangles, false);
+	std::vector<uint32_t> stamp(numVertices, 0);     // Meshlet index + 1 the vertex is in
+	std::vector<uint8_t> localIndex(numVertices, 0);
+
+	std::vector<uint32_t> candidates;
+	uint32_t scan = 0; // Every triangle before is used
+
+	for (;;)
+	{
+		while (scan < numTriangles && used[scan]) scan++;
+		if (scan == numTriangles) break;
+
+		Meshlet m = {};
+		m.vertexOffset = uint32_t(set.vertices.size());
+		m.triangleOffset = uint32_t(set.triangles.size());
+
+		uint32_t id = uint32_t(set.meshlets.size()) + 1;
+		glm::vec3 centerSum(0.0f);
+
+		auto newVertices = [&](uint32_t t)
+		{
+			uint32_t n = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t v = indices[t * 3 + c];
+				bool repeated = (c > 0 && indices[t * 3] == v) || (c > 1 && indices[t * 3 + 1] == v);
+				if (stamp[v] != id && !repeated) n++;
+			}
+			return n;
+		};
+
+		auto add = [&](uint32_t t)
+		{
+			used[t] = true;
+
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t v = indices[t * 3 + c];
+				if (stamp[v] != id)
+				{
+					stamp[v] = id;
+					localIndex[v] = uint8_t(m.vertexCount++);
+					set.vertices.push_back(v);
+
+					for (uint32_t a = firstAdjacent[v]; a < firstAdjacent[v + 1]; a++)
+						if (!used[adjacent[a]]) candidates.push_back(adjacent[a]);
+				}
+
+				set.triangles.push_back(localIndex[v]);
+			}
+
+			m.triangleCount++;
+			centerSum += centroid(t);
+		};
+
+		candidates.clear();
+		add(scan);
+
+		while (m.triangleCount < MaxMeshletTriangles)
+		{
+			glm::vec3 center = centerSum / float(m.triangleCount);
+
+			// Fewest new vertices first, then closest to the meshlet
+			uint32_t best = UINT32_MAX;
+			uint32_t bestNew = UINT32_MAX;
+			float bestDistance = FLT_MAX;
+
+			size_t live = 0;
+			for (size_t i = 0; i < candidates.size(); i++)
+			{
+				uint32_t t = candidates[i];
+				if (used[t]) continue;
+				candidates[live++] = t;
+
+				uint32_t n = newVertices(t);
+				if (m.vertexCount + n > MaxMeshletVertices || n > bestNew) continue;
+
+				glm::vec3 d = centroid(t) - center;
+				float distance = glm::dot(d, d);
+
+				if (n < bestNew || distance < bestDistance)
+				{
+					best = t;
+					bestNew = n;
+					bestDistance = distance;
+				}
+			}
+			candidates.resize(live);
+
+			// Nothing connected fits, take the closest of the next unused triangles
+			if (best == UINT32_MAX)
+			{
+				uint32_t looked = 0;
+				for (uint32_t t = scan; t < numTriangles && looked < FallbackWindow; t++)
+				{
+					if (used[t]) continue;
+					looked++;
+
+					if (m.vertexCount + newVertices(t) > MaxMeshletVertices) continue;
+
+					glm::vec3 d = centroid(t) - center;
+					float distance = glm::dot(d, d);
+
+					if (distance < bestDistance)
+					{
+						best = t;
+						bestDistance = distance;
+					}
+				}
+			}
+
+			if (best == UINT32_MAX) break;
+			add(best);
+		}
+
+		ComputeBounds(mesh, set, m);
+		set.meshlets.push_back(m);
+	}
+
+	return set;
+}
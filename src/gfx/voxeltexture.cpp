@@ -0,0 +1,59 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - GFX System - Voxel Texture
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "gfx/voxeltexture.h"
+
+#include <vector>
+
+VoxelTexture::VoxelTexture(BrickMapScene& scene)
+{
+    IVec3 size = scene.Size();
+
+    texture = new Texture(BufferFormat::R32UI, size.x, size.y, size.z, 1);
+
+    // Texture storage starts undefined, uploaded one brick thick slab at a time including empty space
+    const Int slabDepth = BrickMapScene::BrickSize;
+    std::vector<UInt> slab(size_t(size.x) * size_t(size.y) * size_t(slabDepth));
+
+    for (Int z0 = 0; z0 < size.z; z0 += slabDepth)
+    {
+        size_t i = 0;
+        for (Int z = z0; z < z0 + slabDepth; z++)
+        {
+            for (Int y = 0; y < size.y; y++)
+            {
+                for (Int x = 0; x < size.x; x++)
+                    slab[i++] = scene.Get(IVec3(x, y, z));
+            }
+        }
+
+        texture->UploadImage(Texture::ImageFormat::RInteger, DataType::Uint32, 0, 0, 0, z0, size.x, size.y, slabDepth, slab.data());
+    }
+
+    scene.ClearDirty();
+}
+
+VoxelTexture::~VoxelTexture()
+{
+    delete texture;
+}
+
+size_t VoxelTexture::Update(BrickMapScene& scene)
+{
+    const std::vector<IVec3>& dirty = scene.DirtyBricks();
+
+    // Brick materials are already laid out x, y, z like an 8^3 texture region
+    for (IVec3 cell : dirty)
+    {
+        IVec3 origin = cell * BrickMapScene::BrickSize;
+        texture->UploadImage(Texture::ImageFormat::RInteger, DataType::Uint32, 0, origin.x, origin.y, origin.z,
+            BrickMapScene::BrickSize, BrickMapScene::BrickSize, BrickMapScene::BrickSize, scene.BrickMaterials(cell));
+    }
+
+    size_t uploaded = dirty.size();
+    scene.ClearDirty();
+
+    return uploaded;
+}
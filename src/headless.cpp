@@ -0,0 +1,387 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Headless Renderer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "headless.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "stb_image_write.h"
+
+#include "gfx/meshcache.h"
+#include "profiler.h"
+#include "scene/demo.h"
+#include "scene/voxelizer.h"
+
+static const char* Usage =
+    "Usage: tracer_headless [options]\n"
+    "  --scene <path>       .gltf / .glb to voxelize or a chunk file to page in, the demo hills if omitted\n"
+    "  --resolution <n>     voxels along the longest axis of a voxelized scene (512)\n"
+    "  --size <w>x<h>       image size (1280x720)\n"
+    "  --frames <n>         frames to render, spread over the camera path (1, or one per keyframe)\n"
+    "  --camera <path>      camera path, one \"px py pz fx fy fz [fov]\" keyframe per line\n"
+    "  --output <pattern>   path with one %d for the frame index, .png .bmp .tga .jpg or .hdr (frame_%04d.png)\n"
+    "  --threads <n>        worker threads (one per core)\n"
+    "  --cache-mb <n>       chunk cache budget of paged scenes (1024)\n"
+    "  --trace <path>       write the profiler zones of the run as a Chrome trace\n"
+    "  --progressive <e>    adaptive sampling until the per pixel error is under e, e.g. 0.004 (off)\n"
+    "  --path-trace <n>     path trace n samples per pixel instead (off)\n";
+
+static std::string Extension(const std::string& path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return "";
+
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    return ext;
+}
+
+// The pattern is handed to snprintf with the frame index, so it may hold a single %d (or %i) with
+// flags, width & precision, and %% besides. Anything else would read arguments that aren't there.
+static bool ValidOutputPattern(const std::string& pattern)
+{
+    int conversions = 0;
+
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        if (pattern[i] != '%') continue;
+
+        if (++i < pattern.size() && pattern[i] == '%') continue;
+
+        while (i < pattern.size() && std::strchr("-+ #0", pattern[i])) i++;
+        while (i < pattern.size() && std::isdigit((unsigned char)pattern[i])) i++;
+        if (i < pattern.size() && pattern[i] == '.')
+        {
+            i++;
+            while (i < pattern.size() && std::isdigit((unsigned char)pattern[i])) i++;
+        }
+
+        if (i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i')) return false;
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
+bool HeadlessTracer::ParseArguments(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--help" || arg == "-h")
+        {
+            std::cout << Usage;
+            return false;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cerr << "[Headless] Missing value for " << arg << "\n" << Usage;
+            return false;
+        }
+
+        std::string value = argv[++i];
+        bool valid = true;
+
+        if (arg == "--scene")
+            options.scene = value;
+        else if (arg == "--resolution")
+            valid = std::sscanf(value.c_str(), "%d", &options.resolution) == 1 && options.resolution > 0;
+        else if (arg == "--size")
+            valid = std::sscanf(value.c_str(), "%zux%zu", &options.width, &options.height) == 2 && options.width > 0 && options.height > 0;
+        else if (arg == "--frames")
+            valid = std::sscanf(value.c_str(), "%zu", &options.frames) == 1;
+        else if (arg == "--camera")
+            options.cameraPath = value;
+        else if (arg == "--output")
+        {
+            options.output = value;
+            valid = ValidOutputPattern(value);
+        }
+        else if (arg == "--threads")
+            valid = std::sscanf(value.c_str(), "%zu", &options.threads) == 1;
+        else if (arg == "--cache-mb")
+            valid = std::sscanf(value.c_str(), "%zu", &options.cacheMB) == 1;
+        else if (arg == "--trace")
+            options.trace = value;
+        else if (arg == "--progressive")
+            valid = std::sscanf(value.c_str(), "%f", &options.progressive) == 1 && options.progressive >= 0.0f;
+        else if (arg == "--path-trace")
+            valid = std::sscanf(value.c_str(), "%zu", &options.pathSamples) == 1;
+        else
+            valid = false;
+
+        if (!valid)
+        {
+            std::cerr << "[Headless] Bad argument " << arg << " " << value << "\n" << Usage;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+HeadlessTracer::HeadlessTracer(const Options& options)
+    : options(options), threadPool(options.threads), renderer(&threadPool, options.width, options.height), pathTracer(&threadPool, options.width, options.height)
+{
+    Profiler::SetThreadName("Main");
+
+    renderer.progressive.threshold = options.progressive;
+
+    LoadScene();
+    LoadCameraPath();
+}
+
+HeadlessTracer::~HeadlessTracer()
+{
+    delete scene;
+    delete paged;
+}
+
+void HeadlessTracer::LoadScene()
+{
+    if (options.scene.empty())
+    {
+        scene = CreateDemoScene();
+        pathTracer.materials = DemoMaterials();
+        return;
+    }
+
+    std::string ext = Extension(options.scene);
+
+    if (ext == "gltf" || ext == "glb")
+    {
+        Model model = LoadModelCached(options.scene, &threadPool);
+        Voxelizer::Result result = Voxelizer::Voxelize(model.meshes.data(), model.meshes.size(), options.resolution, &threadPool);
+
+        scene = result.scene;
+        worldOrigin = result.origin;
+        worldScale = result.scale;
+
+        // Voxel materials are off by one, 0 is EmptyVoxel
+        pathTracer.materials.assign(1, Material());
+        pathTracer.materials.insert(pathTracer.materials.end(), model.materials.begin(), model.materials.end());
+
+        std::cout << "[Headless] Voxelized " << result.triangles << " triangles in " << result.seconds << "s, "
+            << scene->SolidVoxels() << " voxels" << std::endl;
+        return;
+    }
+
+    paged = new PagedVoxelScene(options.scene, options.cacheMB << 20);
+}
+
+void HeadlessTracer::LoadCameraPath()
+{
+    if (options.cameraPath.empty()) return;
+
+    std::ifstream file(options.cameraPath);
+    if (!file)
+    {
+        std::cerr << "[Headless] Can't open camera path " << options.cameraPath << std::endl;
+        throw ErrorCode::ASSET_LOAD_FAILED;
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream in(line);
+        Keyframe k;
+        k.fov = 60.0f;
+
+        if (!(in >> k.position.x >> k.position.y >> k.position.z >> k.forward.x >> k.forward.y >> k.forward.z))
+        {
+            std::cerr << "[Headless] Skipping unreadable keyframe on line " << lineNumber << " of " << options.cameraPath << std::endl;
+            continue;
+        }
+        in >> k.fov;
+
+        // Normalizing a zero direction gives NaN, which would poison every pixel of the frame
+        Float length = glm::length(k.forward);
+        if (!(length > 0.0f) || !std::isfinite(length))
+        {
+            std::cerr << "[Headless] Skipping keyframe without a forward direction on line " << lineNumber << " of " << options.cameraPath << std::endl;
+            continue;
+        }
+
+        k.position = (k.position - worldOrigin) * worldScale;
+        k.forward /= length;
+        keyframes.push_back(k);
+    }
+
+    if (keyframes.empty())
+    {
+        std::cerr << "[Headless] No keyframes in " << options.cameraPath << std::endl;
+        throw ErrorCode::ASSET_LOAD_FAILED;
+    }
+}
+
+Camera HeadlessTracer::CameraAt(size_t frame, size_t numFrames) const
+{
+    if (keyframes.empty())
+        return DefaultCamera(paged ? paged->Size() : scene->Size());
+
+    // Linear between keyframes, the frames span the whole path
+    Float t = numFrames > 1 ? Float(frame) / Float(numFrames - 1) * Float(keyframes.size() - 1) : 0.0f;
+    size_t k = glm::min(size_t(t), keyframes.size() - 1);
+    size_t next = glm::min(k + 1, keyframes.size() - 1);
+    Float f = t - Float(k);
+
+    Camera camera;
+    camera.position = glm::mix(keyframes[k].position, keyframes[next].position, f);
+    camera.forward = glm::normalize(glm::mix(keyframes[k].forward, keyframes[next].forward, f));
+    camera.fov = glm::mix(keyframes[k].fov, keyframes[next].fov, f);
+
+    return camera;
+}
+
+template <typename SceneT>
+void HeadlessTracer::Converge(const SceneT& sc, const Camera& camera)
+{
+    do
+    {
+        renderer.RenderProgressive(sc, camera);
+    } while (!renderer.GetStats().converged);
+
+    const Renderer::Stats& stats = renderer.GetStats();
+    std::cout << "[Headless] Converged at " << double(stats.accumulatedRays) / double(renderer.Width() * renderer.Height())
+        << " samples per pixel on average, " << stats.maxSamples << " at most" << std::endl;
+}
+
+template <typename SceneT>
+void HeadlessTracer::PathTrace(const SceneT& sc, const Camera& camera)
+{
+    pathTracer.RestartAccumulation();
+
+    double ms = 0.0;
+    for (size_t s = 0; s < options.pathSamples; s++)
+    {
+        pathTracer.Render(sc, camera);
+        ms += pathTracer.GetStats().frameMs;
+    }
+
+    std::cout << "[Headless] Path traced " << options.pathSamples << " samples per pixel in " << ms << "ms" << std::endl;
+}
+
+void HeadlessTracer::RenderFrame(const BrickMapScene& sc, const Camera& camera)
+{
+    if (options.pathSamples)
+        PathTrace(sc, camera);
+    else if (options.progressive > 0.0f)
+        Converge(sc, camera);
+    else
+        renderer.Render(sc, camera);
+}
+
+void HeadlessTracer::RenderFrame(PagedVoxelScene& sc, const Camera& camera)
+{
+    // Offline frames wait for the chunks they cross rather than keeping the coarse LOD. Every pass
+    // can reveal chunks that were hidden behind LOD hits, so go on until nothing is missed or the
+    // cache stops taking new chunks.
+    for (int pass = 0; pass < MaxPagingPasses; pass++)
+    {
+        PagedVoxelScene::Stats before = sc.GetStats();
+        renderer.Render(sc, camera);
+
+        if (sc.GetStats().misses == before.misses) break;
+
+        sc.Flush();
+        if (sc.GetStats().loads == before.loads) break;
+    }
+
+    // The resident set holds still until Update(), so every sample sees the same chunks
+    if (options.pathSamples)
+        PathTrace(sc, camera);
+    else if (options.progressive > 0.0f)
+        Converge(sc, camera);
+
+    sc.Update();
+}
+
+template <typename SceneT>
+int HeadlessTracer::RenderFrames(SceneT& sc)
+{
+    size_t numFrames = options.frames ? options.frames : glm::max(keyframes.size(), size_t(1));
+
+    for (size_t frame = 0; frame < numFrames; frame++)
+    {
+        Profiler::BeginFrame();
+
+        RenderFrame(sc, CameraAt(frame, numFrames));
+
+        char path[1024];
+        std::snprintf(path, sizeof(path), options.output.c_str(), int(frame));
+
+        if (!WriteImage(path))
+        {
+            std::cerr << "[Headless] Failed to write " << path << std::endl;
+            return 1;
+        }
+
+        double frameMs = options.pathSamples ? pathTracer.GetStats().frameMs : renderer.GetStats().frameMs;
+        double megaRaysPerSecond = options.pathSamples ? pathTracer.GetStats().megaRaysPerSecond : renderer.GetStats().megaRaysPerSecond;
+        std::cout << "[Headless] Frame " << frame + 1 << "/" << numFrames << ": " << frameMs << "ms, "
+            << megaRaysPerSecond << " Mrays/s -> " << path << std::endl;
+    }
+
+    Profiler::BeginFrame();
+
+    if (!options.trace.empty() && !Profiler::WriteChromeTrace(options.trace))
+    {
+        std::cerr << "[Headless] Failed to write " << options.trace << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool HeadlessTracer::WriteImage(const std::string& path) const
+{
+    PROFILE_FUNCTION();
+
+    int w = int(renderer.Width());
+    int h = int(renderer.Height());
+    const Vec4* pixels = options.pathSamples ? pathTracer.Framebuffer() : renderer.Framebuffer();
+
+    // The framebuffer starts at the bottom row, images at the top
+    stbi_flip_vertically_on_write(1);
+
+    std::string ext = Extension(path);
+    if (ext == "hdr")
+        return stbi_write_hdr(path.c_str(), w, h, 4, &pixels[0].x) != 0;
+
+    std::vector<uint8_t> image(size_t(w) * size_t(h) * 4);
+    for (size_t i = 0; i < size_t(w) * size_t(h); i++)
+    {
+        Vec4 c = glm::clamp(pixels[i], Vec4(0.0f), Vec4(1.0f)) * 255.0f + 0.5f;
+        image[i * 4 + 0] = uint8_t(c.x);
+        image[i * 4 + 1] = uint8_t(c.y);
+        image[i * 4 + 2] = uint8_t(c.z);
+        image[i * 4 + 3] = 255;
+    }
+
+    if (ext == "png") return stbi_write_png(path.c_str(), w, h, 4, image.data(), w * 4) != 0;
+    if (ext == "bmp") return stbi_write_bmp(path.c_str(), w, h, 4, image.data()) != 0;
+    if (ext == "tga") return stbi_write_tga(path.c_str(), w, h, 4, image.data()) != 0;
+    if (ext == "jpg" || ext == "jpeg") return stbi_write_jpg(path.c_str(), w, h, 4, image.data(), 95) != 0;
+
+    std::cerr << "[Headless] Unknown image format ." << ext << std::endl;
+    return false;
+}
+
+int HeadlessTracer::run()
+{
+    if (paged) return RenderFrames(*paged);
+    return RenderFrames(*scene);
+}
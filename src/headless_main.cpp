@@ -0,0 +1,27 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Headless Renderer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include <iostream>
+
+#include "headless.h"
+
+int main(int argc, char** argv)
+{
+    HeadlessTracer::Options options;
+    if (!HeadlessTracer::ParseArguments(argc, argv, options))
+        return 1;
+
+    try
+    {
+        HeadlessTracer tracer(options);
+
+        return tracer.run();
+    }
+    catch (ErrorCode e)
+    {
+        std::cerr << "[Error] " << e << std::endl;
+        return -1;
+    }
+}
@@ -0,0 +1,346 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Wavefront Path Tracer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "pathtracer.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const Float Pi = 3.14159265f;
+
+// PCG hash step, uniform in [0, 1)
+static inline Float Random(UInt& state)
+{
+    state = state * 747796405u + 2891336453u;
+    UInt word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return Float(((word >> 22u) ^ word) >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline UInt Seed(UInt pixel, UInt frame)
+{
+    UInt h = pixel * 0x9E3779B9u ^ frame * 0x85EBCA6Bu;
+    h = (h ^ (h >> 16)) * 0x45d9f3bu;
+    h = (h ^ (h >> 16)) * 0x45d9f3bu;
+    return h ^ (h >> 16);
+}
+
+// Cosine distributed around n
+static inline Vec3 CosineDirection(Vec3 n, Float u1, Float u2)
+{
+    Float phi = 2.0f * Pi * u1;
+    Float cosTheta = std::sqrt(u2);
+    Float sinTheta = std::sqrt(1.0f - u2);
+
+    Vec3 t = glm::normalize(glm::cross(std::fabs(n.x) > 0.5f ? Vec3(0.0f, 1.0f, 0.0f) : Vec3(1.0f, 0.0f, 0.0f), n));
+    Vec3 b = glm::cross(n, t);
+
+    return glm::normalize(t * (std::cos(phi) * sinTheta) + b * (std::sin(phi) * sinTheta) + n * cosTheta);
+}
+
+PathTracer::PathTracer(ThreadPool* pool, size_t width, size_t height)
+    : pool(pool)
+{
+    Resize(width, height);
+}
+
+void PathTracer::Resize(size_t width, size_t height)
+{
+    this->width = width;
+    this->height = height;
+    framebuffer.assign(width * height, Vec4(0.0f));
+    accumulating = false;
+}
+
+void PathTracer::RestartAccumulation()
+{
+    accumulation.assign(width * height, Vec3(0.0f));
+    stats.samples = 0;
+    accumulating = true;
+}
+
+void PathTracer::BeginFrame(const Camera& camera, uint64_t sceneVersion)
+{
+    if (!accumulating || camera != accumulatedCamera || sceneVersion != accumulatedVersion)
+    {
+        RestartAccumulation();
+        accumulatedCamera = camera;
+        accumulatedVersion = sceneVersion;
+    }
+
+    frameStart = std::chrono::steady_clock::now();
+
+    radiance.assign(width * height, Vec3(0.0f));
+    paths.clear();
+    paths.reserve(glm::max(settings.pathsInFlight, ChunkSize));
+    nextPixel = 0;
+
+    stats.extensionRays = 0;
+    stats.shadowRays = 0;
+    stats.waves = 0;
+}
+
+void PathTracer::EndFrame()
+{
+    PROFILE_ZONE("Accumulate");
+
+    frameIndex++;
+    stats.samples++;
+
+    size_t numPixels = width * height;
+    Float invSamples = 1.0f / Float(stats.samples);
+
+    pool->ParallelFor(NumChunks(numPixels), [&](size_t chunk)
+        {
+            for (size_t i = chunk * ChunkSize; i < glm::min((chunk + 1) * ChunkSize, numPixels); i++)
+            {
+                accumulation[i] += radiance[i];
+                framebuffer[i] = Vec4(accumulation[i] * invSamples, 1.0f);
+            }
+        });
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+    stats.frameMs = seconds * 1000.0;
+    stats.megaRaysPerSecond = double(stats.extensionRays + stats.shadowRays) / seconds * 1e-6;
+}
+
+bool PathTracer::Generate(const Camera& camera)
+{
+    PROFILE_ZONE("Generate");
+
+    size_t capacity = glm::max(settings.pathsInFlight, ChunkSize);
+    size_t first = paths.size();
+    size_t count = glm::min(first < capacity ? capacity - first : 0, width * height - nextPixel);
+
+    paths.resize(first + count);
+
+    Float aspect = Float(width) / Float(height);
+    size_t pixel0 = nextPixel;
+
+    pool->ParallelFor(NumChunks(count), [&](size_t chunk)
+        {
+            for (size_t i = chunk * ChunkSize; i < glm::min((chunk + 1) * ChunkSize, count); i++)
+            {
+                size_t pixel = pixel0 + i;
+                PathState& p = paths[first + i];
+
+                p.pixel = UInt(pixel);
+                p.rng = Seed(UInt(pixel), frameIndex);
+
+                Float u = (Float(pixel % width) + Random(p.rng)) / Float(width) * 2.0f - 1.0f;
+                Float v = (Float(pixel / width) + Random(p.rng)) / Float(height) * 2.0f - 1.0f;
+                Ray r = camera.GenerateRay(u, v, aspect);
+
+                p.origin = r.Origin;
+                p.direction = r.Direction;
+                p.bounce = 0;
+                p.throughput = Vec3(1.0f);
+                p.medium = NoMedium;
+            }
+        });
+
+    nextPixel += count;
+    return !paths.empty();
+}
+
+void PathTracer::SortHits()
+{
+    PROFILE_ZONE("Sort");
+
+    // Counting sort, stable so paths of a material keep their (roughly spatial) order
+    size_t chunks = NumChunks(paths.size());
+    size_t buckets = materials.size() + 2;
+    histograms.assign(chunks * buckets, 0);
+
+    pool->ParallelFor(chunks, [&](size_t chunk)
+        {
+            UInt* h = &histograms[chunk * buckets];
+            for (size_t i = chunk * ChunkSize; i < glm::min((chunk + 1) * ChunkSize, paths.size()); i++)
+                h[MaterialSlot(hits[i])]++;
+        });
+
+    // Bucket major offsets, so each material is one contiguous run across chunks
+    UInt sum = 0;
+    for (size_t b = 0; b < buckets; b++)
+    {
+        for (size_t c = 0; c < chunks; c++)
+        {
+            UInt n = histograms[c * buckets + b];
+            histograms[c * buckets + b] = sum;
+            sum += n;
+        }
+    }
+
+    shadeOrder.resize(paths.size());
+
+    pool->ParallelFor(chunks, [&](size_t chunk)
+        {
+            UInt* h = &histograms[chunk * buckets];
+            for (size_t i = chunk * ChunkSize; i < glm::min((chunk + 1) * ChunkSize, paths.size()); i++)
+                shadeOrder[h[MaterialSlot(hits[i])]++] = UInt(i);
+        });
+}
+
+void PathTracer::Shade()
+{
+    PROFILE_ZONE("Shade");
+
+    size_t chunks = NumChunks(paths.size());
+    nextPaths.resize(chunks * ChunkSize);
+    shadowRays.resize(chunks * ChunkSize);
+    nextCounts.assign(chunks, 0);
+    shadowCounts.assign(chunks, 0);
+
+    pool->ParallelFor(chunks, [&](size_t chunk)
+        {
+            PathState* next = &nextPaths[chunk * ChunkSize];
+            ShadowRay* shadow = &shadowRays[chunk * ChunkSize];
+            UInt numNext = 0;
+            UInt numShadow = 0;
+
+            // Paths come in runs of one material
+            UInt slot = UInt(-1);
+            Material m;
+            Float transmission = 0.0f;
+
+            for (size_t k = chunk * ChunkSize; k < glm::min((chunk + 1) * ChunkSize, paths.size()); k++)
+            {
+                UInt i = shadeOrder[k];
+                PathState p = paths[i];
+                const PathHit& h = hits[i];
+                Vec3& pixel = radiance[p.pixel];
+
+                if (h.t == MaxFloat)
+                {
+                    pixel += p.throughput * Sky(p.direction);
+                    continue;
+                }
+
+                if (MaterialSlot(h) != slot)
+                {
+                    slot = MaterialSlot(h);
+                    m = MaterialOf(h.material);
+                    transmission = glm::clamp((m.transmission.x + m.transmission.y + m.transmission.z) / 3.0f, 0.0f, 1.0f);
+                }
+
+                pixel += p.throughput * m.emission;
+
+                if (p.bounce >= settings.maxBounces) continue;
+
+                Vec3 position = p.origin + p.direction * h.t;
+                bool entering = p.medium != h.material;
+                Vec3 n = h.normal;
+                Vec3 albedo = Vec3(m.color);
+
+                if (Random(p.rng) < transmission)
+                {
+                    // Smooth dielectric, Schlick's Fresnel picks reflection or refraction
+                    Float eta = entering ? 1.0f / m.IOR : m.IOR;
+                    Float cosI = -glm::dot(n, p.direction);
+                    Float sin2T = eta * eta * (1.0f - cosI * cosI);
+
+                    Float fresnel = 1.0f;
+                    if (sin2T < 1.0f)
+                    {
+                        Float r0 = (1.0f - m.IOR) / (1.0f + m.IOR);
+                        r0 *= r0;
+                        Float c = 1.0f - (entering ? cosI : std::sqrt(1.0f - sin2T));
+                        fresnel = r0 + (1.0f - r0) * c * c * c * c * c;
+                    }
+
+                    if (Random(p.rng) < fresnel)
+                    {
+                        p.direction = glm::reflect(p.direction, n);
+                        p.origin = position + n * SurfaceOffset;
+                    }
+                    else
+                    {
+                        p.direction = glm::normalize(p.direction * eta + n * (eta * cosI - std::sqrt(1.0f - sin2T)));
+                        p.origin = position - n * SurfaceOffset;
+                        p.medium = entering ? h.material : NoMedium;
+                        p.throughput *= albedo;
+                    }
+
+                    p.throughput *= m.transmission / transmission;
+                }
+                else
+                {
+                    // Lambert, the sun is connected explicitly & the bounce is cosine distributed
+                    Vec3 weight = albedo * (Vec3(1.0f) - m.transmission) / (1.0f - transmission);
+                    p.origin = position + n * SurfaceOffset;
+
+                    Float cosSun = glm::dot(n, sunDirection);
+                    if (cosSun > 0.0f)
+                        shadow[numShadow++] = { p.origin, p.pixel, p.throughput * weight * sunIrradiance * (cosSun / Pi) };
+
+                    Float u1 = Random(p.rng);
+                    Float u2 = Random(p.rng);
+                    p.direction = CosineDirection(n, u1, u2);
+                    p.throughput *= weight;
+                }
+
+                p.bounce++;
+
+                // Russian roulette, survivors carry the energy of the terminated ones
+                if (p.bounce >= settings.rouletteBounces)
+                {
+                    Float survive = glm::min(glm::max(glm::max(p.throughput.x, p.throughput.y), p.throughput.z), 0.95f);
+                    if (Random(p.rng) >= survive) continue;
+
+                    p.throughput /= survive;
+                }
+
+                next[numNext++] = p;
+            }
+
+            nextCounts[chunk] = numNext;
+            shadowCounts[chunk] = numShadow;
+        });
+}
+
+void PathTracer::Compact()
+{
+    PROFILE_ZONE("Compact");
+
+    size_t chunks = nextCounts.size();
+    nextOffsets.resize(chunks);
+
+    size_t total = 0;
+    for (size_t c = 0; c < chunks; c++)
+    {
+        nextOffsets[c] = total;
+        total += nextCounts[c];
+    }
+
+    paths.resize(total);
+
+    pool->ParallelFor(chunks, [&](size_t chunk)
+        {
+            auto first = nextPaths.begin() + chunk * ChunkSize;
+            std::copy(first, first + nextCounts[chunk], paths.begin() + nextOffsets[chunk]);
+        });
+
+    stats.waves++;
+}
+
+Material PathTracer::MaterialOf(UInt id) const
+{
+    if (id < materials.size()) return materials[id];
+
+    // Diffuse in the Renderer's per id colors
+    UInt h = id * 2654435761u;
+
+    Material m = {};
+    m.color = Vec4(Vec3(Float((h >> 8) & 0xFF), Float((h >> 16) & 0xFF), Float((h >> 24) & 0xFF)) / 255.0f * 0.6f + Vec3(0.3f), 1.0f);
+    m.IOR = 1.5f;
+    m.texture0 = m.texture1 = m.texture2 = m.texture3 = NoTexture;
+    return m;
+}
+
+Vec3 PathTracer::Sky(Vec3 direction) const
+{
+    // Gradient of Renderer::Sky
+    Float t = glm::clamp(direction.y * 0.5f + 0.5f, 0.0f, 1.0f);
+    return glm::mix(Vec3(0.9f, 0.9f, 1.0f), Vec3(0.4f, 0.6f, 1.0f), t);
+}
@@ -0,0 +1,252 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - CPU Profiler
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+    struct ThreadBuffer
+    {
+        uint32_t id;
+        std::string name;                  // Guarded by the registry mutex
+        std::unique_ptr<Profiler::Event[]> events{ new Profiler::Event[Profiler::BufferEvents] };
+        std::atomic<uint64_t> written{ 0 }; // Events ever recorded, the ring holds the last BufferEvents
+        bool owned = true;                 // Guarded by the registry mutex
+    };
+
+    // Buffers outlive their threads so zones of finished threads still show up in traces, a new
+    // thread takes over the buffer of a finished one before another is allocated
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        std::vector<uint64_t> frames; // Frame starts, the last FrameHistory
+    };
+
+    Registry& GetRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    struct ThreadSlot
+    {
+        ThreadBuffer* buffer = nullptr;
+
+        ~ThreadSlot()
+        {
+            if (!buffer) return;
+
+            std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+            buffer->owned = false;
+        }
+    };
+
+    thread_local ThreadSlot threadSlot;
+    thread_local uint32_t threadDepth = 0;
+
+    ThreadBuffer& ForThread()
+    {
+        if (!threadSlot.buffer)
+        {
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            for (const std::unique_ptr<ThreadBuffer>& b : registry.buffers)
+            {
+                if (!b->owned)
+                {
+                    threadSlot.buffer = b.get();
+                    break;
+                }
+            }
+
+            if (!threadSlot.buffer)
+            {
+                registry.buffers.emplace_back(new ThreadBuffer());
+                threadSlot.buffer = registry.buffers.back().get();
+                threadSlot.buffer->id = uint32_t(registry.buffers.size() - 1);
+            }
+
+            threadSlot.buffer->owned = true;
+            threadSlot.buffer->name = "Thread " + std::to_string(threadSlot.buffer->id);
+        }
+
+        return *threadSlot.buffer;
+    }
+
+    // Oldest event of a ring written up to written that is safe to read. The slot of the event
+    // before it is the one the owner fills next, it may be half written at any time.
+    inline uint64_t FirstValid(uint64_t written)
+    {
+        return written >= Profiler::BufferEvents ? written + 1 - Profiler::BufferEvents : 0;
+    }
+
+    // Copy of the events of b still in its ring that ended after from, in completion order.
+    // Events complete in order of their end, so the copy walks back from the newest & stops at
+    // the first one that ended before from. Events overwritten during the copy are dropped,
+    // the owner only ever moves forward.
+    std::vector<Profiler::Event> Snapshot(const ThreadBuffer& b, uint64_t from)
+    {
+        uint64_t last = b.written.load(std::memory_order_acquire);
+        uint64_t first = last;
+
+        std::vector<Profiler::Event> events;
+        for (; first > FirstValid(last); first--)
+        {
+            const Profiler::Event& e = b.events[(first - 1) & (Profiler::BufferEvents - 1)];
+            if (e.end <= from) break;
+
+            events.push_back(e);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t valid = FirstValid(b.written.load(std::memory_order_relaxed));
+        if (valid > first)
+            events.resize(size_t(last - std::min(valid, last)));
+
+        std::reverse(events.begin(), events.end());
+        return events;
+    }
+
+    void WriteEscaped(std::ostream& out, const std::string& s)
+    {
+        out << '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\') out << '\\';
+            if (uint8_t(c) >= 0x20) out << c;
+        }
+        out << '"';
+    }
+}
+
+std::atomic<bool> Profiler::enabled{ true };
+
+std::chrono::steady_clock::time_point Profiler::Epoch()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+void Profiler::SetThreadName(const std::string& name)
+{
+    ThreadBuffer& b = ForThread();
+
+    std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+    b.name = name;
+}
+
+uint32_t Profiler::Enter()
+{
+    return threadDepth++;
+}
+
+void Profiler::Leave(const char* name, uint64_t start, uint32_t depth)
+{
+    uint64_t end = Now();
+    threadDepth = depth;
+
+    ThreadBuffer& b = ForThread();
+    uint64_t i = b.written.load(std::memory_order_relaxed);
+
+    b.events[i & (BufferEvents - 1)] = { name, start, end, depth };
+    b.written.store(i + 1, std::memory_order_release);
+}
+
+void Profiler::BeginFrame()
+{
+    uint64_t now = Now();
+
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    registry.frames.push_back(now);
+    if (registry.frames.size() > FrameHistory)
+        registry.frames.erase(registry.frames.begin());
+}
+
+bool Profiler::LastFrame(uint64_t& start, uint64_t& end)
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    size_t n = registry.frames.size();
+    if (n < 2) return false;
+
+    start = registry.frames[n - 2];
+    end = registry.frames[n - 1];
+    return true;
+}
+
+std::vector<Profiler::ThreadEvents> Profiler::Collect(uint64_t from, uint64_t to)
+{
+    std::vector<ThreadEvents> threads;
+
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    for (const std::unique_ptr<ThreadBuffer>& b : registry.buffers)
+    {
+        ThreadEvents t;
+        t.id = b->id;
+        t.name = b->name;
+
+        for (const Event& e : Snapshot(*b, from))
+        {
+            if (e.start < to) t.events.push_back(e);
+        }
+
+        if (!t.events.empty()) threads.push_back(std::move(t));
+    }
+
+    return threads;
+}
+
+bool Profiler::WriteChromeTrace(const std::string& path)
+{
+    std::vector<ThreadEvents> threads = Collect();
+
+    std::vector<uint64_t> frames;
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        frames = registry.frames;
+    }
+
+    std::ofstream out(path);
+    if (!out) return false;
+
+    // Timestamps are in microseconds, fractions keep the nanoseconds
+    auto us = [](uint64_t ns) { return std::to_string(ns / 1000) + "." + std::to_string(ns % 1000 + 1000).substr(1); };
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"VoxelTracer\"}}";
+
+    for (const ThreadEvents& t : threads)
+    {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t.id << ",\"args\":{\"name\":";
+        WriteEscaped(out, t.name);
+        out << "}}";
+
+        for (const Event& e : t.events)
+        {
+            out << ",\n{\"name\":";
+            WriteEscaped(out, e.name);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << t.id << ",\"ts\":" << us(e.start) << ",\"dur\":" << us(e.end - e.start) << "}";
+        }
+    }
+
+    for (uint64_t f : frames)
+        out << ",\n{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":" << us(f) << "}";
+
+    out << "\n]}\n";
+    return bool(out);
+}
@@ -4,42 +4,423 @@
 //  Cheng (Bob) Cao 2020
 
 #include "raytracing.h"
-#include "..\include\raytracing.h"
 
-Ray::Ray(Vec3 Direction, Float MinT, Float MaxT)
-    : Direction(Direction)
+#include <vector>
+
+Ray::Ray(Vec3 Origin, Vec3 Direction, Float MinT, Float MaxT)
+    : Origin(Origin)
+    , Direction(Direction)
     , InvDirection(Vec3(1.0) / Direction)
     , MinT(MinT)
     , MaxT(MaxT)
 {
 }
 
+template <RayTracing::AnyHitBehavior AnyHitFlag>
+static void TraceRayDynamic(RayTracing& rt, Scene* sc, Ray& r, void* payload)
+{
+    DynamicScene scene(sc);
+
+    // Kept from the handler based API: the closest hit handler runs whenever it is set
+    auto anyHit = [](const RayTracing& rt, const Ray& r, void* payload) { return rt.anyHitHandler(rt, r, payload); };
+    auto closestHit = [](const RayTracing& rt, const Ray& r, void* payload) { rt.cloestHitHandler(rt, r, payload); };
+
+    if (rt.cloestHitHandler)
+        rt.TraceRay<AnyHitFlag, RayTracing::ClosestHitBehavior::CALL_HANDLER>(scene, r, anyHit, closestHit, payload);
+    else
+        rt.TraceRay<AnyHitFlag, RayTracing::ClosestHitBehavior::RETURN>(scene, r, anyHit, closestHit, payload);
+}
+
 void RayTracing::TraceRay(Scene* sc, Ray& r, AnyHitBehavior anyHitFlag, ClosestHitBehavior closestHitFlag, void* payload)
 {
-    Scene::Context* ctx = sc->LaunchRay();
-    Ray tempRay = r;
+    switch (anyHitFlag)
+    {
+    case AnyHitBehavior::COMMIT_AND_CONTINUE:
+        TraceRayDynamic<AnyHitBehavior::COMMIT_AND_CONTINUE>(*this, sc, r, payload);
+        break;
+    case AnyHitBehavior::IGNORE_AND_CONTINUE:
+        TraceRayDynamic<AnyHitBehavior::IGNORE_AND_CONTINUE>(*this, sc, r, payload);
+        break;
+    case AnyHitBehavior::COMMIT_AND_RETURN:
+        TraceRayDynamic<AnyHitBehavior::COMMIT_AND_RETURN>(*this, sc, r, payload);
+        break;
+    case AnyHitBehavior::CALL_HANDLER:
+        // Without a handler no hit gets committed
+        if (anyHitHandler)
+            TraceRayDynamic<AnyHitBehavior::CALL_HANDLER>(*this, sc, r, payload);
+        else
+            TraceRayDynamic<AnyHitBehavior::IGNORE_AND_CONTINUE>(*this, sc, r, payload);
+        break;
+    }
+}
 
-    AnyHitBehavior anyhit = AnyHitBehavior::COMMIT_AND_CONTINUE;
-    bool hasHit = false;
+// Fallback packet traversal: one single ray context per lane
+class LanePacketContext : public Scene::Context
+{
+public:
+    ContextArena* arena;
+    Scene::Context* lanes[16] = {};
+    LaneMask exhausted = 0;
+
+    LanePacketContext(ContextArena* arena) : arena(arena) {}
+};
 
-    // An actually very powerful state machine
-    while (sc->NextIntersection(ctx, tempRay))
+template <int N>
+static LaneMask NextIntersectionPerLane(Scene* sc, Scene::Context* ctx, RayPacket<N>& p, LaneMask active)
+{
+    LanePacketContext* c = static_cast<LanePacketContext*>(ctx);
+    LaneMask hits = 0;
+
+    for (LaneMask m = active & ~c->exhausted; m; m &= m - 1)
     {
-        if (anyHitFlag == AnyHitBehavior::CALL_HANDLER && anyHitHandler)
-            anyhit = anyHitHandler(*this, tempRay, payload);
+        int lane = LowestLane(m);
+
+        if (!c->lanes[lane])
+            c->lanes[lane] = sc->LaunchRay(*c->arena);
+
+        Ray r = p.GetRay(lane);
+        if (sc->NextIntersection(c->lanes[lane], r))
+        {
+            p.MinT[lane] = r.MinT;
+            p.MaxT[lane] = r.MaxT;
+            p.PrimitiveID[lane] = r.PrimitiveID;
+            hits |= LaneMask(1) << lane;
+        }
         else
-            anyhit = anyHitFlag;
+        {
+            c->exhausted |= LaneMask(1) << lane;
+        }
+    }
+
+    return hits;
+}
+
+Scene::Context* Scene::LaunchRayPacket(ContextArena& arena, int width)
+{
+    return arena.New<LanePacketContext>(&arena);
+}
+
+LaneMask Scene::NextIntersectionPacket(Context* ctx, RayPacket4& p, LaneMask active)
+{
+    return NextIntersectionPerLane(this, ctx, p, active);
+}
+
+LaneMask Scene::NextIntersectionPacket(Context* ctx, RayPacket8& p, LaneMask active)
+{
+    return NextIntersectionPerLane(this, ctx, p, active);
+}
+
+LaneMask Scene::NextIntersectionPacket(Context* ctx, RayPacket16& p, LaneMask active)
+{
+    return NextIntersectionPerLane(this, ctx, p, active);
+}
+
+bool Scene::Occluded(const Ray& r)
+{
+    ContextArena& arena = ContextArena::ForThread();
+    ContextArena::Marker marker = arena.Mark();
+
+    Ray tempRay = r;
+    bool hit = NextIntersection(LaunchRay(arena), tempRay);
+
+    arena.Rewind(marker);
+    return hit;
+}
+
+template <int N>
+static LaneMask OccludedPacketTraversal(Scene* sc, const RayPacket<N>& p, LaneMask active)
+{
+    ContextArena& arena = ContextArena::ForThread();
+    ContextArena::Marker marker = arena.Mark();
+
+    Scene::Context* ctx = sc->LaunchRayPacket(arena, N);
+    RayPacket<N> tempPacket = p;
+
+    // Lanes are done with their first hit
+    LaneMask occluded = 0;
+    LaneMask hits;
+    while (active && (hits = sc->NextIntersectionPacket(ctx, tempPacket, active)))
+    {
+        occluded |= hits;
+        active &= ~hits;
+    }
+
+    arena.Rewind(marker);
+    return occluded;
+}
+
+LaneMask Scene::OccludedPacket(const RayPacket4& p, LaneMask active)
+{
+    return OccludedPacketTraversal(this, p, active);
+}
+
+LaneMask Scene::OccludedPacket(const RayPacket8& p, LaneMask active)
+{
+    return OccludedPacketTraversal(this, p, active);
+}
+
+LaneMask Scene::OccludedPacket(const RayPacket16& p, LaneMask active)
+{
+    return OccludedPacketTraversal(this, p, active);
+}
+
+template <int N>
+void RayTracing::TracePacket(Scene* sc, RayPacket<N>& p, LaneMask active, AnyHitBehavior anyHitFlag, ClosestHitBehavior closestHitFlag, void* const* payloads)
+{
+    ContextArena& arena = ContextArena::ForThread();
+    ContextArena::Marker marker = arena.Mark();
+
+    Scene::Context* ctx = sc->LaunchRayPacket(arena, N);
+    RayPacket<N> query = p;
+    RayPacket<N> tempPacket = p;
+
+    LaneMask hasHit = 0;
+    LaneMask hits;
+
+    // Same state machine as TraceRay, lanes leave the active set on COMMIT_AND_RETURN
+    while (active && (hits = sc->NextIntersectionPacket(ctx, tempPacket, active)))
+    {
+        for (; hits; hits &= hits - 1)
+        {
+            int lane = LowestLane(hits);
+            void* payload = payloads ? payloads[lane] : nullptr;
+
+            AnyHitBehavior anyhit = anyHitFlag;
+            if (anyHitFlag == AnyHitBehavior::CALL_HANDLER && anyHitHandler)
+                anyhit = anyHitHandler(*this, tempPacket.GetRay(lane), payload);
+
+            if (anyhit == AnyHitBehavior::COMMIT_AND_CONTINUE || anyhit == AnyHitBehavior::COMMIT_AND_RETURN)
+            {
+                p.MinT[lane] = tempPacket.MinT[lane];
+                p.MaxT[lane] = tempPacket.MaxT[lane];
+                p.PrimitiveID[lane] = tempPacket.PrimitiveID[lane];
+                hasHit |= LaneMask(1) << lane;
+
+                query.MaxT[lane] = tempPacket.MinT[lane];
+            }
+
+            if (anyhit == AnyHitBehavior::COMMIT_AND_RETURN)
+                active &= ~(LaneMask(1) << lane);
+
+            tempPacket.MinT[lane] = query.MinT[lane];
+            tempPacket.MaxT[lane] = query.MaxT[lane];
+        }
+    }
+
+    arena.Rewind(marker);
+
+    if (cloestHitHandler)
+    {
+        for (; hasHit; hasHit &= hasHit - 1)
+        {
+            int lane = LowestLane(hasHit);
+            cloestHitHandler(*this, p.GetRay(lane), payloads ? payloads[lane] : nullptr);
+        }
+    }
+}
+
+void RayTracing::TraceRayPacket(Scene* sc, RayPacket4& p, LaneMask active, AnyHitBehavior anyHitFlag, ClosestHitBehavior closestHitFlag, void* const* payloads)
+{
+    TracePacket(sc, p, active, anyHitFlag, closestHitFlag, payloads);
+}
+
+void RayTracing::TraceRayPacket(Scene* sc, RayPacket8& p, LaneMask active, AnyHitBehavior anyHitFlag, ClosestHitBehavior closestHitFlag, void* const* payloads)
+{
+    TracePacket(sc, p, active, anyHitFlag, closestHitFlag, payloads);
+}
+
+void RayTracing::TraceRayPacket(Scene* sc, RayPacket16& p, LaneMask active, AnyHitBehavior anyHitFlag, ClosestHitBehavior closestHitFlag, void* const* payloads)
+{
+    TracePacket(sc, p, active, anyHitFlag, closestHitFlag, payloads);
+}
+
+// Morton code of the (wrapped) origin cell, direction octant in the lowest 3 bits.
+// Origin locality matters most, splitting by octant first costs more than it gains.
+static inline UInt RayBinKey(const Ray& r, Float invCellSize)
+{
+    auto spread = [](UInt v)
+    {
+        v &= 0xFF;
+        v = (v | (v << 8)) & 0x0F00F00Fu;
+        v = (v | (v << 4)) & 0xC30C30C3u;
+        v = (v | (v << 2)) & 0x49249249u;
+        return v;
+    };
+
+    UInt octant = UInt(r.Direction.x < 0.0f) | (UInt(r.Direction.y < 0.0f) << 1) | (UInt(r.Direction.z < 0.0f) << 2);
+    glm::ivec3 cell = glm::ivec3(glm::floor(r.Origin * invCellSize));
+
+    return ((spread(UInt(cell.x)) | (spread(UInt(cell.y)) << 1) | (spread(UInt(cell.z)) << 2)) << 3) | octant;
+}
+
+// Sorts the rays by RayBinKey, order receives the permutation & keys the keys in sorted order
+static void BinRays(const Ray* rays, size_t count, Float cellSize, std::vector<UInt>& keys, std::vector<UInt>& order)
+{
+    const int RadixBits = 9;
+    const UInt RadixSize = 1 << RadixBits;
+
+    // Scratch is kept per thread so steady state batches do not allocate
+    thread_local std::vector<UInt> keysTemp, orderTemp;
+
+    keys.resize(count);
+    keysTemp.resize(count);
+    order.resize(count);
+    orderTemp.resize(count);
+
+    Float invCellSize = 1.0f / cellSize;
+    for (size_t i = 0; i < count; i++)
+    {
+        keys[i] = RayBinKey(rays[i], invCellSize);
+        order[i] = UInt(i);
+    }
 
-        if (anyhit == AnyHitBehavior::COMMIT_AND_CONTINUE || anyhit == AnyHitBehavior::COMMIT_AND_RETURN)
+    // LSD radix sort of the 27 bit keys, 3 passes of 9 bits
+    for (int pass = 0; pass < 3; pass++)
+    {
+        UInt shift = pass * RadixBits;
+        UInt histogram[RadixSize] = {};
+
+        for (size_t i = 0; i < count; i++)
+            histogram[(keys[i] >> shift) & (RadixSize - 1)]++;
+
+        UInt sum = 0;
+        for (UInt b = 0; b < RadixSize; b++)
+        {
+            UInt c = histogram[b];
+            histogram[b] = sum;
+            sum += c;
+        }
+
+        for (size_t i = 0; i < count; i++)
         {
-            r.MaxT = tempRay.MaxT;
-            r.MinT = tempRay.MinT;
-            hasHit = true;
+            UInt dst = histogram[(keys[i] >> shift) & (RadixSize - 1)]++;
+            keysTemp[dst] = keys[i];
+            orderTemp[dst] = order[i];
         }
-        
-        if (anyhit == AnyHitBehavior::COMMIT_AND_RETURN) break;
+
+        keys.swap(keysTemp);
+        order.swap(orderTemp);
+    }
+}
+
+// Full packets within one octant go down the packet path in batches
+static inline bool CoherentPacket(const std::vector<UInt>& keys, size_t i, int width)
+{
+    bool coherent = (i + width <= keys.size());
+    for (int lane = 1; coherent && lane < width; lane++)
+        coherent = ((keys[i + lane] ^ keys[i]) & 7) == 0;
+
+    return coherent;
+}
+
+void RayTracing::TraceRays(Scene* sc, Ray* rays, size_t count, AnyHitBehavior anyHitFlag, ClosestHitBehavior closestHitFlag, void* const* payloads)
+{
+    const int PacketWidth = 8;
+
+    thread_local std::vector<UInt> keys, order;
+    thread_local std::vector<Ray> sorted;
+    thread_local std::vector<void*> sortedPayloads;
+
+    BinRays(rays, count, batchCellSize, keys, order);
+
+    // Gather into a contiguous stream in binned order
+    sorted.clear();
+    for (size_t i = 0; i < count; i++)
+        sorted.push_back(rays[order[i]]);
+
+    if (payloads)
+    {
+        sortedPayloads.resize(count);
+        for (size_t i = 0; i < count; i++)
+            sortedPayloads[i] = payloads[order[i]];
     }
 
-    if (hasHit && cloestHitHandler)
-        cloestHitHandler(*this, r, payload);
+    // Full packets within one octant go down the packet path, the rest one by one
+    size_t i = 0;
+    while (i < count)
+    {
+        if (CoherentPacket(keys, i, PacketWidth))
+        {
+            RayPacket<PacketWidth> packet;
+            for (int lane = 0; lane < PacketWidth; lane++)
+                packet.SetRay(lane, sorted[i + lane]);
+
+            TraceRayPacket(sc, packet, AllLanes<PacketWidth>(), anyHitFlag, closestHitFlag, payloads ? &sortedPayloads[i] : nullptr);
+
+            for (int lane = 0; lane < PacketWidth; lane++)
+            {
+                sorted[i + lane].MinT = packet.MinT[lane];
+                sorted[i + lane].MaxT = packet.MaxT[lane];
+                sorted[i + lane].PrimitiveID = packet.PrimitiveID[lane];
+            }
+
+            i += PacketWidth;
+        }
+        else
+        {
+            TraceRay(sc, sorted[i], anyHitFlag, closestHitFlag, payloads ? sortedPayloads[i] : nullptr);
+            i++;
+        }
+    }
+
+    // Scatter results back to the original order
+    for (size_t i = 0; i < count; i++)
+    {
+        Ray& r = rays[order[i]];
+        r.MinT = sorted[i].MinT;
+        r.MaxT = sorted[i].MaxT;
+        r.PrimitiveID = sorted[i].PrimitiveID;
+    }
+}
+
+bool RayTracing::TraceOcclusion(Scene* sc, const Ray& r)
+{
+    return sc->Occluded(r);
+}
+
+LaneMask RayTracing::TraceOcclusionPacket(Scene* sc, const RayPacket4& p, LaneMask active)
+{
+    return sc->OccludedPacket(p, active);
+}
+
+LaneMask RayTracing::TraceOcclusionPacket(Scene* sc, const RayPacket8& p, LaneMask active)
+{
+    return sc->OccludedPacket(p, active);
+}
+
+LaneMask RayTracing::TraceOcclusionPacket(Scene* sc, const RayPacket16& p, LaneMask active)
+{
+    return sc->OccludedPacket(p, active);
+}
+
+void RayTracing::TraceOcclusions(Scene* sc, const Ray* rays, size_t count, bool* occluded)
+{
+    const int PacketWidth = 8;
+
+    thread_local std::vector<UInt> keys, order;
+    BinRays(rays, count, batchCellSize, keys, order);
+
+    // Results go straight to their original slot, there is nothing to gather back
+    size_t i = 0;
+    while (i < count)
+    {
+        if (CoherentPacket(keys, i, PacketWidth))
+        {
+            RayPacket<PacketWidth> packet;
+            for (int lane = 0; lane < PacketWidth; lane++)
+                packet.SetRay(lane, rays[order[i + lane]]);
+
+            LaneMask hits = sc->OccludedPacket(packet, AllLanes<PacketWidth>());
+
+            for (int lane = 0; lane < PacketWidth; lane++)
+                occluded[order[i + lane]] = (hits >> lane) & 1;
+
+            i += PacketWidth;
+        }
+        else
+        {
+            occluded[order[i]] = sc->Occluded(rays[order[i]]);
+            i++;
+        }
+    }
 }
@@ -0,0 +1,196 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - CPU Renderer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "renderer.h"
+
+#include <cmath>
+
+Ray Camera::GenerateRay(Float u, Float v, Float aspect) const
+{
+    Vec3 right = glm::normalize(glm::cross(forward, up));
+    Vec3 trueUp = glm::cross(right, forward);
+    Float tanHalfFov = std::tan(glm::radians(fov) * 0.5f);
+
+    Vec3 dir = glm::normalize(forward + right * (u * tanHalfFov * aspect) + trueUp * (v * tanHalfFov));
+    return Ray(position, dir);
+}
+
+bool Camera::operator==(const Camera& other) const
+{
+    return position == other.position && forward == other.forward && up == other.up && fov == other.fov;
+}
+
+Renderer::Renderer(ThreadPool* pool, size_t width, size_t height)
+    : pool(pool)
+{
+    Resize(width, height);
+}
+
+void Renderer::Resize(size_t width, size_t height)
+{
+    this->width = width;
+    this->height = height;
+    framebuffer.assign(width * height, Vec4(0.0f));
+    accumulating = false;
+}
+
+size_t Renderer::NumTiles() const
+{
+    return ((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize);
+}
+
+void Renderer::TileBounds(size_t tile, size_t& x0, size_t& y0, size_t& x1, size_t& y1) const
+{
+    size_t tilesX = (width + tileSize - 1) / tileSize;
+    x0 = (tile % tilesX) * tileSize;
+    y0 = (tile / tilesX) * tileSize;
+    x1 = glm::min(x0 + tileSize, width);
+    y1 = glm::min(y0 + tileSize, height);
+}
+
+void Renderer::BeginFrame()
+{
+    pool->ResetStats();
+    frameStart = std::chrono::steady_clock::now();
+}
+
+void Renderer::EndFrame(uint64_t rays)
+{
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - frameStart).count();
+
+    stats.frameMs = seconds * 1000.0;
+    stats.rays = rays;
+    stats.megaRaysPerSecond = double(rays) / seconds * 1e-6;
+
+    std::vector<ThreadPool::ThreadStats> threadStats = pool->GetStats();
+    stats.threadUtilization.resize(threadStats.size());
+    stats.threadSteals.resize(threadStats.size());
+    for (size_t i = 0; i < threadStats.size(); i++)
+    {
+        stats.threadUtilization[i] = threadStats[i].busySeconds / seconds;
+        stats.threadSteals[i] = threadStats[i].steals;
+    }
+}
+
+void Renderer::RestartAccumulation()
+{
+    accumulation.assign(width * height, Vec4(0.0f));
+    pixelSamples.assign(width * height, 0);
+    pixelError.assign(width * height, MaxFloat);
+    pixelActive.assign(width * height, 1);
+    tiles.assign(NumTiles(), TileState());
+    stats.accumulatedRays = 0;
+    accumulating = true;
+}
+
+void Renderer::SelectTiles(const Camera& camera, uint64_t sceneVersion)
+{
+    if (!accumulating || camera != accumulatedCamera || sceneVersion != accumulatedVersion)
+    {
+        RestartAccumulation();
+        accumulatedCamera = camera;
+        accumulatedVersion = sceneVersion;
+    }
+
+    // Errors only change while tracing, so tiles can look across their borders here
+    pool->ParallelFor(tiles.size(), [&](size_t tile) { SelectPixels(tile); });
+
+    activeTiles.clear();
+
+    for (size_t t = 0; t < tiles.size(); t++)
+    {
+        if (tiles[t].active) activeTiles.push_back(t);
+    }
+}
+
+void Renderer::SelectPixels(size_t tile)
+{
+    size_t x0, y0, x1, y1;
+    TileBounds(tile, x0, y0, x1, y1);
+
+    TileState& state = tiles[tile];
+    state.active = false;
+
+    UInt maxSamples = glm::max(progressive.maxSamples, 1u);
+
+    for (size_t y = y0; y < y1; y++)
+    {
+        for (size_t x = x0; x < x1; x++)
+        {
+            size_t pixel = y * width + x;
+
+            Float error = 0.0f;
+            for (size_t ny = (y > 0 ? y - 1 : y); ny <= glm::min(y + 1, height - 1); ny++)
+            {
+                for (size_t nx = (x > 0 ? x - 1 : x); nx <= glm::min(x + 1, width - 1); nx++)
+                    error = glm::max(error, pixelError[ny * width + nx]);
+            }
+
+            bool active = pixelSamples[pixel] < maxSamples && error > progressive.threshold;
+            pixelActive[pixel] = active;
+            state.active = state.active || active;
+        }
+    }
+}
+
+void Renderer::EndProgressiveFrame()
+{
+    uint64_t rays = 0;
+    for (size_t t : activeTiles)
+        rays += tiles[t].rays;
+
+    EndFrame(rays);
+
+    stats.activeTiles = activeTiles.size();
+    stats.accumulatedRays += rays;
+    stats.maxSamples = 0;
+    stats.converged = true;
+
+    for (const TileState& s : tiles)
+    {
+        stats.maxSamples = glm::max(stats.maxSamples, s.samples);
+        stats.converged = stats.converged && !s.active;
+    }
+}
+
+Vec2 Renderer::PixelJitter(size_t x, size_t y, UInt sample)
+{
+    // Hashed offset per pixel, then the R2 low discrepancy sequence
+    UInt h = UInt(x) * 73856093u ^ UInt(y) * 19349663u;
+    h = (h ^ (h >> 16)) * 0x45d9f3bu;
+    h = (h ^ (h >> 16)) * 0x45d9f3bu;
+    h ^= h >> 16;
+
+    Vec2 offset(Float(h & 0xFFFF) / 65536.0f, Float(h >> 16) / 65536.0f);
+    return glm::fract(offset + Float(sample) * Vec2(0.7548776662f, 0.5698402910f));
+}
+
+Float Renderer::PixelError(const Vec4& sum, UInt samples)
+{
+    if (samples < 2) return MaxFloat;
+
+    Float n = Float(samples);
+    Float mean = glm::dot(Vec3(sum), Vec3(0.2126f, 0.7152f, 0.0722f)) / n;
+    Float variance = glm::max((sum.w - mean * mean * n) / (n - 1.0f), 0.0f);
+
+    return std::sqrt(variance / n);
+}
+
+Vec4 Renderer::Sky(const Ray& r) const
+{
+    Float t = glm::clamp(r.Direction.y * 0.5f + 0.5f, 0.0f, 1.0f);
+    return Vec4(glm::mix(Vec3(0.9f, 0.9f, 1.0f), Vec3(0.4f, 0.6f, 1.0f), t), 1.0f);
+}
+
+Vec4 Renderer::Shade(const HitAttributes& attr) const
+{
+    // Stable color per material id
+    UInt h = attr.Material * 2654435761u;
+    Vec3 albedo = Vec3(Float((h >> 8) & 0xFF), Float((h >> 16) & 0xFF), Float((h >> 24) & 0xFF)) / 255.0f * 0.6f + Vec3(0.3f);
+
+    Float diffuse = glm::max(glm::dot(attr.Normal, sunDirection), 0.0f);
+    return Vec4(albedo * (0.25f + 0.75f * diffuse), 1.0f);
+}
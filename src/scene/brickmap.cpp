@@ -0,0 +1,140 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Brick Map
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/brickmap.h"
+
+BrickMapScene::BrickMapScene(IVec3 size)
+    : gridSize((size + IVec3(BrickSize - 1)) / BrickSize)
+{
+    this->size = gridSize * BrickSize;
+    grid.assign(size_t(gridSize.x) * size_t(gridSize.y) * size_t(gridSize.z), NullBrick);
+    dirty.assign(grid.size(), 0);
+}
+
+BrickMapScene::BrickMapScene(IVec3 size, const Voxel* voxels, size_t count)
+    : BrickMapScene(size)
+{
+    for (size_t i = 0; i < count; i++)
+        Set(voxels[i].position, voxels[i].material);
+}
+
+BrickMapScene::BrickMapScene(const VoxelGridScene& grid)
+    : BrickMapScene(grid.Size())
+{
+    IVec3 s = grid.Size();
+
+    for (Int z = 0; z < s.z; z++)
+    {
+        for (Int y = 0; y < s.y; y++)
+        {
+            for (Int x = 0; x < s.x; x++)
+            {
+                UInt m = grid.Get(IVec3(x, y, z));
+                if (m != EmptyVoxel) Set(IVec3(x, y, z), m);
+            }
+        }
+    }
+}
+
+UInt BrickMapScene::Get(IVec3 p) const
+{
+    UInt b = grid[GridIndex(p / BrickSize)];
+    if (b == NullBrick) return EmptyVoxel;
+
+    return materials[size_t(b) * BrickVoxels + LocalIndex(p % BrickSize)];
+}
+
+void BrickMapScene::Set(IVec3 p, UInt material)
+{
+    IVec3 cell = p / BrickSize;
+    size_t index = GridIndex(cell);
+    UInt& b = grid[index];
+
+    if (b == NullBrick)
+    {
+        if (material == EmptyVoxel) return;
+
+        b = UInt(bricks.size());
+        bricks.push_back(Brick());
+        materials.resize(materials.size() + BrickVoxels, EmptyVoxel);
+    }
+
+    IVec3 local = p % BrickSize;
+    uint64_t bit = 1ull << (local.x + local.y * BrickSize);
+
+    UInt& m = materials[size_t(b) * BrickVoxels + LocalIndex(local)];
+    if (m == material) return;
+
+    if (material == EmptyVoxel)
+        bricks[b].occupancy[local.z] &= ~bit;
+    else
+        bricks[b].occupancy[local.z] |= bit;
+
+    m = material;
+    version++;
+
+    if (!dirty[index])
+    {
+        dirty[index] = 1;
+        dirtyBricks.push_back(cell);
+    }
+}
+
+void BrickMapScene::ApplyEdits(const Voxel* edits, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (VoxelInside(edits[i].position, size)) Set(edits[i].position, edits[i].material);
+    }
+}
+
+void BrickMapScene::ClearDirty()
+{
+    for (IVec3 cell : dirtyBricks) dirty[GridIndex(cell)] = 0;
+    dirtyBricks.clear();
+}
+
+const UInt* BrickMapScene::BrickMaterials(IVec3 brick) const
+{
+    UInt b = grid[GridIndex(brick)];
+    return b == NullBrick ? nullptr : &materials[size_t(b) * BrickVoxels];
+}
+
+size_t BrickMapScene::SolidVoxels() const
+{
+    size_t count = 0;
+    for (const Brick& b : bricks)
+    {
+        for (uint64_t slice : b.occupancy)
+            count += PopCount(UInt(slice)) + PopCount(UInt(slice >> 32));
+    }
+    return count;
+}
+
+size_t BrickMapScene::MemoryUsage() const
+{
+    return grid.size() * sizeof(UInt) + bricks.size() * sizeof(Brick) + materials.size() * sizeof(UInt);
+}
+
+double BrickMapScene::BytesPerSolidVoxel() const
+{
+    size_t solid = SolidVoxels();
+    return solid ? double(MemoryUsage()) / double(solid) : 0.0;
+}
+
+HitAttributes BrickMapScene::GetHitAttributes(const Ray& r) const
+{
+    return { VoxelHitNormal(r), materials[r.PrimitiveID] };
+}
+
+Scene::Context* BrickMapScene::LaunchRay(ContextArena& arena)
+{
+    return arena.New<BrickMapContext>();
+}
+
+bool BrickMapScene::NextIntersection(Context* ctx, Ray& r)
+{
+    return Traverse(*static_cast<BrickMapContext*>(ctx), r);
+}
@@ -0,0 +1,396 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Triangle BVH
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/bvh.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "profiler.h"
+
+// Nodes above this many triangles build their children as separate tasks
+static const UInt ParallelBuildThreshold = 16 * 1024;
+
+// Nodes above this many triangles bin in parallel chunks
+static const UInt ParallelBinThreshold = 256 * 1024;
+static const UInt BinChunkSize = 64 * 1024;
+
+struct AABB
+{
+    Vec3 boundsMin = Vec3(MaxFloat);
+    Vec3 boundsMax = Vec3(-MaxFloat);
+
+    inline void Grow(Vec3 p)
+    {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+
+    inline void Grow(const AABB& b)
+    {
+        boundsMin = glm::min(boundsMin, b.boundsMin);
+        boundsMax = glm::max(boundsMax, b.boundsMax);
+    }
+
+    inline Float HalfArea() const
+    {
+        Vec3 e = glm::max(boundsMax - boundsMin, Vec3(0.0f));
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+struct Bins
+{
+    AABB bounds[3][BVHScene::NumBins];
+    UInt count[3][BVHScene::NumBins] = {};
+
+    inline void Merge(const Bins& b)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int i = 0; i < BVHScene::NumBins; i++)
+            {
+                bounds[axis][i].Grow(b.bounds[axis][i]);
+                count[axis][i] += b.count[axis][i];
+            }
+        }
+    }
+};
+
+static inline const Vertex& MeshVertex(const Mesh& m, UInt triangle, int corner)
+{
+    return m.vertices[m.vertexOffset + m.indicies[m.indexOffset + triangle * 3 + corner]];
+}
+
+BVHScene::BVHScene(const Mesh* meshes, size_t numMeshes, ThreadPool* pool)
+    : meshes(meshes, meshes + numMeshes)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    Build(pool);
+
+    auto end = std::chrono::steady_clock::now();
+    buildSeconds = std::chrono::duration<double>(end - start).count();
+}
+
+void BVHScene::Build(ThreadPool* pool)
+{
+    PROFILE_ZONE("BVH Build");
+
+    auto parallelFor = [pool](size_t count, const std::function<void(size_t)>& fn)
+    {
+        if (pool)
+            pool->ParallelFor(count, fn);
+        else
+            for (size_t i = 0; i < count; i++) fn(i);
+    };
+
+    for (UInt m = 0; m < UInt(meshes.size()); m++)
+    {
+        for (UInt t = 0; t < meshes[m].count / 3; t++)
+            sources.push_back({ m, t });
+    }
+
+    UInt numTriangles = UInt(sources.size());
+    UInt numChunks = (numTriangles + BinChunkSize - 1) / BinChunkSize;
+
+    std::vector<PrimRef> refs(numTriangles);
+    parallelFor(numChunks, [&](size_t chunk)
+    {
+        UInt end = glm::min(UInt(chunk + 1) * BinChunkSize, numTriangles);
+        for (UInt i = UInt(chunk) * BinChunkSize; i < end; i++)
+        {
+            const Mesh& m = meshes[sources[i].mesh];
+            AABB b;
+            for (int corner = 0; corner < 3; corner++)
+                b.Grow(MeshVertex(m, sources[i].triangle, corner).position);
+
+            refs[i] = { b.boundsMin, i, b.boundsMax, 0 };
+        }
+    });
+
+    // A binary tree with at least one triangle per leaf has at most 2n - 1 nodes
+    nodes.resize(glm::max(UInt(1), numTriangles * 2));
+    std::atomic<UInt> nodeCount{ 1 };
+
+    if (numTriangles > 0)
+    {
+        if (pool)
+        {
+            ThreadPool::TaskGroup group(*pool);
+            group.Run([&]() { BuildNode(pool, refs, 0, 0, numTriangles, 0, nodeCount); });
+            group.Wait();
+        }
+        else
+        {
+            BuildNode(nullptr, refs, 0, 0, numTriangles, 0, nodeCount);
+        }
+    }
+    else
+    {
+        nodes[0] = { Vec3(0.0f), 0, Vec3(0.0f), 0 };
+    }
+
+    nodes.resize(nodeCount.load());
+    nodes.shrink_to_fit();
+
+    // Leaf ordered copy of the positions, the only triangle data traversal touches
+    std::vector<TriangleSource> unordered;
+    unordered.swap(sources);
+    sources.resize(numTriangles);
+    triangles.resize(numTriangles);
+
+    parallelFor(numChunks, [&](size_t chunk)
+    {
+        UInt end = glm::min(UInt(chunk + 1) * BinChunkSize, numTriangles);
+        for (UInt i = UInt(chunk) * BinChunkSize; i < end; i++)
+        {
+            TriangleSource s = unordered[refs[i].index];
+            const Mesh& m = meshes[s.mesh];
+
+            Vec3 v0 = MeshVertex(m, s.triangle, 0).position;
+            Vec3 v1 = MeshVertex(m, s.triangle, 1).position;
+            Vec3 v2 = MeshVertex(m, s.triangle, 2).position;
+
+            triangles[i] = { v0, v1 - v0, v2 - v0 };
+            sources[i] = s;
+        }
+    });
+}
+
+void BVHScene::BuildNode(ThreadPool* pool, std::vector<PrimRef>& refs, UInt nodeIndex, UInt begin, UInt end, int depth, std::atomic<UInt>& nodeCount)
+{
+    UInt count = end - begin;
+
+    // Bounds of the triangles & of their centroids, which is what gets binned
+    auto gatherBounds = [&](UInt from, UInt to, AABB& bounds, AABB& centroids)
+    {
+        for (UInt i = from; i < to; i++)
+        {
+            bounds.Grow(refs[i].boundsMin);
+            bounds.Grow(refs[i].boundsMax);
+            centroids.Grow((refs[i].boundsMin + refs[i].boundsMax) * 0.5f);
+        }
+    };
+
+    UInt numChunks = (count + BinChunkSize - 1) / BinChunkSize;
+    bool parallel = pool && count > ParallelBinThreshold;
+
+    AABB bounds, centroids;
+    if (parallel)
+    {
+        std::vector<AABB> chunkBounds(numChunks), chunkCentroids(numChunks);
+        pool->ParallelFor(numChunks, [&](size_t chunk)
+        {
+            UInt from = begin + UInt(chunk) * BinChunkSize;
+            gatherBounds(from, glm::min(from + BinChunkSize, end), chunkBounds[chunk], chunkCentroids[chunk]);
+        });
+
+        for (UInt i = 0; i < numChunks; i++)
+        {
+            bounds.Grow(chunkBounds[i]);
+            centroids.Grow(chunkCentroids[i]);
+        }
+    }
+    else
+    {
+        gatherBounds(begin, end, bounds, centroids);
+    }
+
+    Node& node = nodes[nodeIndex];
+    node.boundsMin = bounds.boundsMin;
+    node.boundsMax = bounds.boundsMax;
+    node.leftFirst = begin;
+    node.count = count;
+
+    if (count <= MaxLeafSize || depth >= MaxDepth) return;
+
+    Vec3 extent = centroids.boundsMax - centroids.boundsMin;
+    Vec3 scale = Vec3(Float(NumBins)) / glm::max(extent, Vec3(1e-20f));
+
+    auto binOf = [&](const PrimRef& ref, int axis)
+    {
+        Float c = (ref.boundsMin[axis] + ref.boundsMax[axis]) * 0.5f;
+        return glm::min(int((c - centroids.boundsMin[axis]) * scale[axis]), NumBins - 1);
+    };
+
+    auto fillBins = [&](UInt from, UInt to, Bins& bins)
+    {
+        for (UInt i = from; i < to; i++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                int b = binOf(refs[i], axis);
+                bins.count[axis][b]++;
+                bins.bounds[axis][b].Grow(refs[i].boundsMin);
+                bins.bounds[axis][b].Grow(refs[i].boundsMax);
+            }
+        }
+    };
+
+    Bins bins;
+    if (parallel)
+    {
+        std::vector<Bins> chunkBins(numChunks);
+        pool->ParallelFor(numChunks, [&](size_t chunk)
+        {
+            UInt from = begin + UInt(chunk) * BinChunkSize;
+            fillBins(from, glm::min(from + BinChunkSize, end), chunkBins[chunk]);
+        });
+
+        for (const Bins& b : chunkBins)
+            bins.Merge(b);
+    }
+    else
+    {
+        fillBins(begin, end, bins);
+    }
+
+    // Sweep the bin boundaries, SAH cost relative to the parent with traversal cost 1
+    Float bestCost = MaxFloat;
+    int bestAxis = -1;
+    int bestSplit = 0;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] <= 0.0f) continue;
+
+        Float rightArea[NumBins];
+        UInt rightCount[NumBins];
+        AABB right;
+        UInt rightSum = 0;
+        for (int i = NumBins - 1; i > 0; i--)
+        {
+            right.Grow(bins.bounds[axis][i]);
+            rightSum += bins.count[axis][i];
+            rightArea[i] = right.HalfArea();
+            rightCount[i] = rightSum;
+        }
+
+        AABB left;
+        UInt leftSum = 0;
+        for (int i = 1; i < NumBins; i++)
+        {
+            left.Grow(bins.bounds[axis][i - 1]);
+            leftSum += bins.count[axis][i - 1];
+
+            if (leftSum == 0 || rightCount[i] == 0) continue;
+
+            Float cost = left.HalfArea() * Float(leftSum) + rightArea[i] * Float(rightCount[i]);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    UInt mid;
+    if (bestAxis < 0)
+    {
+        // All centroids in one spot, nothing for SAH to separate
+        if (count <= 4 * MaxLeafSize) return;
+        mid = begin + count / 2;
+    }
+    else
+    {
+        Float leafCost = Float(count);
+        Float splitCost = 1.0f + bestCost / bounds.HalfArea();
+        if (count <= 4 * MaxLeafSize && splitCost >= leafCost) return;
+
+        auto it = std::partition(refs.begin() + begin, refs.begin() + end, [&](const PrimRef& ref) { return binOf(ref, bestAxis) < bestSplit; });
+        mid = UInt(it - refs.begin());
+    }
+
+    UInt left = nodeCount.fetch_add(2, std::memory_order_relaxed);
+    node.leftFirst = left;
+    node.count = 0;
+
+    if (pool && count > ParallelBuildThreshold)
+    {
+        ThreadPool::TaskGroup group(*pool);
+        group.Run([=, &refs, &nodeCount]()
+        {
+            PROFILE_ZONE("BVH Subtree");
+            BuildNode(pool, refs, left, begin, mid, depth + 1, nodeCount);
+        });
+        BuildNode(pool, refs, left + 1, mid, end, depth + 1, nodeCount);
+        group.Wait();
+    }
+    else
+    {
+        BuildNode(pool, refs, left, begin, mid, depth + 1, nodeCount);
+        BuildNode(pool, refs, left + 1, mid, end, depth + 1, nodeCount);
+    }
+}
+
+size_t BVHScene::MemoryUsage() const
+{
+    return nodes.size() * sizeof(Node) + triangles.size() * sizeof(Triangle);
+}
+
+Scene::Context* BVHScene::LaunchRay(ContextArena& arena)
+{
+    return arena.New<BVHContext>();
+}
+
+bool BVHScene::NextIntersection(Context* ctx, Ray& r)
+{
+    return Traverse(*static_cast<BVHContext*>(ctx), r);
+}
+
+bool BVHScene::Occluded(const Ray& r)
+{
+    return TraverseOcclusion(r);
+}
+
+LaneMask BVHScene::OccludedPacket(const RayPacket4& p, LaneMask active)
+{
+    return OccludedPerLane(*this, p, active);
+}
+
+LaneMask BVHScene::OccludedPacket(const RayPacket8& p, LaneMask active)
+{
+    return OccludedPerLane(*this, p, active);
+}
+
+LaneMask BVHScene::OccludedPacket(const RayPacket16& p, LaneMask active)
+{
+    return OccludedPerLane(*this, p, active);
+}
+
+HitAttributes BVHScene::GetHitAttributes(const Ray& r) const
+{
+    const TriangleSource& s = sources[r.PrimitiveID];
+    return TriangleHitAttributes(meshes[s.mesh], triangles[r.PrimitiveID], s.triangle, r);
+}
+
+HitAttributes BVHScene::TriangleHitAttributes(const Mesh& m, const Triangle& tri, UInt triangle, const Ray& r)
+{
+    // Barycentrics of the hit point
+    Vec3 p = r.Origin + r.Direction * r.MinT - tri.v0;
+    Float d00 = glm::dot(tri.e1, tri.e1);
+    Float d01 = glm::dot(tri.e1, tri.e2);
+    Float d11 = glm::dot(tri.e2, tri.e2);
+    Float d20 = glm::dot(p, tri.e1);
+    Float d21 = glm::dot(p, tri.e2);
+    Float denom = d00 * d11 - d01 * d01;
+    Float v = denom != 0.0f ? (d11 * d20 - d01 * d21) / denom : 0.0f;
+    Float w = denom != 0.0f ? (d00 * d21 - d01 * d20) / denom : 0.0f;
+
+    const Vertex& a = MeshVertex(m, triangle, 0);
+    const Vertex& b = MeshVertex(m, triangle, 1);
+    const Vertex& c = MeshVertex(m, triangle, 2);
+
+    Vec3 n = a.normal * (1.0f - v - w) + b.normal * v + c.normal * w;
+    if (glm::dot(n, n) <= 0.0f) n = glm::cross(tri.e1, tri.e2);
+    n = glm::normalize(n);
+
+    // Two sided, shade the side the ray came from
+    if (glm::dot(n, r.Direction) > 0.0f) n = -n;
+
+    return { n, a.materialId };
+}
@@ -0,0 +1,184 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Wide Triangle BVH
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/bvh8.h"
+
+#include <chrono>
+#include <cmath>
+
+#include "profiler.h"
+
+static inline Float HalfArea(const BVHScene::Node& n)
+{
+    Vec3 e = glm::max(n.boundsMax - n.boundsMin, Vec3(0.0f));
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+BVH8Scene::BVH8Scene(const Mesh* meshes, size_t numMeshes, ThreadPool* pool)
+{
+    PROFILE_ZONE("BVH8 Build");
+
+    auto start = std::chrono::steady_clock::now();
+
+    BVHScene bvh(meshes, numMeshes, pool);
+
+    if (!bvh.triangles.empty())
+    {
+        PROFILE_ZONE("BVH8 Collapse");
+
+        root = bvh.nodes[0];
+        nodes.reserve(bvh.nodes.size() / 4);
+        links.reserve(bvh.nodes.size() / 4);
+        Collapse(bvh, 0);
+    }
+
+    // Collapsing keeps the leaves, so the leaf ordered triangles carry over as is
+    this->meshes.swap(bvh.meshes);
+    triangles.swap(bvh.triangles);
+    sources.swap(bvh.sources);
+
+    auto end = std::chrono::steady_clock::now();
+    buildSeconds = std::chrono::duration<double>(end - start).count();
+}
+
+UInt BVH8Scene::Collapse(const BVHScene& bvh, UInt bvhNode)
+{
+    // Open up the interior child with the largest area until all 8 slots are taken
+    UInt children[Width];
+    int numChildren = 0;
+
+    const BVHScene::Node& n = bvh.nodes[bvhNode];
+    if (n.count)
+    {
+        children[numChildren++] = bvhNode;
+    }
+    else
+    {
+        children[numChildren++] = n.leftFirst;
+        children[numChildren++] = n.leftFirst + 1;
+    }
+
+    while (numChildren < Width)
+    {
+        int best = -1;
+        Float bestArea = -1.0f;
+
+        for (int i = 0; i < numChildren; i++)
+        {
+            const BVHScene::Node& c = bvh.nodes[children[i]];
+            if (!c.count && HalfArea(c) > bestArea)
+            {
+                best = i;
+                bestArea = HalfArea(c);
+            }
+        }
+
+        if (best < 0) break;
+
+        UInt first = bvh.nodes[children[best]].leftFirst;
+        children[best] = first;
+        children[numChildren++] = first + 1;
+    }
+
+    UInt index = UInt(nodes.size());
+    nodes.emplace_back();
+    links.emplace_back();
+
+    // Smallest power of two step that lets 255 steps cover the node
+    Vec3 origin = n.boundsMin;
+    Vec3 extent = n.boundsMax - n.boundsMin;
+
+    Node quantized = {};
+    quantized.origin = origin;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int e = extent[axis] > 0.0f ? int(std::ceil(std::log2(extent[axis] / 255.0f))) : -126;
+        e = glm::clamp(e, -126, 127);
+        while (e < 127 && Exp2(e) * 255.0f < extent[axis]) e++;
+
+        quantized.exponent[axis] = int8_t(e);
+    }
+
+    NodeLinks l = {};
+
+    for (int i = 0; i < numChildren; i++)
+    {
+        const BVHScene::Node& c = bvh.nodes[children[i]];
+
+        // Round outwards so the quantized box always contains the child
+        for (int axis = 0; axis < 3; axis++)
+        {
+            Float step = Exp2(quantized.exponent[axis]);
+            int lo = int(std::floor((c.boundsMin[axis] - origin[axis]) / step));
+            int hi = int(std::ceil((c.boundsMax[axis] - origin[axis]) / step));
+
+            while (lo > 0 && origin[axis] + Float(lo) * step > c.boundsMin[axis]) lo--;
+            while (hi < 255 && origin[axis] + Float(hi) * step < c.boundsMax[axis]) hi++;
+
+            quantized.lo[axis][i] = uint8_t(glm::clamp(lo, 0, 255));
+            quantized.hi[axis][i] = uint8_t(glm::clamp(hi, 0, 255));
+        }
+
+        quantized.validMask |= uint8_t(1u << i);
+
+        if (c.count)
+        {
+            l.child[i] = c.leftFirst;
+            l.count[i] = c.count;
+        }
+        else
+        {
+            l.child[i] = Collapse(bvh, children[i]);
+            l.count[i] = 0;
+        }
+    }
+
+    nodes[index] = quantized;
+    links[index] = l;
+
+    return index;
+}
+
+size_t BVH8Scene::MemoryUsage() const
+{
+    return nodes.size() * sizeof(Node) + links.size() * sizeof(NodeLinks) + triangles.size() * sizeof(BVHScene::Triangle);
+}
+
+Scene::Context* BVH8Scene::LaunchRay(ContextArena& arena)
+{
+    return arena.New<BVH8Context>();
+}
+
+bool BVH8Scene::NextIntersection(Context* ctx, Ray& r)
+{
+    return Traverse(*static_cast<BVH8Context*>(ctx), r);
+}
+
+bool BVH8Scene::Occluded(const Ray& r)
+{
+    return TraverseOcclusion(r);
+}
+
+LaneMask BVH8Scene::OccludedPacket(const RayPacket4& p, LaneMask active)
+{
+    return OccludedPerLane(*this, p, active);
+}
+
+LaneMask BVH8Scene::OccludedPacket(const RayPacket8& p, LaneMask active)
+{
+    return OccludedPerLane(*this, p, active);
+}
+
+LaneMask BVH8Scene::OccludedPacket(const RayPacket16& p, LaneMask active)
+{
+    return OccludedPerLane(*this, p, active);
+}
+
+HitAttributes BVH8Scene::GetHitAttributes(const Ray& r) const
+{
+    const BVHScene::TriangleSource& s = sources[r.PrimitiveID];
+    return BVHScene::TriangleHitAttributes(meshes[s.mesh], triangles[r.PrimitiveID], s.triangle, r);
+}
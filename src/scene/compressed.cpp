@@ -0,0 +1,451 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Compressed Voxel Chunks
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/compressed.h"
+
+#include <algorithm>
+
+// Encoded chunks of one row of the chunk grid, offsets are local until assembled
+struct EncodedChunks
+{
+    std::vector<std::pair<size_t, CompressedVoxelScene::Chunk>> chunks; // Grid index & chunk
+    std::vector<UInt> palettes;
+    std::vector<uint32_t> rows;
+    std::vector<uint32_t> runWords;
+};
+
+static inline uint8_t PaletteBits(size_t paletteSize)
+{
+    if (paletteSize <= 2) return 1;
+    if (paletteSize <= 4) return 2;
+    if (paletteSize <= 16) return 4;
+    if (paletteSize <= 256) return 8;
+    return 16;
+}
+
+bool CompressedVoxelScene::EncodeChunk(const UInt* voxels, std::vector<UInt>& palette, Chunk& c,
+    std::vector<UInt>& palettes, std::vector<uint32_t>& rows, std::vector<uint32_t>& runWords)
+{
+    palette.clear();
+    palette.push_back(EmptyVoxel);
+
+    bool empty = true;
+    bool hasEmpty = false;
+    UInt last = EmptyVoxel;
+
+    for (Int i = 0; i < ChunkVoxels; i++)
+    {
+        UInt m = voxels[i];
+
+        if (m == EmptyVoxel)
+        {
+            hasEmpty = true;
+            continue;
+        }
+
+        empty = false;
+        if (m == last) continue;
+        last = m;
+
+        if (std::find(palette.begin() + 1, palette.end(), m) == palette.end())
+            palette.push_back(m);
+    }
+
+    if (empty) return false;
+
+    c = {};
+    c.paletteOffset = UInt(palettes.size());
+
+    if (!hasEmpty && palette.size() == 2)
+    {
+        c.paletteSize = 1;
+        c.uniform = 1;
+        palettes.push_back(palette[1]);
+        return true;
+    }
+
+    std::sort(palette.begin() + 1, palette.end());
+
+    c.paletteSize = uint16_t(palette.size());
+    c.bits = PaletteBits(palette.size());
+    c.rowOffset = UInt(rows.size());
+    c.runOffset = UInt(runWords.size());
+    palettes.insert(palettes.end(), palette.begin(), palette.end());
+
+    // Runs along x, values packed back to back across the rows of the chunk
+    UInt runs = 0;
+    for (Int r = 0; r < ChunkRows; r++)
+    {
+        uint32_t startMask = 0;
+        UInt firstRun = runs;
+        UInt previous = 0xFFFFFFFFu;
+
+        for (Int x = 0; x < ChunkSize; x++)
+        {
+            UInt m = voxels[r * ChunkSize + x];
+            if (x > 0 && m == previous) continue;
+            previous = m;
+
+            UInt index = UInt(std::lower_bound(palette.begin() + 1, palette.end(), m) - palette.begin());
+            if (m == EmptyVoxel) index = 0;
+
+            // Widths divide 32, a value starting a word never spills into the next
+            UInt bit = runs * c.bits;
+            if ((bit & 31) == 0) runWords.push_back(0);
+            runWords.back() |= index << (bit & 31);
+
+            startMask |= 1u << x;
+            runs++;
+        }
+
+        rows.push_back((firstRun << 16) | startMask);
+    }
+
+    return true;
+}
+
+template <typename SourceFn>
+void CompressedVoxelScene::Build(IVec3 sourceSize, ThreadPool* pool, const SourceFn& source)
+{
+    gridSize = (sourceSize + IVec3(ChunkSize - 1)) / ChunkSize;
+    size = gridSize * ChunkSize;
+    grid.assign(size_t(gridSize.x) * size_t(gridSize.y) * size_t(gridSize.z), NullChunk);
+
+    size_t numRows = size_t(gridSize.y) * size_t(gridSize.z);
+    std::vector<EncodedChunks> encoded(numRows);
+
+    auto encodeRow = [&](size_t row)
+    {
+        EncodedChunks& out = encoded[row];
+        IVec3 chunkCell(0, Int(row % size_t(gridSize.y)), Int(row / size_t(gridSize.y)));
+
+        std::vector<UInt> voxels(ChunkVoxels);
+        std::vector<UInt> palette;
+
+        for (chunkCell.x = 0; chunkCell.x < gridSize.x; chunkCell.x++)
+        {
+            IVec3 origin = chunkCell * ChunkSize;
+
+            for (Int i = 0; i < ChunkVoxels; i++)
+            {
+                IVec3 p = origin + IVec3(i % ChunkSize, i / ChunkSize % ChunkSize, i / ChunkRows);
+                bool inside = p.x < sourceSize.x && p.y < sourceSize.y && p.z < sourceSize.z;
+
+                voxels[i] = inside ? source(p) : EmptyVoxel;
+            }
+
+            Chunk c;
+            if (EncodeChunk(voxels.data(), palette, c, out.palettes, out.rows, out.runWords))
+                out.chunks.push_back({ GridIndex(chunkCell), c });
+        }
+    };
+
+    if (pool)
+    {
+        pool->ParallelFor(numRows, encodeRow);
+    }
+    else
+    {
+        for (size_t row = 0; row < numRows; row++) encodeRow(row);
+    }
+
+    // Concatenate in grid order
+    for (EncodedChunks& e : encoded)
+    {
+        UInt paletteBase = UInt(palettes.size());
+        UInt rowBase = UInt(rows.size());
+        UInt runBase = UInt(runWords.size());
+
+        for (auto& entry : e.chunks)
+        {
+            Chunk c = entry.second;
+            c.paletteOffset += paletteBase;
+            c.rowOffset += rowBase;
+            c.runOffset += runBase;
+
+            grid[entry.first] = UInt(chunks.size());
+            chunks.push_back(c);
+        }
+
+        palettes.insert(palettes.end(), e.palettes.begin(), e.palettes.end());
+        rows.insert(rows.end(), e.rows.begin(), e.rows.end());
+        runWords.insert(runWords.end(), e.runWords.begin(), e.runWords.end());
+
+        e = EncodedChunks();
+    }
+}
+
+CompressedVoxelScene::CompressedVoxelScene(const BrickMapScene& map, ThreadPool* pool)
+{
+    Build(map.Size(), pool, [&map](IVec3 p) { return map.Get(p); });
+}
+
+CompressedVoxelScene::CompressedVoxelScene(const VoxelGridScene& grid, ThreadPool* pool)
+{
+    Build(grid.Size(), pool, [&grid](IVec3 p) { return grid.Get(p); });
+}
+
+UInt CompressedVoxelScene::Get(IVec3 p) const
+{
+    UInt index = grid[GridIndex(p / ChunkSize)];
+    if (index == NullChunk) return EmptyVoxel;
+
+    const Chunk& c = chunks[index];
+    return palettes[c.paletteOffset + PaletteIndex(c, p % ChunkSize)];
+}
+
+void CompressedVoxelScene::DecodeChunk(UInt index, UInt* voxels) const
+{
+    if (index == NullChunk)
+    {
+        std::fill(voxels, voxels + ChunkVoxels, EmptyVoxel);
+        return;
+    }
+
+    const Chunk& c = chunks[index];
+    const UInt* palette = &palettes[c.paletteOffset];
+
+    if (c.uniform)
+    {
+        std::fill(voxels, voxels + ChunkVoxels, palette[0]);
+        return;
+    }
+
+    // Walk the runs of each row instead of looking every voxel up
+    const uint32_t* chunkRows = &rows[c.rowOffset];
+    const uint32_t* words = &runWords[c.runOffset];
+    UInt mask = (1u << c.bits) - 1u;
+
+    for (Int r = 0; r < ChunkRows; r++)
+    {
+        uint32_t row = chunkRows[r];
+        UInt run = (row >> 16) - 1;
+        UInt value = EmptyVoxel;
+
+        for (Int x = 0; x < ChunkSize; x++)
+        {
+            if ((row >> x) & 1)
+            {
+                UInt bit = ++run * c.bits;
+                value = palette[(words[bit >> 5] >> (bit & 31)) & mask];
+            }
+
+            voxels[r * ChunkSize + x] = value;
+        }
+    }
+}
+
+void CompressedVoxelScene::ApplyEdits(const Voxel* edits, size_t count)
+{
+    // Grid index & edit, stable sorted so the edits of a chunk stay in order
+    std::vector<std::pair<size_t, size_t>> order;
+    order.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (VoxelInside(edits[i].position, size)) order.push_back({ GridIndex(edits[i].position / ChunkSize), i });
+    }
+
+    std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<UInt> voxels(ChunkVoxels);
+    std::vector<UInt> palette;
+    std::vector<UInt> newPalette;
+    std::vector<uint32_t> newRows;
+    std::vector<uint32_t> newRunWords;
+
+    // Copies new data over the old slot if it fits, otherwise appends it
+    auto place = [this](auto& array, UInt offset, size_t capacity, const auto& data)
+    {
+        if (data.size() <= capacity)
+        {
+            std::copy(data.begin(), data.end(), array.begin() + offset);
+            garbageWords += capacity - data.size();
+            return offset;
+        }
+
+        garbageWords += capacity;
+        array.insert(array.end(), data.begin(), data.end());
+        return UInt(array.size() - data.size());
+    };
+
+    for (size_t begin = 0; begin < order.size();)
+    {
+        size_t cell = order[begin].first;
+        UInt index = grid[cell];
+
+        DecodeChunk(index, voxels.data());
+
+        size_t first = begin;
+        for (; begin < order.size() && order[begin].first == cell; begin++)
+        {
+            const Voxel& e = edits[order[begin].second];
+            IVec3 local = e.position % ChunkSize;
+            voxels[local.x + local.y * ChunkSize + local.z * ChunkRows] = e.material;
+        }
+
+        // Later edits may undo earlier ones, compare the outcome with the chunk as it is stored
+        bool changed = false;
+        for (size_t i = first; i < begin && !changed; i++)
+        {
+            const Voxel& e = edits[order[i].second];
+            IVec3 local = e.position % ChunkSize;
+            changed = voxels[local.x + local.y * ChunkSize + local.z * ChunkRows] != Get(e.position);
+        }
+
+        if (!changed) continue;
+
+        newPalette.clear();
+        newRows.clear();
+        newRunWords.clear();
+
+        Chunk c;
+        bool solid = EncodeChunk(voxels.data(), palette, c, newPalette, newRows, newRunWords);
+
+        Chunk old = {};
+        size_t oldRows = 0;
+        size_t oldRunWords = 0;
+
+        if (index != NullChunk)
+        {
+            old = chunks[index];
+            oldRows = old.uniform ? 0 : ChunkRows;
+            oldRunWords = old.uniform ? 0 : RunWordCount(old, &rows[old.rowOffset]);
+        }
+
+        if (!solid)
+        {
+            if (index != NullChunk)
+            {
+                garbageWords += old.paletteSize + oldRows + oldRunWords;
+                freeChunks.push_back(index);
+                grid[cell] = NullChunk;
+            }
+            continue;
+        }
+
+        c.paletteOffset = place(palettes, old.paletteOffset, old.paletteSize, newPalette);
+        c.rowOffset = place(rows, old.rowOffset, oldRows, newRows);
+        c.runOffset = place(runWords, old.runOffset, oldRunWords, newRunWords);
+
+        if (index == NullChunk)
+        {
+            if (freeChunks.empty())
+            {
+                index = UInt(chunks.size());
+                chunks.push_back(c);
+            }
+            else
+            {
+                index = freeChunks.back();
+                freeChunks.pop_back();
+            }
+
+            grid[cell] = index;
+        }
+
+        chunks[index] = c;
+    }
+}
+
+void CompressedVoxelScene::Compact()
+{
+    if (!garbageWords && freeChunks.empty()) return;
+
+    std::vector<Chunk> newChunks;
+    std::vector<UInt> newPalettes;
+    std::vector<uint32_t> newRows;
+    std::vector<uint32_t> newRunWords;
+
+    newChunks.reserve(NumChunks());
+
+    // Live chunks in grid order
+    for (UInt& index : grid)
+    {
+        if (index == NullChunk) continue;
+
+        Chunk c = chunks[index];
+        const uint32_t* chunkRows = c.uniform ? nullptr : &rows[c.rowOffset];
+        UInt numRunWords = RunWordCount(c, chunkRows);
+
+        newPalettes.insert(newPalettes.end(), &palettes[c.paletteOffset], &palettes[c.paletteOffset] + c.paletteSize);
+        c.paletteOffset = UInt(newPalettes.size() - c.paletteSize);
+
+        if (!c.uniform)
+        {
+            newRows.insert(newRows.end(), chunkRows, chunkRows + ChunkRows);
+            newRunWords.insert(newRunWords.end(), &runWords[c.runOffset], &runWords[c.runOffset] + numRunWords);
+            c.rowOffset = UInt(newRows.size() - ChunkRows);
+            c.runOffset = UInt(newRunWords.size() - numRunWords);
+        }
+
+        index = UInt(newChunks.size());
+        newChunks.push_back(c);
+    }
+
+    chunks.swap(newChunks);
+    palettes.swap(newPalettes);
+    rows.swap(newRows);
+    runWords.swap(newRunWords);
+
+    freeChunks.clear();
+    garbageWords = 0;
+}
+
+size_t CompressedVoxelScene::SolidVoxels() const
+{
+    size_t count = 0;
+
+    for (UInt index : grid)
+    {
+        if (index == NullChunk) continue;
+
+        const Chunk& c = chunks[index];
+        if (c.uniform)
+        {
+            count += ChunkVoxels;
+            continue;
+        }
+
+        for (Int i = 0; i < ChunkVoxels; i++)
+        {
+            if (PaletteIndex(c, IVec3(i % ChunkSize, i / ChunkSize % ChunkSize, i / ChunkRows)) != 0) count++;
+        }
+    }
+
+    return count;
+}
+
+size_t CompressedVoxelScene::MemoryUsage() const
+{
+    return grid.size() * sizeof(UInt) + chunks.size() * sizeof(Chunk) + palettes.size() * sizeof(UInt) +
+        rows.size() * sizeof(uint32_t) + runWords.size() * sizeof(uint32_t);
+}
+
+double CompressedVoxelScene::BytesPerSolidVoxel() const
+{
+    size_t solid = SolidVoxels();
+    return solid ? double(MemoryUsage()) / double(solid) : 0.0;
+}
+
+HitAttributes CompressedVoxelScene::GetHitAttributes(const Ray& r) const
+{
+    const Chunk& c = chunks[r.PrimitiveID / ChunkVoxels];
+
+    UInt local = r.PrimitiveID % ChunkVoxels;
+    IVec3 p(Int(local % ChunkSize), Int(local / ChunkSize % ChunkSize), Int(local / ChunkRows));
+
+    return { VoxelHitNormal(r), palettes[c.paletteOffset + PaletteIndex(c, p)] };
+}
+
+Scene::Context* CompressedVoxelScene::LaunchRay(ContextArena& arena)
+{
+    return arena.New<ChunkContext>();
+}
+
+bool CompressedVoxelScene::NextIntersection(Context* ctx, Ray& r)
+{
+    return Traverse(*static_cast<ChunkContext*>(ctx), r);
+}
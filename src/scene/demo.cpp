@@ -0,0 +1,56 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Demo Content
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/demo.h"
+
+#include <cmath>
+
+#include "profiler.h"
+
+BrickMapScene* CreateDemoScene()
+{
+    PROFILE_FUNCTION();
+
+    IVec3 size(256, 64, 256);
+    BrickMapScene* sc = new BrickMapScene(size);
+
+    for (int z = 0; z < size.z; z++)
+    {
+        for (int x = 0; x < size.x; x++)
+        {
+            float h = 16.0f + 8.0f * sin(x * 0.05f) * cos(z * 0.07f) + 4.0f * sin((x + z) * 0.13f);
+
+            for (int y = 0; y < int(h); y++)
+                sc->Set(IVec3(x, y, z), (y < int(h) - 3) ? 1 : 2);
+        }
+    }
+
+    sc->ClearDirty();
+    return sc;
+}
+
+std::vector<Material> DemoMaterials()
+{
+    auto diffuse = [](Vec3 color)
+    {
+        Material m = {};
+        m.color = Vec4(color, 1.0f);
+        m.IOR = 1.5f;
+        m.texture0 = m.texture1 = m.texture2 = m.texture3 = NoTexture;
+        return m;
+    };
+
+    // EmptyVoxel, soil, grass
+    return { diffuse(Vec3(0.0f)), diffuse(Vec3(0.45f, 0.33f, 0.22f)), diffuse(Vec3(0.30f, 0.55f, 0.20f)) };
+}
+
+Camera DefaultCamera(IVec3 sceneSize)
+{
+    Camera camera;
+    camera.position = Vec3(-0.08f * sceneSize.x, 0.75f * sceneSize.y, -0.08f * sceneSize.z);
+    camera.forward = glm::normalize(Vec3(1.0f, -0.35f, 1.0f));
+
+    return camera;
+}
@@ -0,0 +1,311 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Sparse Voxel Octree
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/octree.h"
+
+#include <algorithm>
+
+SparseVoxelOctree::SparseVoxelOctree(UInt resolution, const Voxel* voxels, size_t count)
+{
+    while (this->resolution < resolution)
+    {
+        this->resolution <<= 1;
+        levels++;
+    }
+
+    Build(voxels, count);
+}
+
+SparseVoxelOctree::SparseVoxelOctree(const VoxelGridScene& grid)
+{
+    IVec3 size = grid.Size();
+    UInt maxSize = UInt(glm::max(glm::max(size.x, size.y), size.z));
+
+    while (resolution < maxSize)
+    {
+        resolution <<= 1;
+        levels++;
+    }
+
+    std::vector<Voxel> voxels;
+    voxels.reserve(grid.SolidVoxels());
+
+    for (Int z = 0; z < size.z; z++)
+    {
+        for (Int y = 0; y < size.y; y++)
+        {
+            for (Int x = 0; x < size.x; x++)
+            {
+                UInt m = grid.Get(IVec3(x, y, z));
+                if (m != EmptyVoxel) voxels.push_back({ IVec3(x, y, z), m });
+            }
+        }
+    }
+
+    Build(voxels.data(), voxels.size());
+}
+
+void SparseVoxelOctree::Build(const Voxel* voxels, size_t count)
+{
+    // Sort the stream into Morton order, children of a node then end up contiguous
+    std::vector<std::pair<uint64_t, UInt>> keys;
+    keys.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const Voxel& v = voxels[i];
+        if (v.material == EmptyVoxel) continue;
+        if (glm::any(glm::lessThan(v.position, IVec3(0))) || glm::any(glm::greaterThanEqual(v.position, IVec3(Int(resolution))))) continue;
+
+        keys.push_back({ MortonEncode(v.position), v.material });
+    }
+
+    // Stable, so the last write to a voxel wins
+    std::stable_sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    materials.clear();
+    std::vector<uint64_t> childKeys;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (i + 1 < keys.size() && keys[i + 1].first == keys[i].first) continue;
+
+        childKeys.push_back(keys[i].first);
+        materials.push_back(keys[i].second);
+    }
+    keys.clear();
+    keys.shrink_to_fit();
+
+    // Build bottom up, levelNodes[0] is the level right above the voxels
+    std::vector<std::vector<Node>> levelNodes(levels);
+    for (UInt level = 0; level < levelNodes.size(); level++)
+    {
+        std::vector<Node>& current = levelNodes[level];
+        std::vector<uint64_t> parentKeys;
+
+        for (size_t i = 0; i < childKeys.size(); i++)
+        {
+            uint64_t parent = childKeys[i] >> 3;
+            if (parentKeys.empty() || parentKeys.back() != parent)
+            {
+                parentKeys.push_back(parent);
+                current.push_back({ UInt(i), 0, { 0, 0, 0 } });
+            }
+            current.back().childMask |= uint8_t(1u << (childKeys[i] & 7));
+        }
+
+        childKeys.swap(parentKeys);
+    }
+
+    // Empty root keeps traversal branch free
+    if (levelNodes.back().empty())
+        levelNodes.back().push_back({ 0, 0, { 0, 0, 0 } });
+
+    // Flatten top down & turn per level child indices into global ones
+    nodes.clear();
+    std::vector<size_t> levelBase(levelNodes.size());
+    for (size_t level = levelNodes.size(); level-- > 0;)
+    {
+        levelBase[level] = nodes.size();
+        nodes.insert(nodes.end(), levelNodes[level].begin(), levelNodes[level].end());
+    }
+
+    for (size_t level = 1; level < levelNodes.size(); level++)
+    {
+        for (size_t i = 0; i < levelNodes[level].size(); i++)
+            nodes[levelBase[level] + i].firstChild += UInt(levelBase[level - 1]);
+    }
+}
+
+UInt SparseVoxelOctree::Get(IVec3 p) const
+{
+    if (glm::any(glm::lessThan(p, IVec3(0))) || glm::any(glm::greaterThanEqual(p, IVec3(Int(resolution)))))
+        return EmptyVoxel;
+
+    UInt index = 0;
+    for (Int shift = Int(levels) - 1; shift >= 0; shift--)
+    {
+        const Node& n = nodes[index];
+        int octant = ((p.x >> shift) & 1) | (((p.y >> shift) & 1) << 1) | (((p.z >> shift) & 1) << 2);
+
+        if (!(n.childMask & (1u << octant))) return EmptyVoxel;
+
+        index = ChildIndex(n, octant);
+    }
+
+    return materials[index];
+}
+
+void SparseVoxelOctree::ApplyEdits(const Voxel* edits, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (VoxelInside(edits[i].position, IVec3(Int(resolution)))) Edit(edits[i].position, edits[i].material);
+    }
+}
+
+void SparseVoxelOctree::Edit(IVec3 p, UInt material)
+{
+    UInt path[32];
+    int octants[32];
+
+    UInt index = 0;
+    for (Int shift = Int(levels) - 1; shift >= 0; shift--)
+    {
+        int depth = Int(levels) - 1 - shift;
+        int octant = ((p.x >> shift) & 1) | (((p.y >> shift) & 1) << 1) | (((p.z >> shift) & 1) << 2);
+
+        path[depth] = index;
+        octants[depth] = octant;
+
+        if (!(nodes[index].childMask & (1u << octant)))
+        {
+            if (material == EmptyVoxel) return;
+
+            // Grow the missing part of the path down to the voxel
+            for (; shift >= 0; shift--)
+            {
+                octant = ((p.x >> shift) & 1) | (((p.y >> shift) & 1) << 1) | (((p.z >> shift) & 1) << 2);
+                index = InsertChild(index, octant, shift == 0);
+            }
+
+            materials[index] = material;
+            return;
+        }
+
+        index = ChildIndex(nodes[index], octant);
+    }
+
+    if (material != EmptyVoxel)
+    {
+        materials[index] = material;
+        return;
+    }
+
+    // Drop the voxel & every node left without children, the root always stays
+    RemoveChild(path[levels - 1], octants[levels - 1], true);
+    for (Int depth = Int(levels) - 1; depth > 0 && !nodes[path[depth]].childMask; depth--)
+        RemoveChild(path[depth - 1], octants[depth - 1], false);
+}
+
+UInt SparseVoxelOctree::InsertChild(UInt node, int octant, bool leaf)
+{
+    Node n = nodes[node];
+    UInt count = PopCount(n.childMask);
+    UInt position = PopCount(UInt(n.childMask) & ((1u << octant) - 1u));
+
+    // Children have to stay contiguous, the block moves to the end with a gap for the new one.
+    // Blocks already at the end (often the one moved by the previous insert) just grow.
+    auto insert = [&](auto& array, auto empty)
+    {
+        UInt first = UInt(array.size());
+
+        if (count > 0 && n.firstChild + count == first)
+        {
+            array.push_back(empty);
+            std::copy_backward(array.begin() + n.firstChild + position, array.end() - 1, array.end());
+            array[n.firstChild + position] = empty;
+            return n.firstChild;
+        }
+
+        for (UInt i = 0; i < count + 1; i++)
+        {
+            auto child = (i == position) ? empty : array[n.firstChild + i - (i > position)];
+            array.push_back(child);
+        }
+
+        (leaf ? garbageMaterials : garbageNodes) += count;
+        return first;
+    };
+
+    UInt first = leaf ? insert(materials, EmptyVoxel) : insert(nodes, Node{ 0, 0, { 0, 0, 0 } });
+
+    nodes[node].firstChild = first;
+    nodes[node].childMask |= uint8_t(1u << octant);
+
+    return first + position;
+}
+
+void SparseVoxelOctree::RemoveChild(UInt node, int octant, bool leaf)
+{
+    Node& n = nodes[node];
+    UInt count = PopCount(n.childMask);
+    UInt position = PopCount(UInt(n.childMask) & ((1u << octant) - 1u));
+
+    // Close the gap in place, the last slot of the block becomes garbage
+    if (leaf)
+        std::copy(materials.begin() + n.firstChild + position + 1, materials.begin() + n.firstChild + count, materials.begin() + n.firstChild + position);
+    else
+        std::copy(nodes.begin() + n.firstChild + position + 1, nodes.begin() + n.firstChild + count, nodes.begin() + n.firstChild + position);
+
+    (leaf ? garbageMaterials : garbageNodes)++;
+    n.childMask &= uint8_t(~(1u << octant));
+}
+
+void SparseVoxelOctree::Compact()
+{
+    if (!garbageNodes && !garbageMaterials) return;
+
+    std::vector<Voxel> voxels;
+    voxels.reserve(SolidVoxels());
+
+    // Depth first walk collecting every voxel, then a regular build
+    struct Entry
+    {
+        UInt node;
+        Int size;
+        IVec3 origin;
+    };
+
+    std::vector<Entry> stack = { { 0, Int(resolution), IVec3(0) } };
+    while (!stack.empty())
+    {
+        Entry e = stack.back();
+        stack.pop_back();
+
+        const Node& n = nodes[e.node];
+        Int half = e.size >> 1;
+
+        for (int octant = 0; octant < 8; octant++)
+        {
+            if (!(n.childMask & (1u << octant))) continue;
+
+            IVec3 origin = e.origin + IVec3(octant & 1, (octant >> 1) & 1, (octant >> 2) & 1) * half;
+            if (half == 1)
+                voxels.push_back({ origin, materials[ChildIndex(n, octant)] });
+            else
+                stack.push_back({ ChildIndex(n, octant), half, origin });
+        }
+    }
+
+    garbageNodes = 0;
+    garbageMaterials = 0;
+    Build(voxels.data(), voxels.size());
+}
+
+size_t SparseVoxelOctree::MemoryUsage() const
+{
+    return nodes.size() * sizeof(Node) + materials.size() * sizeof(UInt);
+}
+
+double SparseVoxelOctree::BytesPerSolidVoxel() const
+{
+    size_t solid = SolidVoxels();
+    return solid ? double(MemoryUsage()) / double(solid) : 0.0;
+}
+
+HitAttributes SparseVoxelOctree::GetHitAttributes(const Ray& r) const
+{
+    return { VoxelHitNormal(r), materials[r.PrimitiveID] };
+}
+
+Scene::Context* SparseVoxelOctree::LaunchRay(ContextArena& arena)
+{
+    return arena.New<OctreeContext>();
+}
+
+bool SparseVoxelOctree::NextIntersection(Context* ctx, Ray& r)
+{
+    return Traverse(*static_cast<OctreeContext*>(ctx), r);
+}
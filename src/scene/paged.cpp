@@ -0,0 +1,425 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Paged Voxel World
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/paged.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "profiler.h"
+
+// Chunk file layout: header, chunk payloads, then one DirectoryEntry per grid cell in grid order.
+// A payload is uint32 words: palette size, bits | uniform << 8, run word count, the palette, the
+// ChunkRows rows (non uniform chunks only) & the run words.
+struct ChunkFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t chunkSize;
+    int32_t gridSize[3];
+    uint32_t reserved;
+    uint64_t directoryOffset;
+};
+
+static const char ChunkFileMagic[8] = "VTCHUNK";
+static const uint32_t PayloadHeaderWords = 3;
+
+bool PagedVoxelScene::WriteChunkFile(const CompressedVoxelScene& scene, const std::string& path)
+{
+    typedef CompressedVoxelScene::Chunk Chunk;
+
+    std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+
+    ChunkFileHeader header = {};
+    std::memcpy(header.magic, ChunkFileMagic, sizeof(header.magic));
+    header.version = FileVersion;
+    header.chunkSize = ChunkSize;
+    header.gridSize[0] = scene.gridSize.x;
+    header.gridSize[1] = scene.gridSize.y;
+    header.gridSize[2] = scene.gridSize.z;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<DirectoryEntry> directory(scene.grid.size(), DirectoryEntry{});
+    std::vector<uint32_t> payload;
+    std::vector<UInt> counts;
+    uint64_t offset = sizeof(header);
+
+    for (size_t cell = 0; cell < scene.grid.size(); cell++)
+    {
+        UInt index = scene.grid[cell];
+        if (index == CompressedVoxelScene::NullChunk) continue;
+
+        const Chunk& c = scene.chunks[index];
+        const UInt* palette = &scene.palettes[c.paletteOffset];
+        const uint32_t* rows = c.uniform ? nullptr : &scene.rows[c.rowOffset];
+
+        UInt numRunWords = CompressedVoxelScene::RunWordCount(c, rows);
+
+        payload.clear();
+        payload.push_back(c.paletteSize);
+        payload.push_back(UInt(c.bits) | (UInt(c.uniform) << 8));
+        payload.push_back(numRunWords);
+        payload.insert(payload.end(), palette, palette + c.paletteSize);
+        if (!c.uniform)
+        {
+            payload.insert(payload.end(), rows, rows + ChunkRows);
+            payload.insert(payload.end(), &scene.runWords[c.runOffset], &scene.runWords[c.runOffset] + numRunWords);
+        }
+
+        // Coarse LOD: solid 4^3 blocks & the most common material
+        DirectoryEntry& entry = directory[cell];
+        counts.assign(c.paletteSize, 0);
+
+        for (Int i = 0; i < ChunkVoxels; i++)
+        {
+            IVec3 local(i % ChunkSize, i / ChunkSize % ChunkSize, i / ChunkRows);
+            UInt p = c.uniform ? 0 : ChunkPaletteIndex(rows, &scene.runWords[c.runOffset], c.bits, local);
+            if (!c.uniform && p == 0) continue;
+
+            counts[p]++;
+            IVec3 block = local / LodCell;
+            entry.lodMask |= uint64_t(1) << (block.x + block.y * LodSize + block.z * LodSize * LodSize);
+        }
+
+        size_t common = std::max_element(counts.begin() + (c.uniform ? 0 : 1), counts.end()) - counts.begin();
+        entry.lodMaterial = palette[common];
+        entry.offset = offset;
+        entry.bytes = uint32_t(payload.size() * sizeof(uint32_t));
+
+        file.write(reinterpret_cast<const char*>(payload.data()), entry.bytes);
+        offset += entry.bytes;
+    }
+
+    header.directoryOffset = offset;
+    file.write(reinterpret_cast<const char*>(directory.data()), directory.size() * sizeof(DirectoryEntry));
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+
+    if (!file)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    std::remove(path.c_str());
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+PagedVoxelScene::PagedVoxelScene(const std::string& path, size_t byteBudget)
+    : byteBudget(byteBudget), path(path)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    ChunkFileHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!file || std::memcmp(header.magic, ChunkFileMagic, sizeof(header.magic)) != 0 ||
+        header.version != FileVersion || header.chunkSize != ChunkSize)
+    {
+        throw ErrorCode::ASSET_LOAD_FAILED;
+    }
+
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = uint64_t(file.tellg());
+
+    // Voxel coordinates fit Int & cell indices UInt, the directory has to be in the file
+    const int32_t MaxGridSize = std::numeric_limits<Int>::max() / ChunkSize;
+    for (int32_t g : header.gridSize)
+    {
+        if (g <= 0 || g > MaxGridSize) throw ErrorCode::ASSET_LOAD_FAILED;
+    }
+
+    gridSize = IVec3(header.gridSize[0], header.gridSize[1], header.gridSize[2]);
+    size = gridSize * ChunkSize;
+
+    size_t cells = size_t(gridSize.x) * size_t(gridSize.y) * size_t(gridSize.z);
+    if (cells > std::numeric_limits<UInt>::max() || header.directoryOffset > fileSize ||
+        cells > (fileSize - header.directoryOffset) / sizeof(DirectoryEntry))
+    {
+        throw ErrorCode::ASSET_LOAD_FAILED;
+    }
+
+    directory.resize(cells);
+
+    file.seekg(std::streamoff(header.directoryOffset));
+    file.read(reinterpret_cast<char*>(directory.data()), cells * sizeof(DirectoryEntry));
+    if (!file) throw ErrorCode::ASSET_LOAD_FAILED;
+
+    // Payloads are whole words between the header & the directory
+    for (const DirectoryEntry& entry : directory)
+    {
+        if (!entry.bytes) continue;
+
+        if (entry.bytes % sizeof(uint32_t) != 0 || entry.offset < sizeof(ChunkFileHeader) ||
+            entry.offset > header.directoryOffset || entry.bytes > header.directoryOffset - entry.offset)
+        {
+            throw ErrorCode::ASSET_LOAD_FAILED;
+        }
+    }
+
+    resident.assign(cells, nullptr);
+    requested.reset(new std::atomic<uint8_t>[cells]);
+    for (size_t i = 0; i < cells; i++) requested[i].store(0, std::memory_order_relaxed);
+
+    ioThread = std::thread(&PagedVoxelScene::IOLoop, this);
+}
+
+PagedVoxelScene::~PagedVoxelScene()
+{
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        stopping = true;
+    }
+
+    ioWake.notify_all();
+    ioThread.join();
+
+    for (UInt cell : residentCells) delete resident[cell];
+    for (auto& c : completed) delete c.second;
+}
+
+PagedVoxelScene::CounterShard& PagedVoxelScene::Shard(CounterShard* shards)
+{
+    static std::atomic<int> nextShard{ 0 };
+    thread_local int shard = nextShard.fetch_add(1, std::memory_order_relaxed) % NumShards;
+
+    return shards[shard];
+}
+
+void PagedVoxelScene::Request(UInt cell) const
+{
+    if (requested[cell].load(std::memory_order_relaxed) || requested[cell].exchange(1)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        pending.push_back(cell);
+    }
+
+    ioWake.notify_one();
+}
+
+PagedVoxelScene::ResidentChunk* PagedVoxelScene::ReadChunk(std::ifstream& file, UInt cell)
+{
+    PROFILE_ZONE("Read Chunk");
+
+    const DirectoryEntry& entry = directory[cell];
+
+    ResidentChunk* c = new ResidentChunk();
+    c->data.resize(entry.bytes / sizeof(uint32_t));
+
+    file.clear();
+    file.seekg(std::streamoff(entry.offset));
+    file.read(reinterpret_cast<char*>(c->data.data()), entry.bytes);
+
+    ioBytes.fetch_add(entry.bytes, std::memory_order_relaxed);
+
+    const uint32_t* words = c->data.data();
+    if (!file || c->data.size() < PayloadHeaderWords || !ValidPayload(words, c->data.size()))
+    {
+        delete c;
+        return nullptr;
+    }
+
+    c->bits = words[1] & 0xFF;
+    c->uniform = (words[1] >> 8) != 0;
+    c->palette = words + PayloadHeaderWords;
+    c->rows = c->palette + words[0];
+    c->runWords = c->rows + ChunkRows;
+    c->lastUsed.store(0, std::memory_order_relaxed);
+
+    return c;
+}
+
+bool PagedVoxelScene::ValidPayload(const uint32_t* words, size_t count)
+{
+    size_t paletteSize = words[0];
+    UInt bits = words[1] & 0xFF;
+    bool uniform = (words[1] >> 8) != 0;
+    size_t numRunWords = words[2];
+
+    if (uniform) return paletteSize >= 1 && count >= PayloadHeaderWords + paletteSize;
+
+    if (bits == 0 || bits > 16 || 32 % bits != 0 || paletteSize < 1 ||
+        count < PayloadHeaderWords + paletteSize + ChunkRows + numRunWords)
+        return false;
+
+    // Every row starts a run at x = 0 & counts the runs of the rows before it, as EncodeChunk writes them
+    const uint32_t* rows = words + PayloadHeaderWords + paletteSize;
+    const uint32_t* runWords = rows + ChunkRows;
+
+    UInt runs = 0;
+    for (Int r = 0; r < ChunkRows; r++)
+    {
+        if (!(rows[r] & 1u) || (rows[r] >> 16) != runs) return false;
+        runs += PopCount(rows[r] & 0xFFFFu);
+    }
+
+    if (numRunWords < (size_t(runs) * bits + 31) / 32) return false;
+
+    // Run values index the palette
+    for (UInt run = 0; run < runs; run++)
+    {
+        UInt bit = run * bits;
+        if (((runWords[bit >> 5] >> (bit & 31)) & ((1u << bits) - 1u)) >= paletteSize) return false;
+    }
+
+    return true;
+}
+
+void PagedVoxelScene::IOLoop()
+{
+    std::ifstream file(path, std::ios::binary);
+
+    Profiler::SetThreadName("Chunk I/O");
+
+    for (;;)
+    {
+        UInt cell;
+
+        {
+            std::unique_lock<std::mutex> lock(ioMutex);
+            ioWake.wait(lock, [this]() { return stopping || !pending.empty(); });
+            if (stopping) return;
+
+            cell = pending.front();
+            pending.pop_front();
+            reading = true;
+        }
+
+        // Failed reads stay requested, the chunk keeps tracing at its LOD
+        ResidentChunk* c = ReadChunk(file, cell);
+
+        {
+            std::lock_guard<std::mutex> lock(ioMutex);
+            if (c) completed.push_back({ cell, c });
+            reading = false;
+        }
+
+        ioIdle.notify_all();
+    }
+}
+
+void PagedVoxelScene::Update()
+{
+    PROFILE_ZONE("Paged Update");
+
+    frame++;
+
+    std::vector<std::pair<UInt, ResidentChunk*>> arrived;
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        arrived.swap(completed);
+    }
+
+    auto chunkBytes = [](const ResidentChunk* c) { return sizeof(ResidentChunk) + c->data.size() * sizeof(uint32_t); };
+
+    for (auto& a : arrived)
+    {
+        a.second->lastUsed.store(frame, std::memory_order_relaxed);
+        resident[a.first] = a.second;
+        residentCells.push_back(a.first);
+        residentBytes += chunkBytes(a.second);
+        loads++;
+    }
+
+    if (residentBytes <= byteBudget) return;
+
+    // Least recently used first, ties go to the older load
+    std::stable_sort(residentCells.begin(), residentCells.end(), [this](UInt a, UInt b)
+    {
+        return resident[a]->lastUsed.load(std::memory_order_relaxed) < resident[b]->lastUsed.load(std::memory_order_relaxed);
+    });
+
+    size_t evicted = 0;
+    while (residentBytes > byteBudget && evicted < residentCells.size())
+    {
+        UInt cell = residentCells[evicted++];
+
+        residentBytes -= chunkBytes(resident[cell]);
+        delete resident[cell];
+        resident[cell] = nullptr;
+        requested[cell].store(0, std::memory_order_relaxed);
+    }
+
+    residentCells.erase(residentCells.begin(), residentCells.begin() + evicted);
+    evictions += evicted;
+}
+
+void PagedVoxelScene::Flush()
+{
+    {
+        std::unique_lock<std::mutex> lock(ioMutex);
+        ioIdle.wait(lock, [this]() { return pending.empty() && !reading; });
+    }
+
+    Update();
+}
+
+PagedVoxelScene::Stats PagedVoxelScene::GetStats() const
+{
+    Stats s;
+
+    for (const CounterShard& shard : shards)
+    {
+        s.lookups += shard.lookups.load(std::memory_order_relaxed);
+        s.misses += shard.misses.load(std::memory_order_relaxed);
+    }
+
+    s.loads = loads;
+    s.evictions = evictions;
+    s.ioBytes = ioBytes.load(std::memory_order_relaxed);
+    s.residentChunks = residentCells.size();
+    s.residentBytes = residentBytes;
+
+    return s;
+}
+
+// VoxelHitNormal for hits against a cubic block of blockSize voxels
+static Vec3 BlockHitNormal(const Ray& r, Float blockSize)
+{
+    Vec3 block = glm::floor((r.Origin + r.Direction * ((r.MinT + r.MaxT) * 0.5f)) / blockSize) * blockSize;
+    Vec3 t0 = (block - r.Origin) * r.InvDirection;
+    Vec3 t1 = (block + Vec3(blockSize) - r.Origin) * r.InvDirection;
+    Vec3 tNear = glm::min(t0, t1);
+
+    int axis = (tNear.x > tNear.y) ? (tNear.x > tNear.z ? 0 : 2) : (tNear.y > tNear.z ? 1 : 2);
+
+    Vec3 n(0.0f);
+    n[axis] = r.Direction[axis] > 0.0f ? -1.0f : 1.0f;
+    return n;
+}
+
+HitAttributes PagedVoxelScene::GetHitAttributes(const Ray& r) const
+{
+    UInt cell = r.PrimitiveID & ~LodHit;
+    const DirectoryEntry& entry = directory[cell];
+    const ResidentChunk* c = resident[cell];
+
+    if ((r.PrimitiveID & LodHit) || !c) return { BlockHitNormal(r, Float(LodCell)), entry.lodMaterial };
+
+    IVec3 chunk(Int(cell % UInt(gridSize.x)), Int(cell / UInt(gridSize.x) % UInt(gridSize.y)), Int(cell / UInt(gridSize.x * gridSize.y)));
+    IVec3 voxel = IVec3(glm::floor(r.Origin + r.Direction * ((r.MinT + r.MaxT) * 0.5f)));
+    IVec3 local = glm::clamp(voxel - chunk * ChunkSize, IVec3(0), IVec3(ChunkSize - 1));
+
+    UInt index = c->uniform ? 0 : ChunkPaletteIndex(c->rows, c->runWords, c->bits, local);
+    return { VoxelHitNormal(r), c->palette[index] };
+}
+
+Scene::Context* PagedVoxelScene::LaunchRay(ContextArena& arena)
+{
+    return arena.New<PagedContext>();
+}
+
+bool PagedVoxelScene::NextIntersection(Context* ctx, Ray& r)
+{
+    return Traverse(*static_cast<PagedContext*>(ctx), r);
+}
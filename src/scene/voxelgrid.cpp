@@ -0,0 +1,197 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Dense Voxel Grid
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/voxelgrid.h"
+
+VoxelGridScene::VoxelGridScene(IVec3 size)
+    : size(size)
+    , voxels(size_t(size.x) * size_t(size.y) * size_t(size.z), EmptyVoxel)
+{
+}
+
+UInt VoxelGridScene::Get(IVec3 p) const
+{
+    return voxels[Index(p)];
+}
+
+void VoxelGridScene::Set(IVec3 p, UInt material)
+{
+    voxels[Index(p)] = material;
+}
+
+void VoxelGridScene::ApplyEdits(const Voxel* edits, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (VoxelInside(edits[i].position, size)) voxels[Index(edits[i].position)] = edits[i].material;
+    }
+}
+
+size_t VoxelGridScene::SolidVoxels() const
+{
+    size_t count = 0;
+    for (UInt v : voxels)
+    {
+        if (v != EmptyVoxel) count++;
+    }
+    return count;
+}
+
+size_t VoxelGridScene::MemoryUsage() const
+{
+    return voxels.size() * sizeof(UInt);
+}
+
+double VoxelGridScene::BytesPerSolidVoxel() const
+{
+    size_t solid = SolidVoxels();
+    return solid ? double(MemoryUsage()) / double(solid) : 0.0;
+}
+
+HitAttributes VoxelGridScene::GetHitAttributes(const Ray& r) const
+{
+    return { VoxelHitNormal(r), voxels[r.PrimitiveID] };
+}
+
+Scene::Context* VoxelGridScene::LaunchRay(ContextArena& arena)
+{
+    return arena.New<GridContext>();
+}
+
+bool VoxelGridScene::NextIntersection(Context* ctx, Ray& r)
+{
+    return Traverse(*static_cast<GridContext*>(ctx), r);
+}
+
+Scene::Context* VoxelGridScene::LaunchRayPacket(ContextArena& arena, int width)
+{
+    return arena.New<GridPacketContext>();
+}
+
+template <int N>
+LaneMask VoxelGridScene::TraversePacket(GridPacketContext* c, RayPacket<N>& p, LaneMask active)
+{
+    typedef SimdFloat<N> F;
+
+    if (!c->started)
+    {
+        c->started = true;
+
+        // Slab test of all lanes against the grid bounds
+        F ox = F::Load(p.OriginX), oy = F::Load(p.OriginY), oz = F::Load(p.OriginZ);
+        F ix = F::Load(p.InvDirectionX), iy = F::Load(p.InvDirectionY), iz = F::Load(p.InvDirectionZ);
+
+        F t0x = (F::Set1(0.0f) - ox) * ix, t1x = (F::Set1(Float(size.x)) - ox) * ix;
+        F t0y = (F::Set1(0.0f) - oy) * iy, t1y = (F::Set1(Float(size.y)) - oy) * iy;
+        F t0z = (F::Set1(0.0f) - oz) * iz, t1z = (F::Set1(Float(size.z)) - oz) * iz;
+
+        F tEnter = Max(Max(Min(t0x, t1x), Min(t0y, t1y)), Max(Min(t0z, t1z), F::Load(p.MinT)));
+        F tExit = Min(Min(Max(t0x, t1x), Max(t0y, t1y)), Min(Max(t0z, t1z), F::Load(p.MaxT)));
+
+        tEnter.Store(c->t);
+        tExit.Store(c->tExit);
+        c->alive = Less(tEnter, tExit) & active;
+
+        for (LaneMask m = c->alive; m; m &= m - 1)
+        {
+            int lane = LowestLane(m);
+
+            GridDDA dda;
+            dda.Init(p.GetRay(lane), c->t[lane], Vec3(0.0f), 1.0f, size);
+
+            c->cellX[lane] = Float(dda.cell.x);
+            c->cellY[lane] = Float(dda.cell.y);
+            c->cellZ[lane] = Float(dda.cell.z);
+            c->stepX[lane] = Float(dda.step.x);
+            c->stepY[lane] = Float(dda.step.y);
+            c->stepZ[lane] = Float(dda.step.z);
+            c->tNextX[lane] = dda.tNext.x;
+            c->tNextY[lane] = dda.tNext.y;
+            c->tNextZ[lane] = dda.tNext.z;
+            c->tDeltaX[lane] = dda.tDelta.x;
+            c->tDeltaY[lane] = dda.tDelta.y;
+            c->tDeltaZ[lane] = dda.tDelta.z;
+        }
+    }
+
+    F tEnd = Min(F::Load(c->tExit), F::Load(p.MaxT));
+    F zero = F::Set1(0.0f);
+    F sx = F::Set1(Float(size.x)), sy = F::Set1(Float(size.y)), sz = F::Set1(Float(size.z));
+
+    for (;;)
+    {
+        F cx = F::Load(c->cellX), cy = F::Load(c->cellY), cz = F::Load(c->cellZ);
+        F t = F::Load(c->t);
+
+        // Retire lanes that left the grid or the search interval
+        LaneMask outside = Less(cx, zero) | Less(cy, zero) | Less(cz, zero) | LessEqual(sx, cx) | LessEqual(sy, cy) | LessEqual(sz, cz);
+        c->alive &= ~outside & Less(t, tEnd);
+
+        LaneMask lanes = active & c->alive;
+        if (!lanes) return 0;
+
+        // Occupancy lookups are gathers, done per lane
+        LaneMask hits = 0;
+        for (LaneMask m = lanes; m; m &= m - 1)
+        {
+            int lane = LowestLane(m);
+            size_t index = Index(IVec3(Int(c->cellX[lane]), Int(c->cellY[lane]), Int(c->cellZ[lane])));
+
+            if (voxels[index] != EmptyVoxel)
+            {
+                p.MinT[lane] = c->t[lane];
+                p.PrimitiveID[lane] = UInt(index);
+                hits |= LaneMask(1) << lane;
+            }
+        }
+
+        // Step every lane across its nearest cell boundary
+        F tnx = F::Load(c->tNextX), tny = F::Load(c->tNextY), tnz = F::Load(c->tNextZ);
+
+        LaneMask xLess = Less(tnx, tny);
+        LaneMask selX = lanes & xLess & Less(tnx, tnz);
+        LaneMask selY = lanes & ~xLess & Less(tny, tnz);
+        LaneMask selZ = lanes & ~selX & ~selY;
+
+        F tLeave = Min(Min(tnx, tny), tnz);
+
+        Select(selX, cx + F::Load(c->stepX), cx).Store(c->cellX);
+        Select(selY, cy + F::Load(c->stepY), cy).Store(c->cellY);
+        Select(selZ, cz + F::Load(c->stepZ), cz).Store(c->cellZ);
+        Select(selX, tnx + F::Load(c->tDeltaX), tnx).Store(c->tNextX);
+        Select(selY, tny + F::Load(c->tDeltaY), tny).Store(c->tNextY);
+        Select(selZ, tnz + F::Load(c->tDeltaZ), tnz).Store(c->tNextZ);
+        Select(lanes, tLeave, t).Store(c->t);
+
+        if (hits)
+        {
+            alignas(64) Float hitExit[N];
+            Min(tLeave, tEnd).Store(hitExit);
+
+            for (LaneMask m = hits; m; m &= m - 1)
+            {
+                int lane = LowestLane(m);
+                p.MaxT[lane] = hitExit[lane];
+            }
+
+            return hits;
+        }
+    }
+}
+
+LaneMask VoxelGridScene::NextIntersectionPacket(Context* ctx, RayPacket4& p, LaneMask active)
+{
+    return TraversePacket(static_cast<GridPacketContext*>(ctx), p, active);
+}
+
+LaneMask VoxelGridScene::NextIntersectionPacket(Context* ctx, RayPacket8& p, LaneMask active)
+{
+    return TraversePacket(static_cast<GridPacketContext*>(ctx), p, active);
+}
+
+LaneMask VoxelGridScene::NextIntersectionPacket(Context* ctx, RayPacket16& p, LaneMask active)
+{
+    return TraversePacket(static_cast<GridPacketContext*>(ctx), p, active);
+}
@@ -0,0 +1,376 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Scenes - Triangle Mesh Voxelizer
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "scene/voxelizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+#include "profiler.h"
+
+static const size_t ChunkSize = 16384; // Triangles per binning task
+
+static void ForEach(ThreadPool* pool, size_t count, const std::function<void(size_t)>& fn)
+{
+    if (pool)
+    {
+        pool->ParallelFor(count, fn);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++) fn(i);
+    }
+}
+
+static inline Vec3 MeshPosition(const Mesh& m, uint32_t index)
+{
+    return m.vertices[m.vertexOffset + m.indicies[m.indexOffset + index]].position;
+}
+
+bool Voxelizer::Setup(const SourceTriangle& s, IVec3 size, Triangle& t)
+{
+    Vec3 e[3] = { s.v[1] - s.v[0], s.v[2] - s.v[1], s.v[0] - s.v[2] };
+
+    t.n = glm::cross(e[0], e[1]);
+    if (t.n.x == 0.0f && t.n.y == 0.0f && t.n.z == 0.0f) return false;
+
+    // Plane against the box corners furthest along & against the normal
+    Vec3 c(t.n.x > 0.0f ? 1.0f : 0.0f, t.n.y > 0.0f ? 1.0f : 0.0f, t.n.z > 0.0f ? 1.0f : 0.0f);
+    t.d1 = glm::dot(t.n, c - s.v[0]);
+    t.d2 = glm::dot(t.n, Vec3(1.0f) - c - s.v[0]);
+
+    // Projection k drops axis w & keeps (a, b)
+    static const int axisA[3] = { 0, 1, 2 };
+    static const int axisB[3] = { 1, 2, 0 };
+    static const int axisW[3] = { 2, 0, 1 };
+
+    for (int k = 0; k < 3; k++)
+    {
+        int a = axisA[k], b = axisB[k];
+        Float sign = t.n[axisW[k]] >= 0.0f ? 1.0f : -1.0f;
+
+        for (int i = 0; i < 3; i++)
+        {
+            Vec2 ne = Vec2(-e[i][b], e[i][a]) * sign;
+
+            t.ne[k][i] = ne;
+            t.de[k][i] = -(ne.x * s.v[i][a] + ne.y * s.v[i][b]) + glm::max(0.0f, ne.x) + glm::max(0.0f, ne.y);
+        }
+    }
+
+    Vec3 an = glm::abs(t.n);
+    t.dominant = (an.x > an.y) ? (an.x > an.z ? 0 : 2) : (an.y > an.z ? 1 : 2);
+    t.plane = glm::dot(t.n, s.v[0]);
+
+    Vec3 lo = glm::min(glm::min(s.v[0], s.v[1]), s.v[2]);
+    Vec3 hi = glm::max(glm::max(s.v[0], s.v[1]), s.v[2]);
+    t.boundsMin = glm::clamp(IVec3(glm::floor(lo)), IVec3(0), size - IVec3(1));
+    t.boundsMax = glm::clamp(IVec3(glm::floor(hi)), IVec3(0), size - IVec3(1));
+
+    t.material = s.material;
+    return true;
+}
+
+bool Voxelizer::Overlaps(const Triangle& t, IVec3 voxel)
+{
+    Vec3 p(voxel);
+
+    Float np = glm::dot(t.n, p);
+    if ((np + t.d1) * (np + t.d2) > 0.0f) return false;
+
+    static const int axisA[3] = { 0, 1, 2 };
+    static const int axisB[3] = { 1, 2, 0 };
+
+    for (int k = 0; k < 3; k++)
+    {
+        Vec2 q(p[axisA[k]], p[axisB[k]]);
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (glm::dot(t.ne[k][i], q) + t.de[k][i] < 0.0f) return false;
+        }
+    }
+
+    return true;
+}
+
+void Voxelizer::VoxelizeTile(const Triangle& t, IVec3 tileMin, UInt* tile)
+{
+    IVec3 lo = glm::max(t.boundsMin, tileMin);
+    IVec3 hi = glm::min(t.boundsMax, tileMin + IVec3(TileSize - 1));
+    if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z) return;
+
+    // Sweep the columns of the two minor axes, the plane bounds each column along the dominant one
+    int w = t.dominant;
+    int u = (w + 1) % 3;
+    int v = (w + 2) % 3;
+    Float invW = 1.0f / t.n[w];
+
+    for (Int cu = lo[u]; cu <= hi[u]; cu++)
+    {
+        for (Int cv = lo[v]; cv <= hi[v]; cv++)
+        {
+            Float w00 = (t.plane - t.n[u] * Float(cu) - t.n[v] * Float(cv)) * invW;
+            Float du = -t.n[u] * invW;
+            Float dv = -t.n[v] * invW;
+
+            Float wMin = w00 + glm::min(du, 0.0f) + glm::min(dv, 0.0f);
+            Float wMax = w00 + glm::max(du, 0.0f) + glm::max(dv, 0.0f);
+
+            Int first = glm::max(Int(std::floor(wMin)), lo[w]);
+            Int last = glm::min(Int(std::floor(wMax)), hi[w]);
+
+            IVec3 voxel;
+            voxel[u] = cu;
+            voxel[v] = cv;
+
+            for (Int cw = first; cw <= last; cw++)
+            {
+                voxel[w] = cw;
+                if (!Overlaps(t, voxel)) continue;
+
+                IVec3 local = voxel - tileMin;
+                UInt& m = tile[(size_t(local.z) * TileSize + size_t(local.y)) * TileSize + size_t(local.x)];
+
+                // Triangles arrive in mesh order, the first one keeps the voxel
+                if (m == EmptyVoxel) m = t.material;
+            }
+        }
+    }
+}
+
+Voxelizer::Result Voxelizer::Voxelize(const Mesh* meshes, size_t numMeshes, Int resolution, ThreadPool* pool)
+{
+    static_assert(TileSize % BrickMapScene::BrickSize == 0, "Tiles are made of whole bricks");
+
+    PROFILE_ZONE("Voxelize");
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Triangles of mesh i start at firstTriangle[i]
+    std::vector<size_t> firstTriangle(numMeshes + 1, 0);
+    for (size_t i = 0; i < numMeshes; i++)
+        firstTriangle[i + 1] = firstTriangle[i] + meshes[i].count / 3;
+
+    size_t numTriangles = firstTriangle[numMeshes];
+
+    // World bounds of the referenced vertices
+    std::vector<Vec3> meshMin(numMeshes, Vec3(MaxFloat));
+    std::vector<Vec3> meshMax(numMeshes, Vec3(-MaxFloat));
+
+    ForEach(pool, numMeshes, [&](size_t i)
+    {
+        const Mesh& m = meshes[i];
+        for (uint32_t j = 0; j < m.count / 3 * 3; j++)
+        {
+            Vec3 p = MeshPosition(m, j);
+            meshMin[i] = glm::min(meshMin[i], p);
+            meshMax[i] = glm::max(meshMax[i], p);
+        }
+    });
+
+    Vec3 boundsMin(MaxFloat), boundsMax(-MaxFloat);
+    for (size_t i = 0; i < numMeshes; i++)
+    {
+        boundsMin = glm::min(boundsMin, meshMin[i]);
+        boundsMax = glm::max(boundsMax, meshMax[i]);
+    }
+
+    Result result = {};
+    result.triangles = numTriangles;
+
+    if (numTriangles == 0 || resolution <= 0)
+    {
+        result.scene = new BrickMapScene(IVec3(1));
+        result.origin = Vec3(0.0f);
+        result.scale = 1.0f;
+        return result;
+    }
+
+    Vec3 extent = boundsMax - boundsMin;
+    Float longest = glm::max(glm::max(extent.x, extent.y), extent.z);
+
+    result.origin = boundsMin;
+    result.scale = longest > 0.0f ? Float(resolution) / longest : 1.0f;
+
+    IVec3 size = glm::clamp(IVec3(glm::ceil(extent * result.scale)), IVec3(1), IVec3(resolution));
+
+    // Triangles into voxel units
+    std::vector<SourceTriangle> triangles(numTriangles);
+
+    ForEach(pool, numMeshes, [&](size_t i)
+    {
+        const Mesh& m = meshes[i];
+        for (uint32_t j = 0; j < m.count / 3; j++)
+        {
+            SourceTriangle& s = triangles[firstTriangle[i] + j];
+            for (int k = 0; k < 3; k++)
+                s.v[k] = (MeshPosition(m, j * 3 + k) - result.origin) * result.scale;
+
+            s.material = m.vertices[m.vertexOffset + m.indicies[m.indexOffset + j * 3]].materialId + 1;
+        }
+    });
+
+    // Bin triangles into every tile their bounds touch, counting first then filling
+    IVec3 tileGrid = (size + IVec3(TileSize - 1)) / TileSize;
+    size_t numTiles = size_t(tileGrid.x) * size_t(tileGrid.y) * size_t(tileGrid.z);
+
+    auto tileIndex = [&](IVec3 tile)
+    {
+        return (size_t(tile.z) * size_t(tileGrid.y) + size_t(tile.y)) * size_t(tileGrid.x) + size_t(tile.x);
+    };
+
+    auto tileRange = [&](const SourceTriangle& s, IVec3& first, IVec3& last)
+    {
+        Vec3 lo = glm::min(glm::min(s.v[0], s.v[1]), s.v[2]);
+        Vec3 hi = glm::max(glm::max(s.v[0], s.v[1]), s.v[2]);
+        first = glm::clamp(IVec3(glm::floor(lo)), IVec3(0), size - IVec3(1)) / TileSize;
+        last = glm::clamp(IVec3(glm::floor(hi)), IVec3(0), size - IVec3(1)) / TileSize;
+    };
+
+    size_t numChunks = (numTriangles + ChunkSize - 1) / ChunkSize;
+    std::vector<std::atomic<size_t>> tileCursor(numTiles);
+    for (std::atomic<size_t>& c : tileCursor) c.store(0, std::memory_order_relaxed);
+
+    auto bin = [&](bool fill, std::vector<UInt>* references)
+    {
+        ForEach(pool, numChunks, [&](size_t chunk)
+        {
+            size_t end = glm::min(numTriangles, (chunk + 1) * ChunkSize);
+            for (size_t i = chunk * ChunkSize; i < end; i++)
+            {
+                IVec3 first, last;
+                tileRange(triangles[i], first, last);
+
+                for (Int z = first.z; z <= last.z; z++)
+                    for (Int y = first.y; y <= last.y; y++)
+                        for (Int x = first.x; x <= last.x; x++)
+                        {
+                            size_t slot = tileCursor[tileIndex(IVec3(x, y, z))].fetch_add(1, std::memory_order_relaxed);
+                            if (fill) (*references)[slot] = UInt(i);
+                        }
+            }
+        });
+    };
+
+    bin(false, nullptr);
+
+    std::vector<size_t> tileFirst(numTiles + 1, 0);
+    for (size_t i = 0; i < numTiles; i++)
+    {
+        tileFirst[i + 1] = tileFirst[i] + tileCursor[i].load(std::memory_order_relaxed);
+        tileCursor[i].store(tileFirst[i], std::memory_order_relaxed);
+    }
+
+    std::vector<UInt> references(tileFirst[numTiles]);
+    bin(true, &references);
+
+    std::vector<size_t> activeTiles;
+    for (size_t i = 0; i < numTiles; i++)
+        if (tileFirst[i + 1] > tileFirst[i]) activeTiles.push_back(i);
+
+    result.tiles = activeTiles.size();
+
+    // Voxelize each tile into a dense scratch block & keep its non empty bricks
+    const Int BrickSize = BrickMapScene::BrickSize;
+    const Int TileBricks = TileSize / BrickSize;
+
+    struct TileOutput
+    {
+        std::vector<IVec3> coords; // Brick coordinates in the map
+        std::vector<BrickMapScene::Brick> bricks;
+        std::vector<UInt> materials;
+    };
+
+    std::vector<TileOutput> outputs(activeTiles.size());
+
+    ForEach(pool, activeTiles.size(), [&](size_t a)
+    {
+        PROFILE_ZONE("Voxelize Tile");
+
+        size_t index = activeTiles[a];
+        IVec3 tile(Int(index % size_t(tileGrid.x)), Int(index / size_t(tileGrid.x) % size_t(tileGrid.y)), Int(index / (size_t(tileGrid.x) * size_t(tileGrid.y))));
+        IVec3 tileMin = tile * TileSize;
+
+        thread_local std::vector<UInt> block;
+        block.assign(size_t(TileSize) * TileSize * TileSize, EmptyVoxel);
+
+        // Binning order is racy, mesh order is restored for the first wins rule
+        std::sort(references.begin() + tileFirst[index], references.begin() + tileFirst[index + 1]);
+
+        for (size_t r = tileFirst[index]; r < tileFirst[index + 1]; r++)
+        {
+            Triangle t;
+            if (Setup(triangles[references[r]], size, t))
+                VoxelizeTile(t, tileMin, block.data());
+        }
+
+        TileOutput& out = outputs[a];
+
+        for (Int bz = 0; bz < TileBricks; bz++)
+            for (Int by = 0; by < TileBricks; by++)
+                for (Int bx = 0; bx < TileBricks; bx++)
+                {
+                    BrickMapScene::Brick brick = {};
+                    bool solid = false;
+
+                    for (Int z = 0; z < BrickSize; z++)
+                        for (Int y = 0; y < BrickSize; y++)
+                            for (Int x = 0; x < BrickSize; x++)
+                            {
+                                IVec3 local = IVec3(bx, by, bz) * BrickSize + IVec3(x, y, z);
+                                if (block[(size_t(local.z) * TileSize + size_t(local.y)) * TileSize + size_t(local.x)] == EmptyVoxel) continue;
+
+                                brick.occupancy[z] |= 1ull << (x + y * BrickSize);
+                                solid = true;
+                            }
+
+                    if (!solid) continue;
+
+                    out.coords.push_back(tile * TileBricks + IVec3(bx, by, bz));
+                    out.bricks.push_back(brick);
+
+                    for (Int z = 0; z < BrickSize; z++)
+                        for (Int y = 0; y < BrickSize; y++)
+                            for (Int x = 0; x < BrickSize; x++)
+                            {
+                                IVec3 local = IVec3(bx, by, bz) * BrickSize + IVec3(x, y, z);
+                                out.materials.push_back(block[(size_t(local.z) * TileSize + size_t(local.y)) * TileSize + size_t(local.x)]);
+                            }
+                }
+    });
+
+    // Bricks of a tile stay next to each other in the map
+    BrickMapScene* scene = new BrickMapScene(size);
+
+    std::vector<size_t> firstBrick(outputs.size() + 1, 0);
+    for (size_t a = 0; a < outputs.size(); a++)
+        firstBrick[a + 1] = firstBrick[a] + outputs[a].bricks.size();
+
+    scene->bricks.resize(firstBrick[outputs.size()]);
+    scene->materials.resize(firstBrick[outputs.size()] * BrickMapScene::BrickVoxels);
+
+    ForEach(pool, outputs.size(), [&](size_t a)
+    {
+        TileOutput& out = outputs[a];
+
+        for (size_t i = 0; i < out.bricks.size(); i++)
+        {
+            size_t b = firstBrick[a] + i;
+            scene->bricks[b] = out.bricks[i];
+            scene->grid[scene->GridIndex(out.coords[i])] = UInt(b);
+        }
+
+        std::copy(out.materials.begin(), out.materials.end(), scene->materials.begin() + firstBrick[a] * BrickMapScene::BrickVoxels);
+        out = TileOutput();
+    });
+
+    result.scene = scene;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return result;
+}
@@ -0,0 +1,212 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Work Stealing Thread Pool
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+#include "threadpool.h"
+
+#include <chrono>
+#include <string>
+
+#include "profiler.h"
+
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local int currentIndex = -1;
+static thread_local int runDepth = 0; // Tasks waiting on nested groups must not count busy time twice
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool& pool)
+    : pool(pool)
+{
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+    Wait();
+}
+
+void ThreadPool::TaskGroup::Run(Task task)
+{
+    pending.fetch_add(1, std::memory_order_relaxed);
+    pool.Push({ std::move(task), &pending });
+}
+
+void ThreadPool::TaskGroup::Wait()
+{
+    int self = pool.ThreadIndex();
+
+    while (pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!pool.TryRunOne(self))
+            std::this_thread::yield();
+    }
+}
+
+ThreadPool::ThreadPool(size_t numWorkers)
+{
+    if (numWorkers == 0)
+    {
+        size_t hardwareThreads = std::thread::hardware_concurrency();
+        numWorkers = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    numThreads = numWorkers + 1;
+    queues.reset(new Queue[numThreads]);
+    counters.reset(new Counters[numThreads]);
+
+    for (size_t i = 0; i < numWorkers; i++)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, int(i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        shutdown = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& t : workers)
+        t.join();
+}
+
+int ThreadPool::ThreadIndex() const
+{
+    return (currentPool == this) ? currentIndex : int(numThreads - 1);
+}
+
+void ThreadPool::Push(Job job)
+{
+    Queue& q = queues[ThreadIndex()];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.jobs.push_back(std::move(job));
+    }
+
+    queued.fetch_add(1, std::memory_order_release);
+
+    // Taking the lock orders us against a worker that is about to sleep
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::TryRunOne(int self)
+{
+    Job job;
+    bool found = false;
+    bool stolen = false;
+
+    // Own work first, newest first
+    {
+        Queue& q = queues[self];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.jobs.empty())
+        {
+            job = std::move(q.jobs.back());
+            q.jobs.pop_back();
+            found = true;
+        }
+    }
+
+    // Steal the oldest job of someone else
+    size_t numQueues = NumThreads();
+    for (size_t i = 1; !found && i < numQueues; i++)
+    {
+        Queue& q = queues[(self + i) % numQueues];
+        std::unique_lock<std::mutex> lock(q.mutex, std::try_to_lock);
+        if (lock.owns_lock() && !q.jobs.empty())
+        {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            found = true;
+            stolen = true;
+        }
+    }
+
+    if (!found) return false;
+
+    queued.fetch_sub(1, std::memory_order_relaxed);
+
+    auto start = std::chrono::steady_clock::now();
+    runDepth++;
+    job.task();
+    runDepth--;
+    auto end = std::chrono::steady_clock::now();
+
+    Counters& c = counters[self];
+    if (runDepth == 0)
+        c.busyNanoseconds.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()), std::memory_order_relaxed);
+    c.tasks.fetch_add(1, std::memory_order_relaxed);
+    if (stolen) c.steals.fetch_add(1, std::memory_order_relaxed);
+
+    job.pending->fetch_sub(1, std::memory_order_release);
+
+    return true;
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    currentPool = this;
+    currentIndex = index;
+
+    Profiler::SetThreadName("Worker " + std::to_string(index));
+
+    for (;;)
+    {
+        if (TryRunOne(index)) continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&]() { return shutdown || queued.load(std::memory_order_acquire) > 0; });
+
+        if (shutdown) return;
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+    if (count == 0) return;
+
+    TaskGroup group(*this);
+
+    // Keep the lower half, hand the upper half out, so the first steal takes half of the range
+    std::function<void(size_t, size_t)> split = [&](size_t begin, size_t end)
+    {
+        while (end - begin > 1)
+        {
+            size_t mid = begin + (end - begin) / 2;
+            group.Run([&split, mid, end]() { split(mid, end); });
+            end = mid;
+        }
+
+        fn(begin);
+    };
+
+    // Even the caller's share goes through the queue so it shows up in the stats
+    group.Run([&split, count]() { split(0, count); });
+    group.Wait();
+}
+
+std::vector<ThreadPool::ThreadStats> ThreadPool::GetStats() const
+{
+    std::vector<ThreadStats> stats(NumThreads());
+
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+        stats[i].busySeconds = double(counters[i].busyNanoseconds.load(std::memory_order_relaxed)) * 1e-9;
+        stats[i].tasks = counters[i].tasks.load(std::memory_order_relaxed);
+        stats[i].steals = counters[i].steals.load(std::memory_order_relaxed);
+    }
+
+    return stats;
+}
+
+void ThreadPool::ResetStats()
+{
+    for (size_t i = 0; i < NumThreads(); i++)
+    {
+        counters[i].busyNanoseconds.store(0, std::memory_order_relaxed);
+        counters[i].tasks.store(0, std::memory_order_relaxed);
+        counters[i].steals.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,247 @@
+// -------------------------------------------------------------------------------
+// VoxelRaytracer - Allocation Test
+// -------------------------------------------------------------------------------
+//  Cheng (Bob) Cao 2020
+
+// Tracing must not touch the heap once the per thread arenas & batch scratch are warmed up.
+// Counts every global operator new while the same rays are traced a second time.
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "raytracing.h"
+#include "scene/bvh.h"
+#include "scene/bvh8.h"
+#include "scene/brickmap.h"
+#include "scene/demo.h"
+#include "scene/voxelgrid.h"
+
+static std::atomic<size_t> allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+// Over aligned types (the arena blocks) come through these, libstdc++ doesn't route them to the ones above
+static void* AlignedAlloc(size_t size, std::align_val_t alignment) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    size_t align = size_t(alignment);
+    size = (glm::max(size, size_t(1)) + align - 1) & ~(align - 1);
+#ifdef _WIN32
+    return _aligned_malloc(size, align);
+#else
+    return std::aligned_alloc(align, size);
+#endif
+}
+
+static void AlignedFree(void* p) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    if (void* p = AlignedAlloc(size, alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return AlignedAlloc(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return AlignedAlloc(size, alignment);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { AlignedFree(p); }
+
+static std::vector<Ray> TestRays(IVec3 size)
+{
+    std::vector<Ray> rays;
+    Vec3 center = Vec3(size) * 0.5f;
+
+    for (int i = 0; i < 4096; i++)
+    {
+        Float a = Float(i) * 0.0061f;
+        Float b = Float(i % 64) / 64.0f - 0.5f;
+        Vec3 origin = center + Vec3(std::cos(a), 0.4f, std::sin(a)) * Float(size.x);
+        rays.push_back(Ray(origin, glm::normalize(center - origin + Vec3(b * 8.0f, b * 4.0f, -b * 8.0f))));
+    }
+
+    return rays;
+}
+
+// All tracing entry points over rays, returns the allocations of the second pass
+template <typename SceneT>
+static size_t Trace(SceneT& sc, const std::vector<Ray>& rays)
+{
+    RayTracing rt;
+    std::vector<Ray> batch = rays;
+    std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+
+    size_t before = 0;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1) before = allocations.load();
+
+        for (Ray r : rays)
+        {
+            rt.TraceRay(sc, r);
+            rt.TraceRay(static_cast<Scene*>(&sc), r, RayTracing::AnyHitBehavior::COMMIT_AND_RETURN);
+            rt.TraceOcclusion(sc, r);
+            rt.TraceOcclusion(static_cast<Scene*>(&sc), r);
+        }
+
+        for (size_t i = 0; i + 16 <= rays.size(); i += 16)
+        {
+            RayPacket4 p4;
+            RayPacket8 p8;
+            RayPacket16 p16;
+            for (int lane = 0; lane < 16; lane++)
+            {
+                if (lane < 4) p4.SetRay(lane, rays[i + lane]);
+                if (lane < 8) p8.SetRay(lane, rays[i + lane]);
+                p16.SetRay(lane, rays[i + lane]);
+            }
+
+            rt.TraceRayPacket(&sc, p4);
+            rt.TraceRayPacket(&sc, p8);
+            rt.TraceRayPacket(&sc, p16);
+            rt.TraceOcclusionPacket(&sc, p16);
+        }
+
+        batch = rays;
+        rt.TraceRays(&sc, batch.data(), batch.size());
+        rt.TraceOcclusions(&sc, batch.data(), batch.size(), occluded.get());
+    }
+
+    return allocations.load() - before;
+}
+
+static int Check(const char* name, size_t count)
+{
+    std::printf("%s: %zu allocations\n", name, count);
+    return count == 0 ? 0 : 1;
+}
+
+int main()
+{
+    int failures = 0;
+
+    // The counter has to see the heap at all for a 0 to mean anything
+    size_t probe = allocations.load();
+    int* volatile p = new int(0);
+    delete p;
+    if (allocations.load() == probe)
+    {
+        std::printf("operator new is not replaced\n");
+        return 1;
+    }
+
+    struct alignas(64) Aligned
+    {
+        char bytes[64];
+    };
+
+    probe = allocations.load();
+    Aligned* volatile a = new Aligned();
+    delete a;
+    if (allocations.load() == probe)
+    {
+        std::printf("aligned operator new is not replaced\n");
+        return 1;
+    }
+
+    std::unique_ptr<BrickMapScene> bricks(CreateDemoScene());
+    IVec3 size = bricks->Size();
+    std::vector<Ray> rays = TestRays(size);
+
+    VoxelGridScene grid(size);
+    for (Int z = 0; z < size.z; z++)
+        for (Int y = 0; y < size.y; y++)
+            for (Int x = 0; x < size.x; x++)
+                grid.Set(IVec3(x, y, z), bricks->Get(IVec3(x, y, z)));
+
+    failures += Check("voxelgrid", Trace(grid, rays));
+    failures += Check("brickmap", Trace(*bricks, rays));
+
+    // Two triangles per cell of a heightfield
+    const Int cells = 64;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    for (Int z = 0; z <= cells; z++)
+    {
+        for (Int x = 0; x <= cells; x++)
+        {
+            Vertex v = {};
+            v.position = Vec3(Float(x), 8.0f + 4.0f * std::sin(Float(x) * 0.3f) * std::cos(Float(z) * 0.2f), Float(z)) * Float(size.x) / Float(cells);
+            v.normal = Vec3(0.0f, 1.0f, 0.0f);
+            vertices.push_back(v);
+        }
+    }
+    for (Int z = 0; z < cells; z++)
+    {
+        for (Int x = 0; x < cells; x++)
+        {
+            uint32_t i = uint32_t(z * (cells + 1) + x);
+            uint32_t row = uint32_t(cells + 1);
+            indices.insert(indices.end(), { i, i + row, i + 1, i + 1, i + row, i + row + 1 });
+        }
+    }
+    Mesh mesh = { uint32_t(indices.size()), 0, 0, vertices.data(), indices.data() };
+
+    BVHScene bvh(&mesh, 1);
+    BVH8Scene bvh8(&mesh, 1);
+
+    failures += Check("bvh", Trace(bvh, rays));
+    failures += Check("bvh8", Trace(bvh8, rays));
+
+    return failures == 0 ? 0 : 1;
+}